@@ -0,0 +1,169 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "acceptor.hpp"
+#include "reactor.hpp"
+#include "tcp.hpp"
+
+/*
+  Per-source and total limits on queued connections, a release freeing a
+  slot, the backlog counters, then a reactor-driven acceptor that pauses
+  under pressure and comes back in small batches, also when a rejection
+  used up a batch, and a drain that gives up on a socket which is not
+  listening.
+ */
+int connect_from(const char *source, const unsigned short port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  inet_pton(AF_INET, source, &addr.sin_addr);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1)
+    return -1;
+
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1)
+    return -1;
+  return fd;
+}
+
+int main() {
+  tcp_resolver r;
+  auto results = r.resolve("127.0.0.1", "9120");
+  tcp_socket listener;
+  if (!listener.bind(results[0], true) || !listener.listen(64) ||
+      !listener.set_nonblocking())
+    return EXIT_FAILURE;
+
+  admission_policy policy;
+  policy.max_connections = 3;
+  policy.max_per_source = 2;
+  acceptor<tcp_socket> limited(listener, policy);
+
+  std::vector<int> clients;
+  for (const char *source :
+       {"127.0.0.1", "127.0.0.1", "127.0.0.1", "127.0.0.2", "127.0.0.2"})
+    clients.push_back(connect_from(source, 9120));
+  for (int fd : clients)
+    if (fd == -1)
+      return EXIT_FAILURE;
+
+  std::vector<tcp_socket> served;
+  auto keep = [&](tcp_socket client, const endpoint &) {
+    served.push_back(std::move(client));
+  };
+  if (limited.drain(keep) != 3 || limited.connections() != 3 ||
+      limited.stats.rejected_source != 1 || limited.stats.deferred_full == 0)
+    return EXIT_FAILURE;
+
+  // the third connection from 127.0.0.1 was closed on arrival.
+  char byte;
+  if (recv(clients[2], &byte, 1, 0) != 0)
+    return EXIT_FAILURE;
+
+  const listen_counters counters = limited.counters();
+  std::cout << "Queued: " << counters.queued << " Backlog: " << counters.backlog
+            << " Overflows: " << counters.overflows << std::endl;
+  if (counters.queued != 1 || counters.backlog != 64)
+    return EXIT_FAILURE;
+
+  // the client closes first, so TIME_WAIT stays off the listening port.
+  close(clients[0]);
+  limited.release(served[0].sockfd);
+  served[0].close();
+  if (limited.drain(keep) != 1 || limited.connections() != 3)
+    return EXIT_FAILURE;
+
+  for (std::size_t i = 1; i < std::size(clients); i++)
+    close(clients[i]);
+  clients.clear();
+  for (auto &client : served) {
+    limited.release(client.sockfd);
+    client.close();
+  }
+  served.clear();
+
+  bool pressure = true;
+  admission_policy paced;
+  paced.batch = 2;
+  paced.pause_ms = 20;
+  paced.under_pressure = [&] { return pressure; };
+  reactor loop;
+  acceptor<tcp_socket> acc(listener, paced);
+  if (!acc.attach(loop, keep))
+    return EXIT_FAILURE;
+
+  for (int i = 0; i < 5; i++)
+    clients.push_back(connect_from("127.0.0.1", 9120));
+  for (int i = 0; i < 5; i++)
+    loop.run_once(10);
+  if (acc.stats.accepted != 0 || acc.stats.pauses == 0)
+    return EXIT_FAILURE;
+
+  pressure = false;
+  const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (acc.stats.accepted != 5 && std::chrono::steady_clock::now() < until)
+    loop.run_once(10);
+
+  std::cout << "Accepted: " << acc.stats.accepted
+            << " Pauses: " << acc.stats.pauses << std::endl;
+  acc.detach();
+  for (int fd : clients)
+    close(fd);
+  clients.clear();
+  for (auto &client : served)
+    client.close();
+  served.clear();
+  if (acc.stats.accepted != 5)
+    return EXIT_FAILURE;
+
+  // a rejection uses up the batch without a hand-out, the connection left
+  // queued behind it must still be picked up.
+  admission_policy strict;
+  strict.max_per_source = 1;
+  strict.batch = 2;
+  acceptor<tcp_socket> once(listener, strict);
+  if (!once.attach(loop, keep))
+    return EXIT_FAILURE;
+
+  for (const char *source : {"127.0.0.1", "127.0.0.1", "127.0.0.2"})
+    clients.push_back(connect_from(source, 9120));
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (once.stats.accepted != 2 &&
+         std::chrono::steady_clock::now() < deadline)
+    loop.run_once(10);
+
+  std::cout << "Accepted: " << once.stats.accepted
+            << " Rejected: " << once.stats.rejected_source << std::endl;
+  once.detach();
+  for (int fd : clients)
+    close(fd);
+  for (auto &client : served)
+    client.close();
+  listener.close();
+  if (once.stats.accepted != 2 || once.stats.rejected_source != 1)
+    return EXIT_FAILURE;
+
+  // accept on a socket that never listened fails the same way every time,
+  // an unlimited batch has to give up after one error instead of spinning.
+  tcp_socket idle;
+  if (!idle.bind(r.resolve("127.0.0.1", "0")[0]) || !idle.set_nonblocking())
+    return EXIT_FAILURE;
+  admission_policy unlimited;
+  unlimited.batch = 0;
+  acceptor<tcp_socket> broken(idle, unlimited);
+  const bool gave_up = broken.drain(keep) == 0 && broken.stats.errors == 1 &&
+                       !broken.exhausted;
+  idle.close();
+  std::cout << "Errors on a non-listening socket: " << broken.stats.errors
+            << std::endl;
+  return gave_up ? EXIT_SUCCESS : EXIT_FAILURE;
+}
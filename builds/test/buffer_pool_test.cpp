@@ -0,0 +1,128 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "buffer_pool.hpp"
+#include "tcp.hpp"
+
+/*
+  find() against std::string::find with matches across block edges,
+  zero-copy slices keeping blocks alive, the limit, block reuse, then a
+  megabyte through operator>> and through a chain with a smaller limit.
+ */
+int main() {
+  std::mt19937 generator(7);
+  std::uniform_int_distribution<int> letter('a', 'c');
+
+  std::string reference;
+  buffer_chain chain;
+  while (std::size(reference) < 5 * buffer_pool::capacity) {
+    auto space = chain.prepare();
+    // uneven writes, so blocks end at varying points of the text.
+    const std::size_t n = std::min<std::size_t>(std::size(space), 777);
+    for (std::size_t i = 0; i < n; i++) {
+      const char c = letter(generator);
+      space[i] = std::byte(c);
+      reference.push_back(c);
+    }
+    chain.commit(n);
+  }
+
+  for (const std::string needle : {"abcab", "cccc", "\r\n\r\n", "a"})
+    for (std::size_t from = 0; from < std::size(reference); from += 997)
+      if (chain.find(needle, from) != reference.find(needle, from)) {
+        std::cerr << "find(" << needle << ", " << from << ") mismatch."
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+  if (chain.to_string() != reference)
+    return EXIT_FAILURE;
+
+  // two matches straddle the edge, from skips the first.
+  buffer_chain edge;
+  for (const std::string &block :
+       {std::string(buffer_pool::capacity - 2, 'x') + "aa", std::string("aab")}) {
+    auto space = edge.prepare();
+    std::memcpy(std::data(space), block.data(), std::size(block));
+    edge.commit(std::size(block));
+  }
+  const std::size_t base = buffer_pool::capacity;
+  if (edge.find("aaa", base - 2) != base - 2 ||
+      edge.find("aaa", base - 1) != base - 1 || edge.find("aaa", base) != buffer_chain::npos)
+    return EXIT_FAILURE;
+  edge.clear();
+
+  // a slice outlives the bytes it was cut from.
+  const std::size_t at = buffer_pool::capacity - 10;
+  buffer_chain part = chain.slice(at, 100);
+  chain.consume(at + 50);
+  if (part.to_string() != reference.substr(at, 100) ||
+      chain.to_string() != reference.substr(at + 50))
+    return EXIT_FAILURE;
+  chain.clear();
+  part.clear();
+
+  buffer_chain bounded(10000);
+  std::size_t taken = 0;
+  for (auto space = bounded.prepare(); !space.empty();
+       space = bounded.prepare()) {
+    bounded.commit(std::size(space));
+    taken += std::size(space);
+  }
+  if (taken != 10000)
+    return EXIT_FAILURE;
+
+  buffer_block *first = buffer_pool::acquire();
+  buffer_pool::release(first);
+  buffer_block *second = buffer_pool::acquire();
+  buffer_pool::release(second);
+  if (first != second)
+    return EXIT_FAILURE;
+
+  tcp_resolver r;
+  auto results = r.resolve("127.0.0.1", "9118");
+  tcp_socket serv_sock;
+  if (!serv_sock.bind(results[0]) || !serv_sock.listen(1))
+    return EXIT_FAILURE;
+
+  const std::string payload(1 << 20, 'z');
+  std::thread server([&] {
+    tcp_socket client = serv_sock.accept();
+    client.send(payload);
+    client.close();
+  });
+
+  tcp_socket sock;
+  if (!sock.connect(results[0]))
+    return EXIT_FAILURE;
+  std::string received;
+  sock >> received;
+  sock.close();
+  server.join();
+  serv_sock.close();
+
+  // a stream far past the chain's limit still arrives whole.
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1)
+    return EXIT_FAILURE;
+  tcp_socket writer, reader;
+  writer.sockfd = pair[0];
+  reader.sockfd = pair[1];
+  std::thread feeder([&] {
+    writer.send(payload);
+    writer.close();
+  });
+  buffer_chain small(10000);
+  std::string streamed;
+  small.receive_all(reader, streamed);
+  feeder.join();
+  reader.close();
+
+  std::cout << "Received: " << std::size(received)
+            << " Past the limit: " << std::size(streamed) << std::endl;
+  return received == payload && streamed == payload ? EXIT_SUCCESS
+                                                    : EXIT_FAILURE;
+}
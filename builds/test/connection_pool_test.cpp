@@ -0,0 +1,167 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "connection_pool.hpp"
+#include "http.hpp"
+#include "https.hpp"
+
+/*
+  A connection handed back is reused by the next http_socket, the per
+  host cap refuses a third lease, a connection the server closed while
+  idle is dropped instead of reused and idle ones expire. Then one TLS
+  session carrying sized and chunked responses across https_sockets
+  until the server asks to close, and an https_socket the pool refuses
+  staying unconnected.
+ */
+using pool_type = connection_pool<tcp_socket>;
+
+std::vector<std::byte> bytes(const std::string &s) {
+  std::vector<std::byte> out(std::size(s));
+  std::copy_n(reinterpret_cast<const std::byte *>(s.data()), std::size(s),
+              out.data());
+  return out;
+}
+
+bool echoes(http_socket &hs, const std::string &s) {
+  const auto sent = bytes(s);
+  return hs.request<std::vector<std::byte>, std::vector<std::byte>>(sent) ==
+         sent;
+}
+
+int main() {
+  http_resolver r;
+  auto results = r.resolve("127.0.0.1", "9122");
+  http_socket listener;
+  if (!listener.bind(results[0], true) || !listener.listen(4))
+    return EXIT_FAILURE;
+
+  // echoes each connection until it ends, closes after "bye".
+  std::vector<std::thread> handlers;
+  std::thread server([&] {
+    for (int i = 0; i < 2; i++) {
+      http_socket client = listener.accept();
+      handlers.emplace_back([client]() mutable {
+        while (true) {
+          std::vector<std::byte> data;
+          client.receive(data);
+          if (data.empty())
+            break;
+          client.respond(data);
+          if (data == bytes("bye"))
+            break;
+        }
+        client.close();
+      });
+    }
+  });
+
+  pool_type::limits limits;
+  limits.max_idle_per_host = 2;
+  limits.max_per_host = 2;
+  limits.idle_timeout = std::chrono::milliseconds(200);
+  limits.acquire_timeout = std::chrono::milliseconds(50);
+  pool_type pool(limits);
+
+  http_socket a, b, c, d, e;
+  for (auto *hs : {&a, &b, &c, &d, &e})
+    hs->pool = &pool;
+
+  bool ok = a.connect(results[0]) && echoes(a, "one");
+  const int first = a.internal.sockfd;
+  a.close();
+  ok = ok && pool.idle() == 1;
+
+  ok = ok && b.connect(results[0]) && b.internal.sockfd == first &&
+       echoes(b, "two") && pool.reused == 1;
+
+  // b and c hold both allowed connections, d has to give up.
+  ok = ok && c.connect(results[0]) && echoes(c, "bye");
+  ok = ok && !d.connect(results[0]) && pool.refused == 1;
+
+  b.close();
+  c.close();
+  ok = ok && pool.idle() == 2;
+
+  // c's connection is the most recent but closed by the server.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ok = ok && e.connect(results[0]) && e.internal.sockfd == first &&
+       echoes(e, "three") && pool.dead == 1;
+  e.close();
+
+  std::this_thread::sleep_for(limits.idle_timeout + std::chrono::milliseconds(50));
+  pool.prune();
+  ok = ok && pool.idle() == 0 && pool.created == 2;
+
+  server.join();
+  for (auto &h : handlers)
+    h.join();
+  listener.close();
+
+  std::cout << "Reused: " << pool.reused << " Created: " << pool.created
+            << " Dead: " << pool.dead << " Refused: " << pool.refused
+            << std::endl;
+
+  auto tls_results = r.resolve("127.0.0.1", "9124");
+  ssl_socket tls_listener;
+  if (!tls_listener.bind(tls_results[0], true) || !tls_listener.listen(1))
+    return EXIT_FAILURE;
+
+  const std::vector<std::string> replies = {
+      "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nsized",
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "7\r\nchunked\r\n0\r\n\r\n",
+      "HTTP/1.1 200 OK\r\nContent-Length: 4\r\nConnection: close\r\n\r\n"
+      "last"};
+  std::thread tls_server([&] {
+    ssl_socket client = tls_listener.accept();
+    buffer_chain received;
+    for (const auto &reply : replies) {
+      http_parser head(http_parser::kind::request);
+      while (head.parse(received) == http_parse_status::incomplete)
+        if (received.receive(client) <= 0)
+          return;
+      received.consume(head.head_length);
+      client.send(reply);
+    }
+    // the client closes first, so TIME_WAIT stays off the listening port.
+    char byte;
+    SSL_read(client.ssl, &byte, 1);
+    client.close();
+  });
+
+  connection_pool<ssl_socket> tls_pool;
+  SSL *session = nullptr;
+  bool tls_ok = true;
+  for (const auto &reply : replies) {
+    https_socket hs;
+    hs.pool = &tls_pool;
+    hs.connect(tls_results);
+    if (session == nullptr)
+      session = hs.internal.ssl;
+    tls_ok = tls_ok && hs.internal.ssl == session &&
+             hs.request("GET / HTTP/1.1\r\nHost: localhost\r\n\r\n") == reply;
+    hs.close();
+  }
+  tls_ok = tls_ok && tls_pool.reused == 2 && tls_pool.created == 1 &&
+           tls_pool.idle() == 0;
+  tls_server.join();
+
+  // no connection allowed at all, connect must not go around the pool.
+  connection_pool<ssl_socket>::limits none;
+  none.max_per_host = 0;
+  none.acquire_timeout = std::chrono::milliseconds(10);
+  connection_pool<ssl_socket> closed_pool(none);
+  https_socket refused;
+  refused.pool = &closed_pool;
+  refused.connect(tls_results);
+  tls_ok = tls_ok && refused.internal.sockfd == -1 && closed_pool.refused == 1;
+  tls_listener.close();
+
+  std::cout << "TLS reused: " << tls_pool.reused
+            << " Created: " << tls_pool.created << std::endl;
+  return ok && tls_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
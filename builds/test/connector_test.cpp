@@ -0,0 +1,85 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "tcp.hpp"
+
+/*
+  A blackholed and a refused address ahead of a live listener, the race
+  should still connect well within the first attempt delay or two, also
+  with the low_latency profile's TCP Fast Open.
+ */
+bool reaches(const tcp_socket &sock, const unsigned short port) {
+  sockaddr_in peer{};
+  socklen_t len = sizeof(peer);
+  return sock.sockfd != -1 &&
+         getpeername(sock.sockfd, reinterpret_cast<sockaddr *>(&peer), &len) ==
+             0 &&
+         ntohs(peer.sin_port) == port;
+}
+
+int main() {
+  tcp_resolver r;
+  auto live = r.resolve("127.0.0.1", "9112");
+
+  // with server side TFO enabled on the host, the first connection
+  // caches a cookie for 127.0.0.1, the refused port shares it.
+  tcp_socket serv_sock;
+  serv_sock.profile = socket_profile::low_latency();
+  if (!serv_sock.bind(live[0]) || !serv_sock.listen(8))
+    return EXIT_FAILURE;
+
+  std::vector<endpoint> endpoints;
+  for (auto &ep : r.resolve("192.0.2.1", "9")) // TEST-NET-1, never answers.
+    endpoints.push_back(ep);
+  for (auto &ep : r.resolve("127.0.0.1", "1")) // nothing listens here.
+    endpoints.push_back(ep);
+  endpoints.insert(std::end(endpoints), std::begin(live), std::end(live));
+
+  const auto start = std::chrono::steady_clock::now();
+  tcp_socket sock;
+  sock.profile = socket_profile::low_latency();
+  const bool connected = sock.connect(endpoints, 2000);
+  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+
+  // a connection that did not reach the listener would block accept.
+  const bool accepted = connected && reaches(sock, 9112);
+  std::cout << "Connected: " << accepted << " in " << elapsed.count() << "ms"
+            << std::endl;
+  tcp_socket client;
+  if (accepted) {
+    sock.send(std::string("cookie"));
+    client = serv_sock.accept();
+  }
+
+  // the client closes first, so TIME_WAIT stays off the listening port.
+  sock.close();
+  client.close();
+
+  // the same race again, a deferred Fast Open connect must not win it.
+  tcp_socket fast;
+  fast.profile = socket_profile::low_latency();
+  const bool fast_connected = fast.connect(endpoints, 2000);
+  const int probe = connector::start(live[0], fast.profile);
+  int fastopen_connect = -1;
+  socklen_t option_len = sizeof(fastopen_connect);
+  getsockopt(probe, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &fastopen_connect,
+             &option_len);
+  ::close(probe);
+  const bool reached_live = fast_connected && reaches(fast, 9112);
+  std::cout << "Fast open race reached the listener: " << reached_live
+            << std::endl;
+
+  fast.close();
+  if (reached_live) {
+    tcp_socket fast_client = serv_sock.accept();
+    fast_client.close();
+  }
+  serv_sock.close();
+  return accepted && elapsed.count() < 1000 && reached_live &&
+                 fastopen_connect == 0
+             ? EXIT_SUCCESS
+             : EXIT_FAILURE;
+}
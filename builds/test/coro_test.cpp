@@ -0,0 +1,74 @@
+#include <array>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "coro.hpp"
+#include "tcp.hpp"
+
+/*
+  Echo server and a few hundred clients as coroutines on one thread.
+ */
+constexpr std::size_t client_count = 256;
+std::size_t echoed = 0;
+
+task<void> echo(tcp_socket client) {
+  std::array<char, 256> buf;
+  ssize_t n;
+  while ((n = co_await async_receive(client, buf)) > 0)
+    if (co_await async_send(client, std::string_view(std::data(buf), n)) == -1)
+      break;
+
+  scheduler::current().close(client);
+}
+
+task<void> serve(tcp_socket &listener) {
+  for (std::size_t i = 0; i < client_count; i++) {
+    tcp_socket client = co_await async_accept(listener);
+    if (client.sockfd == -1)
+      break;
+    scheduler::current().spawn(echo(client));
+  }
+
+  scheduler::current().close(listener);
+}
+
+task<void> request(const endpoint ep, const std::size_t id) {
+  tcp_socket sock;
+  if (!co_await async_connect(sock, ep))
+    co_return;
+
+  const std::string message = "ping " + std::to_string(id);
+  std::array<char, 256> buf;
+  std::string reply;
+  if (co_await async_send(sock, message) != -1)
+    while (std::size(reply) < std::size(message)) {
+      const ssize_t n = co_await async_receive(sock, buf);
+      if (n <= 0)
+        break;
+      reply.append(std::data(buf), n);
+    }
+
+  if (reply == message)
+    echoed++;
+  scheduler::current().close(sock);
+}
+
+int main() {
+  tcp_resolver r;
+  auto results = r.resolve("127.0.0.1", "9110");
+
+  tcp_socket listener;
+  if (!listener.bind(results[0]) || !listener.listen(512))
+    return EXIT_FAILURE;
+
+  scheduler sched;
+  sched.spawn(serve(listener));
+  for (std::size_t i = 0; i < client_count; i++)
+    sched.spawn(request(results[0], i));
+  sched.run();
+
+  std::cout << "Echoed " << echoed << " of " << client_count << " clients"
+            << std::endl;
+  return echoed == client_count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,277 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "http.hpp"
+#include "http_parser.hpp"
+
+/*
+  Heads fed a byte at a time and across buffer blocks, the framing
+  headers, malformed heads, pipelined requests, chunked bodies, then two
+  requests on one kept-alive http_socket connection, a streamed,
+  chunked response, body format negotiation with new and old peers and
+  a body claiming more than the buffer limit.
+ */
+bool fails(const http_parser::kind k, const std::string_view head) {
+  http_parser parser(k);
+  return parser.parse(head) == http_parse_status::error;
+}
+
+int main() {
+  const std::string response = "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/plain \r\n"
+                               "Content-Length: 5\r\n"
+                               "Connection: close\r\n"
+                               "\r\n"
+                               "hello";
+  http_parser parser;
+  for (std::size_t n = 1; n < std::size(response); n++) {
+    const http_parse_status status =
+        parser.parse(std::string_view(response).substr(0, n));
+    const bool whole = n >= std::size(response) - 5;
+    if (status != (whole ? http_parse_status::done
+                         : http_parse_status::incomplete))
+      return EXIT_FAILURE;
+  }
+  if (parser.status != 200 || parser.text(response, parser.reason) != "OK" ||
+      parser.content_length != 5 || parser.keep_alive() ||
+      parser.head_length != std::size(response) - 5 ||
+      parser.header(response, "content-type") != "text/plain")
+    return EXIT_FAILURE;
+
+  // a head longer than a block, committed in small pieces.
+  const std::string pad(buffer_pool::capacity, 'p');
+  const std::string request = "GET /index.html HTTP/1.0\r\n"
+                              "X-Pad: " + pad + "\r\n"
+                              "Transfer-Encoding: gzip, chunked\r\n"
+                              "Connection: Keep-Alive\r\n"
+                              "\r\n";
+  buffer_chain chain;
+  http_parser server(http_parser::kind::request);
+  for (std::size_t at = 0; at < std::size(request);) {
+    auto space = chain.prepare();
+    const std::size_t n =
+        std::min({std::size(space), std::size(request) - at, std::size_t(100)});
+    std::copy_n(reinterpret_cast<const std::byte *>(request.data() + at), n,
+                space.data());
+    chain.commit(n);
+    at += n;
+    if (server.parse(chain) == http_parse_status::error)
+      return EXIT_FAILURE;
+  }
+  std::string scratch;
+  const std::string_view head = chain.linear(server.head_length, scratch);
+  if (server.result() != http_parse_status::done ||
+      std::size(chain.segments) < 2 || server.text(head, server.method) != "GET" ||
+      server.text(head, server.target) != "/index.html" ||
+      server.header(head, "X-PAD") != pad || !server.chunked ||
+      !server.keep_alive() || server.minor_version != 0)
+    return EXIT_FAILURE;
+
+  using kind = http_parser::kind;
+  if (!fails(kind::request, "GET / HTTP/2.0\r\n\r\n") ||
+      !fails(kind::request, "GET / HTTP/1.1\r\nA: b\r\n folded\r\n\r\n") ||
+      !fails(kind::request, "GET / HTTP/1.1\r\nBad Name: x\r\n\r\n") ||
+      !fails(kind::request, "GET / HTTP/1.1\r\nContent-Length: 12a\r\n\r\n") ||
+      !fails(kind::request,
+             "GET / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n") ||
+      !fails(kind::request, "POST / HTTP/1.1\r\nContent-Length: 1\r\n"
+                            "Transfer-Encoding: chunked\r\n\r\n") ||
+      !fails(kind::response, "HTTP/1.1 20 OK\r\n\r\n") ||
+      !fails(kind::response,
+             "HTTP/1.1 200 OK\r\nX: " +
+                 std::string(http_parser::max_head, 'x') + "\r\n\r\n"))
+    return EXIT_FAILURE;
+
+  http_parser until_close;
+  const std::string unsized = "HTTP/1.0 200 OK\r\n\r\nbody";
+  if (until_close.parse(unsized) != http_parse_status::done ||
+      !until_close.body_until_close() || until_close.keep_alive())
+    return EXIT_FAILURE;
+
+  // two pipelined requests, the second parsed after the first is consumed.
+  std::string pipelined = "\r\nGET /a HTTP/1.1\r\nHost: x\r\n\r\n"
+                          "GET /b HTTP/1.1\r\nHost: y\r\n\r\n";
+  http_parser next(kind::request);
+  if (next.parse(pipelined) != http_parse_status::done ||
+      next.text(pipelined, next.target) != "/a")
+    return EXIT_FAILURE;
+  pipelined.erase(0, next.head_length);
+  next.reset();
+  if (next.parse(pipelined) != http_parse_status::done ||
+      next.header(pipelined, "host") != "y" ||
+      next.head_length != std::size(pipelined))
+    return EXIT_FAILURE;
+
+  // chunk sizes in hex, an extension, a trailer, fed a byte at a time.
+  const std::string chunked = "5;name=value\r\nhello\r\n"
+                              "1A\r\nabcdefghijklmnopqrstuvwxyz\r\n"
+                              "0\r\nX-Trailer: t\r\n\r\nNEXT";
+  chunked_decoder decoder;
+  std::string body;
+  std::size_t used = 0;
+  for (std::size_t i = 0; i < std::size(chunked) && !decoder.done(); i++)
+    used += decoder.decode(std::string_view(chunked).substr(i, 1),
+                           [&](const std::string_view piece) { body += piece; });
+  if (!decoder.done() || body != "helloabcdefghijklmnopqrstuvwxyz" ||
+      used != std::size(chunked) - 4)
+    return EXIT_FAILURE;
+
+  for (const std::string_view broken :
+       {"x\r\n", "5\r\nhelloX\r\n", "1000000000000000\r\n"}) {
+    chunked_decoder d;
+    d.decode(broken, [](std::string_view) {});
+    if (!d.failed())
+      return EXIT_FAILURE;
+  }
+
+  http_resolver r;
+  auto results = r.resolve("127.0.0.1", "9121");
+  http_socket listener;
+  if (!listener.bind(results[0], true) || !listener.listen(1))
+    return EXIT_FAILURE;
+
+  std::thread echo([&] {
+    http_socket client = listener.accept();
+    for (int i = 0; i < 2; i++) {
+      std::vector<std::byte> data;
+      client.receive(data);
+      client.respond(data);
+    }
+    client.close();
+  });
+
+  http_socket hs;
+  if (!hs.connect(results[0]))
+    return EXIT_FAILURE;
+  const int fd = hs.internal.sockfd;
+  bool same = true;
+  for (const std::string payload : {"first", "second request"}) {
+    std::vector<std::byte> sent(std::size(payload));
+    std::copy_n(reinterpret_cast<const std::byte *>(payload.data()),
+                std::size(payload), sent.data());
+    auto back = hs.request<std::vector<std::byte>, std::vector<std::byte>>(sent);
+    same = same && back == sent && hs.internal.sockfd == fd;
+  }
+  echo.join();
+  hs.close();
+
+  std::thread streamer([&] {
+    http_socket client = listener.accept();
+    std::vector<std::byte> none;
+    client.receive(none);
+    client.respond_begin("text/plain");
+    for (const std::string part : {"hello ", "chunked ", "world"})
+      client.respond_chunk(part);
+    client.respond_end();
+  });
+
+  http_socket streamed;
+  if (!streamed.connect(results[0]))
+    return EXIT_FAILURE;
+  std::string text;
+  const bool got = streamed.get(
+      "/stream", [&](const std::string_view piece) { text += piece; });
+  streamer.join();
+  streamed.close();
+
+  // legacy first, then binary once the server has shown version 2, with
+  // the large body deflated both ways.
+  std::vector<bool> binary;
+  std::thread negotiator([&] {
+    http_socket client = listener.accept();
+    client.compression = true;
+    for (int i = 0; i < 3; i++) {
+      std::vector<std::byte> data;
+      client.receive(data);
+      binary.push_back(client.request_binary);
+      client.respond(data);
+    }
+    client.close();
+  });
+
+  http_socket modern;
+  if (!modern.connect(results[0]))
+    return EXIT_FAILURE;
+  modern.compression = true;
+  bool negotiated = true;
+  for (const std::size_t length : {100, 64 * 1024, 10}) {
+    std::vector<std::byte> sent(length);
+    for (std::size_t i = 0; i < length; i++)
+      sent[i] = static_cast<std::byte>(i % 7);
+    const bool deflate = modern.peer_version == http_socket::version &&
+                         modern.peer_deflate &&
+                         length >= http_socket::min_compress;
+    auto back =
+        modern.request<std::vector<std::byte>, std::vector<std::byte>>(sent);
+    negotiated = negotiated && back == sent &&
+                 deflate == (length == 64 * 1024);
+  }
+  negotiator.join();
+  modern.close();
+  negotiated = negotiated && binary == std::vector<bool>{false, true, true};
+
+  // a server that predates the header keeps the client on the old format.
+  std::vector<bool> old_binary;
+  std::thread old_server([&] {
+    http_socket client = listener.accept();
+    for (int i = 0; i < 2; i++) {
+      std::vector<std::byte> data;
+      client.receive(data);
+      old_binary.push_back(client.request_binary);
+      const std::string body = http_socket::legacy_encode(data);
+      const std::string head = "HTTP/1.1 200 OK\r\nContent-Length: " +
+                               std::to_string(std::size(body)) + "\r\n\r\n";
+      client.internal.send(head + body);
+    }
+    client.close();
+  });
+
+  http_socket older;
+  if (!older.connect(results[0]))
+    return EXIT_FAILURE;
+  for (int i = 0; i < 2; i++) {
+    const std::vector<std::byte> sent(5, std::byte{0xab});
+    auto back =
+        older.request<std::vector<std::byte>, std::vector<std::byte>>(sent);
+    negotiated = negotiated && back == sent && older.peer_version == 1;
+  }
+  old_server.join();
+  older.close();
+  negotiated = negotiated && old_binary == std::vector<bool>{false, false};
+
+  // a claimed length far past buffer.limit, the body is refused once it
+  // outgrows the limit instead of being reserved or waited for.
+  bool bounded = false;
+  std::thread guarded([&] {
+    http_socket client = listener.accept();
+    client.buffer.limit = 1024;
+    std::vector<std::byte> data;
+    client.receive(data);
+    bounded = !client.peer_keep_alive && std::size(data) <= 1024;
+    client.close();
+  });
+
+  http_socket greedy;
+  if (!greedy.connect(results[0]))
+    return EXIT_FAILURE;
+  greedy.internal.send(std::string("POST / HTTP/1.1\r\n"
+                                   "X-Enet-Version: 2\r\n"
+                                   "Content-Length: 999999999999\r\n\r\n") +
+                       std::string(4096, 'x'));
+  guarded.join();
+  greedy.close();
+  listener.close();
+
+  std::cout << "Kept alive: " << same << " Streamed: " << text
+            << " Negotiated: " << negotiated << " Bounded: " << bounded
+            << std::endl;
+  return same && got && text == "hello chunked world" && negotiated &&
+                 bounded
+             ? EXIT_SUCCESS
+             : EXIT_FAILURE;
+}
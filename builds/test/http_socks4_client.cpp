@@ -1,3 +1,5 @@
+#include <iostream>
+
 #include "socks4.hpp"
 #include "tcp.hpp"
 
@@ -6,7 +8,7 @@ int main(int argc, char **argv) {
   auto results = r.resolve("localhost", "8888");
 
   tcp_socket sock;
-  sock.connect(results[0]);
+  sock.connect(results);
 
   socks4_request req;
   req.cmd = establish_tcp_stream;
@@ -1,41 +1,84 @@
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
 #include <memory>
+#include <thread>
 
+#include "sharded_listener.hpp"
 #include "socks4.hpp"
 #include "tcp.hpp"
 
-int main(int argc, char **argv) {
-  tcp_resolver r;
-  auto results = r.resolve("localhost", "8888");
-
-  tcp_socket serv_sock;
-  serv_sock.bind(results[0]);
-
-  serv_sock.listen(1);
-
-  tcp_socket cli_sock = serv_sock.accept();
-
+static void serve_client(tcp_socket cli_sock, std::size_t shard) {
   std::string response;
   std::array<char, 4096> receive_buffer;
   ssize_t bytes = cli_sock.receive(receive_buffer);
+  if (bytes < static_cast<ssize_t>(sizeof(socks4_request))) {
+    cli_sock.close();
+    return;
+  }
   response.append(receive_buffer.data(), bytes);
 
   socks4_request req;
   std::memcpy(&req, response.data(), sizeof(socks4_request));
 
-  std::cout << (int)req.socks4_version << " " << (int)req.cmd << " "
-            << req.dstport << " " << req.destip << " " << std::endl;
+  std::cout << "[shard " << shard << "] " << (int)req.socks4_version << " "
+            << (int)req.cmd << " " << req.dstport << " " << req.destip << " "
+            << std::endl;
+
+  // destination as the client example encodes it, host order integers.
+  sockaddr_in dst{};
+  dst.sin_family = AF_INET;
+  dst.sin_port = htons(req.dstport);
+  dst.sin_addr.s_addr = htonl(static_cast<std::uint32_t>(req.destip));
+
+  endpoint upstream_ep;
+  std::memcpy(&upstream_ep.addr, &dst, sizeof(dst));
+  upstream_ep.addrlen = sizeof(dst);
+  upstream_ep.family = AF_INET;
+
+  tcp_socket upstream;
+  const bool connected = req.cmd == establish_tcp_stream &&
+                         upstream.connect(upstream_ep);
 
   socks4_response resp;
   resp.vn = 0x00;
-  resp.rep = req_granted;
+  resp.rep = connected ? req_granted : req_rej_or_fail;
   std::string data;
   data.resize(sizeof(resp));
   memcpy(data.data(), &resp, sizeof(resp));
   cli_sock.send(data);
 
-  // Now implement proxy logic here.
+  // splice both directions until either side is done, no user space copies.
+  if (connected) {
+    ssize_t relayed = relay(cli_sock, upstream);
+    std::cout << "[shard " << shard << "] relayed " << relayed << " bytes"
+              << std::endl;
+    upstream.close();
+  }
 
   cli_sock.close();
-  serv_sock.close();
+}
+
+// relay() holds a client until both sides close, keep the accept loop free.
+static void handle_client(tcp_socket cli_sock, std::size_t shard) {
+  std::thread(serve_client, cli_sock, shard).detach();
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  // splice has no MSG_NOSIGNAL, a reset peer would raise SIGPIPE in relay().
+  std::signal(SIGPIPE, SIG_IGN);
+
+  tcp_resolver r;
+  auto results = r.resolve("localhost", "8888");
+
+  // one SO_REUSEPORT listener and accept loop per core.
+  sharded_listener<tcp_socket> serv_sock;
+  if (!serv_sock.start(results[0], 0, 128, handle_client, true))
+    return EXIT_FAILURE;
+
+  serv_sock.join();
   return 0;
 }
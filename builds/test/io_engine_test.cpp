@@ -0,0 +1,127 @@
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "io_engine.hpp"
+#include "tcp.hpp"
+
+/*
+  Echo round trip through the io_engine: multishot accept and receive on the
+  server side, connect/send/receive completions on the client side. The
+  listener is left blocking, the engine has to cope on either backend.
+  Then an idle wait has to last its full timeout after many waits that a
+  completion ended early.
+ */
+int main() {
+  constexpr std::size_t client_count = 32;
+
+  tcp_resolver r;
+  auto results = r.resolve("127.0.0.1", "9101");
+
+  io_engine engine;
+  std::cout << "Backend: " << (engine.using_uring() ? "io_uring" : "epoll")
+            << std::endl;
+
+  tcp_socket serv_sock;
+  if (!serv_sock.bind(results[0]) || !serv_sock.listen(128))
+    return EXIT_FAILURE;
+
+  std::vector<std::unique_ptr<tcp_socket>> accepted;
+  std::vector<std::unique_ptr<std::string>> echoes;
+  engine.accept(
+      serv_sock,
+      [&](int fd) {
+        if (fd < 0)
+          return;
+
+        auto &conn = accepted.emplace_back(std::make_unique<tcp_socket>());
+        conn->sockfd = fd;
+        tcp_socket *sock = conn.get();
+        engine.receive_multishot(
+            *sock, [&, sock](int res, std::span<const std::byte> data) {
+              if (res <= 0)
+                return;
+
+              // the span is only valid during the call, keep a copy to send.
+              auto &echo = echoes.emplace_back(std::make_unique<std::string>(
+                  reinterpret_cast<const char *>(std::data(data)),
+                  std::size(data)));
+              engine.send(*sock, *echo, [](int) {});
+            });
+      },
+      true);
+
+  std::vector<tcp_socket> clients(client_count);
+  std::vector<std::string> requests(client_count);
+  std::vector<std::array<char, 64>> buffers(client_count);
+  std::size_t finished = 0;
+  for (std::size_t i = 0; i < client_count; i++) {
+    requests[i] = "ping " + std::to_string(i);
+    engine.connect(clients[i], results[0], [&, i](int res) {
+      if (res < 0)
+        return;
+
+      engine.send(clients[i], requests[i], [&, i](int sent) {
+        if (sent < 0)
+          return;
+
+        engine.receive(clients[i], buffers[i], [&, i](int bytes) {
+          if (std::string(std::data(buffers[i]), bytes > 0 ? bytes : 0) ==
+              requests[i])
+            finished++;
+          engine.close(clients[i]);
+          if (finished == client_count)
+            engine.stop();
+        });
+      });
+    });
+  }
+
+  engine.run();
+
+  for (auto &conn : accepted)
+    engine.close(*conn);
+  engine.close(serv_sock);
+
+  std::cout << "Echoed " << finished << " of " << client_count << " clients"
+            << std::endl;
+  if (finished != client_count)
+    return EXIT_FAILURE;
+
+  // waits cut short by a completion must not leave their timeout behind to
+  // wake a later, idle wait.
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == -1)
+    return EXIT_FAILURE;
+  tcp_socket near, far;
+  near.sockfd = fds[0];
+  far.sockfd = fds[1];
+  std::array<char, 1> byte;
+  int received = 0;
+  for (int i = 0; i < 20; i++) {
+    engine.receive(near, byte, [&](int res) { received += res; });
+    far.send(std::string("x"));
+    while (received != i + 1)
+      engine.run_once(30);
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  const auto idle_start = std::chrono::steady_clock::now();
+  engine.run_once(200);
+  const auto idle = std::chrono::steady_clock::now() - idle_start;
+  engine.close(near);
+  far.close();
+
+  std::cout << "Idle wait: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(idle)
+                   .count()
+            << " ms" << std::endl;
+  return idle >= std::chrono::milliseconds(150) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
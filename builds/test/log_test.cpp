@@ -0,0 +1,84 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.hpp"
+#include "tcp.hpp"
+
+/*
+  Threads logging at once into stderr redirected to a file: every record
+  is either written whole or counted as dropped. Then last_error after a
+  refused connect and a send on an unconnected socket.
+ */
+int main() {
+  char path[] = "/tmp/enet-log-test-XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd == -1)
+    return EXIT_FAILURE;
+  const int saved = dup(STDERR_FILENO);
+  dup2(fd, STDERR_FILENO);
+
+  constexpr int threads = 8;
+  constexpr int records = 20000;
+  std::vector<std::thread> loggers;
+  for (int t = 0; t < threads; t++)
+    loggers.emplace_back([t] {
+      for (int i = 0; i < records; i++)
+        log_info("thread ", t, " record ", i, " done ", true);
+    });
+  for (auto &t : loggers)
+    t.join();
+  log_debug("compiled out ", 1.5);
+
+  tcp_resolver r;
+  auto results = r.resolve("127.0.0.1", "9119");
+  tcp_socket refused;
+  const bool connected = refused.connect(results[0]);
+  tcp_socket unconnected;
+  const bool sent = unconnected.send(std::string("x")) != -1;
+
+  logger::instance().flush();
+  dup2(saved, STDERR_FILENO);
+  close(fd);
+
+  std::ifstream in(path);
+  std::remove(path);
+  long written = 0, dropped = 0, errors = 0;
+  for (std::string line; std::getline(in, line);) {
+    if (line.starts_with("info: thread ") && line.ends_with(" done true")) {
+      written++;
+    } else if (line.starts_with("warn: ") &&
+               line.ends_with(" log records dropped.")) {
+      std::istringstream(line.substr(6)) >> line;
+      dropped += std::stol(line);
+    } else if (line.starts_with("error: ")) {
+      errors++;
+    } else {
+      std::cerr << "Unexpected line: " << line << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::cout << "Written: " << written << " Dropped: " << dropped
+            << " Errors: " << errors << std::endl;
+  if (written + dropped != threads * records || errors != 2)
+    return EXIT_FAILURE;
+
+  if (connected || refused.last_error.domain != error_domain::system ||
+      refused.last_error.code != ECONNREFUSED)
+    return EXIT_FAILURE;
+  if (sent || unconnected.last_error.code != ENOTCONN)
+    return EXIT_FAILURE;
+
+  std::cout << refused.last_error.message() << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+#include <array>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "reactor.hpp"
+#include "tcp.hpp"
+
+/*
+  Echo server and its clients all driven by one reactor on one thread,
+  then a reactor stopped before run() was called.
+ */
+int main() {
+  constexpr std::size_t client_count = 64;
+
+  tcp_resolver r;
+  auto results = r.resolve("127.0.0.1", "9100");
+
+  reactor loop;
+
+  tcp_socket serv_sock;
+  if (!serv_sock.bind(results[0]) || !serv_sock.listen(128))
+    return EXIT_FAILURE;
+
+  std::vector<std::unique_ptr<tcp_socket>> accepted;
+  loop.add(serv_sock, EPOLLIN, [&](std::uint32_t) {
+    tcp_socket client;
+    while (serv_sock.try_accept(client) == io_status::ok) {
+      auto &conn = accepted.emplace_back(std::make_unique<tcp_socket>(client));
+      tcp_socket *sock = conn.get();
+      loop.add(sock->sockfd, EPOLLIN, [&loop, sock](std::uint32_t) {
+        std::array<char, 4096> buffer;
+        for (;;) {
+          io_result res = sock->try_receive(buffer);
+          if (res.would_block())
+            return;
+          if (!res.ok()) {
+            loop.remove(sock->sockfd);
+            sock->close();
+            return;
+          }
+
+          sock->try_send(std::string_view(std::data(buffer), res.bytes));
+        }
+      });
+    }
+  });
+
+  std::vector<tcp_socket> clients(client_count);
+  std::vector<std::string> replies(client_count);
+  std::size_t finished = 0;
+  for (std::size_t i = 0; i < client_count; i++) {
+    if (!clients[i].connect(results[0]))
+      return EXIT_FAILURE;
+
+    clients[i].send("ping " + std::to_string(i));
+    loop.add(clients[i], EPOLLIN, [&, i](std::uint32_t) {
+      std::array<char, 4096> buffer;
+      io_result res;
+      while ((res = clients[i].try_receive(buffer)).ok())
+        replies[i].append(std::data(buffer), res.bytes);
+
+      if (replies[i] == "ping " + std::to_string(i)) {
+        loop.remove(clients[i].sockfd);
+        clients[i].close();
+        if (++finished == client_count)
+          loop.stop();
+      }
+    });
+  }
+
+  loop.run();
+
+  for (auto &conn : accepted)
+    conn->close();
+  serv_sock.close();
+
+  std::cout << "Echoed " << finished << " of " << client_count << " clients"
+            << std::endl;
+
+  // stopped from another thread before it ever ran, run() must return.
+  reactor early;
+  std::thread stopper([&] { early.stop(); });
+  stopper.join();
+  early.run();
+
+  return finished == client_count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
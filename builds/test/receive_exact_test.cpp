@@ -0,0 +1,92 @@
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "ssl.hpp"
+#include "tcp.hpp"
+
+/*
+  Exact reads against a peer that delivers in full, one that stalls and one
+  that closes half way, then a TLS peer that drops the connection half
+  way without close_notify.
+ */
+int main() {
+  tcp_resolver r;
+  auto results = r.resolve("127.0.0.1", "9115");
+
+  tcp_socket serv_sock;
+  if (!serv_sock.bind(results[0]) || !serv_sock.listen(8))
+    return EXIT_FAILURE;
+
+  tcp_socket client;
+  if (!client.connect(results[0]))
+    return EXIT_FAILURE;
+  tcp_socket peer = serv_sock.accept();
+
+  bool ok = true;
+  std::array<char, 8> buf;
+
+  // full buffer, split over two sends.
+  peer.send(std::string("abcd"));
+  peer.send(std::string("efgh"));
+  io_result res = client.receive_exact(buf);
+  ok &= res.ok() && res.bytes == 8 && std::string(std::data(buf), 8) ==
+                                          "abcdefgh";
+
+  // stalled peer, the deadline is honoured with the partial count.
+  peer.send(std::string("abc"));
+  const auto start = std::chrono::steady_clock::now();
+  res = client.receive_exact(buf, 100);
+  const auto waited = std::chrono::steady_clock::now() - start;
+  ok &= res.status == io_status::timeout && res.bytes == 3;
+  ok &= waited >= std::chrono::milliseconds(100) &&
+        waited < std::chrono::milliseconds(500);
+
+  // half-closed peer ends the read instead of spinning.
+  peer.send(std::string("xy"));
+  peer.close();
+  res = client.receive_exact(buf);
+  ok &= res.status == io_status::eof && res.bytes == 2;
+
+  std::uint64_t value = 0;
+  ok &= client.receive_into(value) == 0 && value == 0;
+
+  std::cout << (ok ? "All exact reads behaved" : "Exact read mismatch")
+            << std::endl;
+
+  client.close();
+  serv_sock.close();
+
+  auto tls_results = r.resolve("127.0.0.1", "9123");
+  ssl_socket tls_serv;
+  if (!tls_serv.bind(tls_results[0], true) || !tls_serv.listen(1))
+    return EXIT_FAILURE;
+
+  std::thread abrupt([&] {
+    ssl_socket tls_peer = tls_serv.accept();
+    tls_peer.send(std::string("xy"));
+    // no SSL_shutdown, the client sees the tcp connection end mid record.
+    ::close(tls_peer.sockfd);
+    tls_peer.sockfd = -1;
+    SSL_free(tls_peer.ssl);
+    tls_peer.ssl = nullptr;
+  });
+
+  ssl_socket tls_client;
+  if (!tls_client.connect(tls_results[0]))
+    return EXIT_FAILURE;
+  res = tls_client.receive_exact(buf);
+  abrupt.join();
+  const bool tls_ok = res.status == io_status::eof && res.bytes == 2 &&
+                      std::string(std::data(buf), 2) == "xy";
+  std::cout << (tls_ok ? "TLS read kept the partial bytes"
+                       : "TLS read lost the partial bytes")
+            << std::endl;
+
+  tls_client.close();
+  tls_serv.close();
+  return ok && tls_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
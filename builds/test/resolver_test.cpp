@@ -0,0 +1,83 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "resolver.hpp"
+
+/*
+  Caching, in-flight deduplication, negative caching and prefetch against a
+  hosts-file source that counts how often it is asked.
+ */
+int main() {
+  const std::string path = "/tmp/enet_resolver_test_hosts";
+  {
+    std::ofstream hosts(path);
+    hosts << "# test entries\n";
+    hosts << "127.0.0.1 cached.test\n";
+    hosts << "127.0.0.2 short.test # expires quickly\n";
+  }
+
+  std::atomic<int> queries = 0;
+  const auto hosts = dns_resolver::hosts_file_source(path);
+  const auto short_ttl = std::chrono::milliseconds(200);
+  const auto short_hosts = dns_resolver::hosts_file_source(path, short_ttl);
+  dns_resolver r({[&](const std::string &host, const std::string &service,
+                      const int socktype) {
+    queries++;
+    // slow enough for concurrent callers to overlap.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return host == "short.test" ? short_hosts(host, service, socktype)
+                                : hosts(host, service, socktype);
+  }});
+
+  bool ok = true;
+
+  // 16 concurrent callers, one query.
+  std::vector<std::thread> callers;
+  std::atomic<int> answered = 0;
+  for (int i = 0; i < 16; i++)
+    callers.emplace_back([&] {
+      if (std::size(r.resolve("cached.test", "80", SOCK_STREAM)) == 1)
+        answered++;
+    });
+  for (auto &t : callers)
+    t.join();
+  ok &= answered == 16 && queries == 1;
+
+  // served from cache.
+  for (int i = 0; i < 100; i++)
+    r.resolve("cached.test", "80", SOCK_STREAM);
+  ok &= queries == 1;
+
+  // a different service is a different entry.
+  ok &= std::size(r.resolve("cached.test", "443", SOCK_STREAM)) == 1;
+  ok &= queries == 2;
+
+  // unknown names are cached as failures too.
+  ok &= r.resolve("missing.test", "80", SOCK_STREAM).empty();
+  ok &= r.resolve("missing.test", "80", SOCK_STREAM).empty();
+  ok &= queries == 3;
+
+  // within the prefetch window the cached answer comes back at once and a
+  // refresh runs behind it.
+  r.resolve("short.test", "80", SOCK_STREAM);
+  std::this_thread::sleep_for(short_ttl - std::chrono::milliseconds(10));
+  const auto start = std::chrono::steady_clock::now();
+  ok &= std::size(r.resolve("short.test", "80", SOCK_STREAM)) == 1;
+  ok &= std::chrono::steady_clock::now() - start <
+        std::chrono::milliseconds(20);
+  r.drain();
+  ok &= queries == 5 && r.prefetches == 1;
+
+  std::cout << "Queries: " << queries << " hits: " << r.hits
+            << " misses: " << r.misses << " coalesced: " << r.coalesced
+            << " prefetches: " << r.prefetches << std::endl;
+
+  std::remove(path.c_str());
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
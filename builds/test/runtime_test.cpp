@@ -0,0 +1,112 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "runtime.hpp"
+#include "work_queue.hpp"
+
+/*
+  The deque under thieves, then messages hopping between cores, a burst
+  of pool jobs that fork more jobs, and an offload returning to its core.
+ */
+template <typename Done> bool wait_until(Done done) {
+  const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > until)
+      return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+int main() {
+  constexpr std::uint64_t items = 200000;
+
+  work_stealing_deque<std::uint64_t> deque(16);
+  std::vector<std::atomic<std::uint8_t>> taken(items + 1);
+  std::atomic<bool> producing = true;
+  std::vector<std::thread> thieves;
+  for (int i = 0; i < 3; i++)
+    thieves.emplace_back([&] {
+      while (producing.load() || deque.size() > 0)
+        if (auto v = deque.steal())
+          taken[*v]++;
+    });
+  for (std::uint64_t v = 1; v <= items; v++) {
+    deque.push(v);
+    if (v % 3 == 0)
+      if (auto p = deque.pop())
+        taken[*p]++;
+  }
+  while (auto p = deque.pop())
+    taken[*p]++;
+  producing = false;
+  for (auto &t : thieves)
+    t.join();
+
+  for (std::uint64_t v = 1; v <= items; v++)
+    if (taken[v] != 1) {
+      std::cerr << "Item " << v << " taken " << int(taken[v]) << " times."
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  runtime rt;
+  if (!rt.start(4, 4, false))
+    return EXIT_FAILURE;
+
+  // a token passed around the ring of cores.
+  constexpr int hops = 20000;
+  std::atomic<int> hopped = 0;
+  std::atomic<bool> wrong_core = false;
+  std::function<void(int)> hop = [&](const int left) {
+    hopped++;
+    if (left == 0)
+      return;
+    const std::size_t next = (runtime::current_core() + 1) % rt.cores();
+    rt.post(next, [&, next, left] {
+      if (runtime::current_core() != next)
+        wrong_core = true;
+      hop(left - 1);
+    });
+  };
+  rt.post(0, [&] { hop(hops); });
+  if (!wait_until([&] { return hopped == hops + 1; }) || wrong_core)
+    return EXIT_FAILURE;
+
+  constexpr int jobs = 100000;
+  std::atomic<int> ran = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < jobs; i++)
+    rt.submit([&] {
+      ran++;
+      rt.submit([&] { ran++; });
+    });
+  if (!wait_until([&] { return ran == 2 * jobs; }))
+    return EXIT_FAILURE;
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  std::cout << "Pool jobs: " << 2 * jobs << " in " << elapsed.count() / 1000.0
+            << " ms" << std::endl;
+
+  std::atomic<int> result = 0;
+  rt.post(1, [&] {
+    rt.offload(
+        [] { return runtime::current_core() == runtime::npos ? 42 : -1; },
+        [&](const int r) { result = runtime::current_core() == 1 ? r : -1; });
+  });
+  if (!wait_until([&] { return result != 0; }) || result != 42)
+    return EXIT_FAILURE;
+
+  // from main there is no core to bring the result back to.
+  if (rt.offload([] { return 1; }, [](int) {}))
+    return EXIT_FAILURE;
+
+  rt.stop();
+  std::cout << "Hops: " << hopped << " Jobs: " << ran << std::endl;
+  return EXIT_SUCCESS;
+}
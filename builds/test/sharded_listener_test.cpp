@@ -0,0 +1,119 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "sharded_listener.hpp"
+#include "tcp.hpp"
+
+/*
+  Connections spread over the SO_REUSEPORT shards, stop() waking workers
+  blocked in accept, then a shard out of descriptors pausing instead of
+  spinning and picking the connection up once descriptors are free.
+ */
+constexpr std::size_t shard_count = 4;
+
+// the client closes first, so TIME_WAIT stays off the listening port.
+void serve(tcp_socket client) {
+  std::array<char, 16> buf;
+  while (client.receive(buf) > 0) {
+  }
+  client.close();
+}
+
+int main() {
+  tcp_resolver r;
+  auto results = r.resolve("127.0.0.1", "9125");
+
+  std::array<std::atomic<int>, shard_count> per_shard{};
+  sharded_listener<tcp_socket> listener;
+  if (!listener.start(results[0], shard_count, 128,
+                      [&](tcp_socket client, std::size_t shard) {
+                        per_shard[shard]++;
+                        serve(client);
+                      }))
+    return EXIT_FAILURE;
+
+  constexpr int client_count = 200;
+  for (int i = 0; i < client_count; i++) {
+    tcp_socket client;
+    if (!client.connect(results[0]))
+      return EXIT_FAILURE;
+    client.close();
+  }
+
+  const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  auto served = [&] {
+    int total = 0;
+    for (auto &n : per_shard)
+      total += n;
+    return total;
+  };
+  while (served() != client_count && std::chrono::steady_clock::now() < until)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+  std::size_t busy = 0;
+  std::cout << "Per shard:";
+  for (auto &n : per_shard) {
+    std::cout << " " << n;
+    busy += n > 0;
+  }
+  std::cout << std::endl;
+  if (served() != client_count || busy < 2)
+    return EXIT_FAILURE;
+
+  // every worker sits in accept now.
+  const auto stop_start = std::chrono::steady_clock::now();
+  listener.stop();
+  if (std::chrono::steady_clock::now() - stop_start > std::chrono::seconds(1))
+    return EXIT_FAILURE;
+
+  std::atomic<int> accepted = 0;
+  sharded_listener<tcp_socket> starved;
+  if (!starved.start(results[0], 1, 16,
+                     [&](tcp_socket client, std::size_t) {
+                       accepted++;
+                       serve(client);
+                     }))
+    return EXIT_FAILURE;
+
+  // the client's descriptor exists before the table fills up.
+  tcp_socket client;
+  client.sockfd = ::socket(AF_INET, SOCK_STREAM, 0);
+  rlimit original;
+  getrlimit(RLIMIT_NOFILE, &original);
+  rlimit low = original;
+  low.rlim_cur = 64;
+  setrlimit(RLIMIT_NOFILE, &low);
+  std::vector<int> filler;
+  for (int fd; (fd = ::dup(STDIN_FILENO)) != -1;)
+    filler.push_back(fd);
+
+  const bool queued =
+      ::connect(client.sockfd, &results[0].addr, results[0].addrlen) == 0;
+  std::this_thread::sleep_for(std::chrono::milliseconds(350));
+  const std::uint64_t pauses = starved.pauses;
+  const bool held = accepted == 0;
+
+  for (int fd : filler)
+    ::close(fd);
+  setrlimit(RLIMIT_NOFILE, &original);
+  const auto resume_until =
+      std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (accepted == 0 && std::chrono::steady_clock::now() < resume_until)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  client.close();
+  starved.stop();
+
+  std::cout << "Pauses: " << pauses << " Accepted after: " << accepted
+            << std::endl;
+  return queued && held && pauses >= 2 && pauses <= 6 && accepted == 1
+             ? EXIT_SUCCESS
+             : EXIT_FAILURE;
+}
@@ -0,0 +1,95 @@
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "shm.hpp"
+
+/*
+  Ping-pong between two processes over a small ring, so messages wrap
+  around and both sides block on a full ring as well as on an empty one.
+  Then moving a socket, and attach() refusing a header whose capacity
+  does not fit the mapping.
+ */
+constexpr std::uint64_t stop = ~0ull;
+
+int main() {
+  constexpr std::uint64_t rounds = 20000;
+
+  shm_socket parent;
+  if (!parent.create(4096))
+    return EXIT_FAILURE;
+
+  const pid_t pid = ::fork();
+  if (pid == 0) {
+    shm_socket child;
+    if (!child.attach(::dup(parent.memfd)))
+      _exit(EXIT_FAILURE);
+
+    std::uint64_t value;
+    while (child.receive_into(value) == sizeof(value) && value != stop)
+      child.send(std::string_view(reinterpret_cast<const char *>(&value),
+                                  sizeof(value)));
+
+    // a burst larger than the ring.
+    const std::string burst(10000, 'x');
+    child.send(burst);
+    child.close();
+    _exit(EXIT_SUCCESS);
+  }
+
+  bool ok = true;
+  const auto start = std::chrono::steady_clock::now();
+  for (std::uint64_t i = 0; i < rounds && ok; i++) {
+    std::uint64_t echoed = 0;
+    parent.send(std::string_view(reinterpret_cast<const char *>(&i),
+                                 sizeof(i)));
+    ok &= parent.receive_into(echoed) == sizeof(echoed) && echoed == i;
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  // the child answers stop with a burst, then closes.
+  parent.send(std::string_view(reinterpret_cast<const char *>(&stop),
+                               sizeof(stop)));
+  std::array<char, 4096> buf;
+  std::size_t burst = 0;
+  ssize_t n;
+  while ((n = parent.receive(buf)) > 0)
+    burst += n;
+
+  ok &= burst == 10000;
+  ok &= parent.receive_exact(buf, 10).status == io_status::eof;
+
+  int status = 0;
+  ::waitpid(pid, &status, 0);
+  ok &= WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+
+  std::cout << "Round trip: "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                       .count() /
+                   rounds
+            << "ns" << std::endl;
+
+  parent.close();
+
+  // a moved-from socket owns nothing, closing it leaves the region mapped.
+  shm_socket first;
+  ok &= first.create(4096);
+  shm_socket owner(std::move(first));
+  first.close();
+  ok &= owner.shared != nullptr && owner.shared->magic == shm_socket::magic;
+
+  // a header claiming more than was mapped is refused.
+  owner.shared->capacity = 1 << 20;
+  shm_socket peer;
+  ok &= !peer.attach(::dup(owner.memfd));
+  owner.shared->capacity = 3000;
+  ok &= !peer.attach(::dup(owner.memfd));
+  owner.close();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,75 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "http_parser.hpp"
+#include "simd_scan.hpp"
+
+/*
+  Every scanner the CPU supports against the scalar one, for every byte
+  value at every position of runs up to 100 bytes, then parser
+  throughput on a typical request head.
+ */
+int main() {
+  std::vector<simd_scan::table> tables = {simd_scan::scalar()};
+#ifdef ENET_SIMD_X86
+  if (__builtin_cpu_supports("sse4.2"))
+    tables.push_back({simd_scan::value_sse42, simd_scan::token_sse42,
+                      simd_scan::target_sse42, "sse4.2"});
+  if (__builtin_cpu_supports("avx2"))
+    tables.push_back({simd_scan::value_avx2, simd_scan::token_avx2,
+                      simd_scan::target_avx2, "avx2"});
+#endif
+
+  std::mt19937 generator(3);
+  for (const auto &t : tables) {
+    for (std::size_t length = 0; length <= 100; length++) {
+      for (int stop = 0; stop < 256; stop++) {
+        // a run of class members with one arbitrary byte dropped in.
+        std::string s(length + 1, 'a');
+        const std::size_t at =
+            length == 0 ? 0 : generator() % (length + 1);
+        s[at] = static_cast<char>(stop);
+        const char *p = s.data() + 1;
+        const std::size_t n = std::size(s) - 1;
+
+        if (t.value(p, n) != simd_scan::value_scalar(p, n) ||
+            t.token(p, n) != simd_scan::token_scalar(p, n) ||
+            t.target(p, n) != simd_scan::target_scalar(p, n)) {
+          std::cerr << t.name << " differs at length " << length << " byte "
+                    << stop << std::endl;
+          return EXIT_FAILURE;
+        }
+      }
+    }
+  }
+
+  const std::string head =
+      "GET /api/v1/items?id=12345&expand=details HTTP/1.1\r\n"
+      "Host: gateway.internal.example\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9\r\n"
+      "Accept-Language: en-US,en;q=0.5\r\n"
+      "Accept-Encoding: gzip, deflate, br\r\n"
+      "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+      "Content-Length: 0\r\n"
+      "Connection: keep-alive\r\n"
+      "\r\n";
+  constexpr int rounds = 200000;
+  http_parser parser(http_parser::kind::request);
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    parser.reset();
+    if (parser.parse(head) != http_parse_status::done)
+      return EXIT_FAILURE;
+  }
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start);
+
+  std::cout << "Scanner: " << simd_scan::impl().name << " Head: "
+            << elapsed.count() / rounds << " ns" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -5,12 +5,12 @@
 #include <cstddef>
 #include <cstdio>
 #include <ctime>
+#include <functional>
 #include <iostream>
 #include <netinet/in.h>
 #include <string_view>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <thread>
 
 #include "dht.hpp"
 #include "endpoint.hpp"
@@ -55,11 +55,6 @@ int main(int argc, char **argv) {
 
   dht_service dht;
 
-  std::time_t tosleep = 0;
-
-  std::size_t print_countdown = 20;
-  std::size_t loop = 0;
-
   std::cerr << "Looking for: ";
   for (std::size_t i = 0; i < 20; i++) {
     std::string byte_string;
@@ -72,63 +67,43 @@ int main(int argc, char **argv) {
   }
   std::cerr << std::endl;
 
-  std::thread searcher([&]() {
-    while (true) {
-      dht.search(info_hash, 0, AF_INET, callback);
-      // dht.find_node(info_hash, AF_INET);
-
-      char str[INET6_ADDRSTRLEN];
-
-      auto s = dht.get_node(info_hash, AF_INET);
-      std::cout << "Family: " << s.ss_family << std::endl;
-      if (s.ss_family == AF_INET)
-        inet_ntop(AF_INET, &(((struct sockaddr_in *)&s)->sin_addr), str,
-                  INET_ADDRSTRLEN);
-      else
-        inet_ntop(AF_INET6, &(((struct sockaddr_in *)&s)->sin_addr), str,
-                  INET6_ADDRSTRLEN);
-      std::cout << "Found Peer: " << std::string(str) << std::endl;
-      std::this_thread::sleep_for(std::chrono::seconds(10));
-    }
-  });
-  searcher.detach();
-
-  while (++loop) {
-    int rc = dht.periodic(tosleep, callback, NULL);
-    if (rc < 0) {
-      if (errno == EINTR) {
-        continue;
-      } else {
-        if (rc == EINVAL || rc == EFAULT)
-          break;
-        tosleep = 1;
-      }
-    }
+  reactor events;
+  if (!dht.attach(events, callback))
+    return 1;
 
-    // TODO: query IP info for node using id
-
-    /* This is how you trigger a search for a torrent hash.  If port
-   (the second argument) is non-zero, it also performs an announce.
-   Since peers expire announced data after 30 minutes, it is a good
-   idea to reannounce every 28 minutes or so. */
-    if (loop % print_countdown) {
-      loop = 0;
-      dht.search(info_hash, 12345, AF_INET, callback);
-
-      // {
-      //   std::array<sockaddr_in, 500> sin;
-      //   std::array<sockaddr_in6, 500> sin6;
-      //   int num = std::size(sin), num6 = std::size(sin6);
-      //   int i;
-      //   i = dht.get_nodes(sin, num, sin6, num6);
-      //   printf("Found %d (%d + %d) good nodes.\n", i, num, num6);
-      // }
-
-      // dht_dump_tables(stdout);
-    }
+  // TODO: query IP info for node using id
 
-    usleep(tosleep);
-  }
+  /* This is how you trigger a search for a torrent hash.  If port
+ (the second argument) is non-zero, it also performs an announce.
+ Since peers expire announced data after 30 minutes, it is a good
+ idea to reannounce every 28 minutes or so. */
+  std::function<void()> announce = [&] {
+    dht.search(info_hash, 12345, AF_INET, callback);
+    events.timers.schedule(std::chrono::minutes(28), announce);
+  };
+  announce();
+
+  // the dht is not thread-safe, lookups run on its loop too.
+  std::function<void()> searcher = [&] {
+    dht.search(info_hash, 0, AF_INET, callback);
+    // dht.find_node(info_hash, AF_INET);
+
+    char str[INET6_ADDRSTRLEN];
+
+    auto s = dht.get_node(info_hash, AF_INET);
+    std::cout << "Family: " << s.ss_family << std::endl;
+    if (s.ss_family == AF_INET)
+      inet_ntop(AF_INET, &(((struct sockaddr_in *)&s)->sin_addr), str,
+                INET_ADDRSTRLEN);
+    else
+      inet_ntop(AF_INET6, &(((struct sockaddr_in *)&s)->sin_addr), str,
+                INET6_ADDRSTRLEN);
+    std::cout << "Found Peer: " << std::string(str) << std::endl;
+    events.timers.schedule(std::chrono::seconds(10), searcher);
+  };
+  searcher();
+
+  events.run();
 
   return 0;
 }
@@ -1,4 +1,5 @@
 #include <cstdlib>
+#include <iostream>
 #include <regex>
 
 #include "args.hpp"
@@ -28,7 +29,7 @@ int main(int argc, char **argv) {
 
   std::cout << "Host: " << host << " URI: " << uri << std::endl;
   http_socket hs;
-  hs.connect(ips[0]);
+  hs.connect(ips);
 
   if (uri.empty())
     uri += '/';
@@ -0,0 +1,64 @@
+#include <cstdlib>
+#include <iostream>
+
+#include <netinet/tcp.h>
+
+#include "tcp.hpp"
+#include "udp.hpp"
+
+/*
+  Presets end up on listening, connecting, accepted and datagram sockets.
+ */
+static int option(const int fd, const int level, const int name) {
+  int value = -1;
+  socklen_t len = sizeof(value);
+  getsockopt(fd, level, name, &value, &len);
+  return value;
+}
+
+int main() {
+  tcp_resolver r;
+  auto results = r.resolve("127.0.0.1", "9116");
+
+  tcp_socket serv_sock;
+  serv_sock.profile = socket_profile::low_latency();
+  if (!serv_sock.bind(results[0]) || !serv_sock.listen(8))
+    return EXIT_FAILURE;
+
+  tcp_socket client;
+  client.profile = socket_profile::low_latency();
+  if (!client.connect(results))
+    return EXIT_FAILURE;
+  tcp_socket accepted = serv_sock.accept();
+
+  bool ok = true;
+  for (const int fd : {client.sockfd, accepted.sockfd}) {
+    ok &= option(fd, IPPROTO_TCP, TCP_NODELAY) == 1;
+    ok &= option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT) == 16384;
+  }
+  ok &= option(serv_sock.sockfd, IPPROTO_TCP, TCP_FASTOPEN) == 256;
+
+  // the kernel doubles the requested size, and caps it at wmem_max.
+  tcp_socket bulk;
+  bulk.profile = socket_profile::bulk();
+  if (!bulk.connect(results[0]))
+    return EXIT_FAILURE;
+  tcp_socket bulk_peer = serv_sock.accept();
+  ok &= option(bulk.sockfd, IPPROTO_TCP, TCP_NODELAY) == 0;
+  ok &= option(bulk.sockfd, SOL_SOCKET, SO_SNDBUF) !=
+        option(bulk_peer.sockfd, SOL_SOCKET, SO_SNDBUF);
+
+  udp_resolver ur;
+  udp_socket datagram;
+  datagram.profile.rcvbuf = 65536;
+  if (!datagram.bind(ur.resolve("127.0.0.1", "9117")[0]))
+    return EXIT_FAILURE;
+  ok &= option(datagram.sockfd, SOL_SOCKET, SO_RCVBUF) == 2 * 65536;
+
+  std::cout << (ok ? "Profiles applied" : "Profile mismatch") << std::endl;
+
+  for (auto *sock : {&client, &accepted, &bulk, &bulk_peer, &serv_sock})
+    sock->close();
+  datagram.close();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "reactor.hpp"
+#include "timer_wheel.hpp"
+
+/*
+  Deadlines across every level fire on their exact tick and in order,
+  cancelled ones never fire, then a million schedule/cancel pairs, then
+  the reactor sleeping on the wheel.
+ */
+int main() {
+  constexpr std::size_t count = 100000;
+
+  timer_wheel wheel;
+  std::mt19937_64 generator(42);
+  std::uniform_int_distribution<std::uint64_t> delay(0, 1 << 26);
+
+  // wheel.current is the tick being fired.
+  std::uint64_t now = 0;
+  std::uint64_t last = 0;
+  std::size_t fired = 0, late = 0, cancelled = 0;
+  std::vector<timer_wheel::timer_id> ids;
+  for (std::size_t i = 0; i < count; i++) {
+    const std::uint64_t expires = delay(generator);
+    ids.push_back(wheel.schedule_tick(expires, [&, expires] {
+      fired++;
+      if (expires != wheel.current || expires < last)
+        late++;
+      last = expires;
+    }));
+  }
+
+  for (std::size_t i = 0; i < count; i += 3)
+    cancelled += wheel.cancel(ids[i]);
+  // a second cancel, or one of a fired timer, is a no-op.
+  if (wheel.cancel(ids[0]) || wheel.armed(ids[0]))
+    late++;
+
+  // step through the deadlines one tick at a time around each.
+  std::vector<std::uint64_t> stops;
+  for (std::size_t i = 0; i < 1000; i++)
+    stops.push_back(delay(generator));
+  std::sort(std::begin(stops), std::end(stops));
+  for (auto stop : stops)
+    for (; now <= stop; now += (stop - now) / 2 + 1)
+      wheel.advance_to(now);
+  while (wheel.size() > 0)
+    wheel.advance_to(now++);
+
+  std::cout << "Fired: " << fired << " Cancelled: " << cancelled
+            << " Late: " << late << std::endl;
+  if (fired + cancelled != count || late != 0)
+    return EXIT_FAILURE;
+
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < 1000000; i++)
+    wheel.cancel(wheel.schedule(std::chrono::seconds(30), [] {}));
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  std::cout << "Schedule+cancel: " << elapsed.count() / 1000.0 << " ns"
+            << std::endl;
+  // every node came off the free list.
+  if (wheel.size() != 0 || std::size(wheel.nodes) != count)
+    return EXIT_FAILURE;
+
+  reactor loop;
+  bool done = false;
+  start = std::chrono::steady_clock::now();
+  loop.timers.schedule(std::chrono::milliseconds(30), [&] { done = true; });
+  while (!done)
+    if (loop.run_once() == -1)
+      return EXIT_FAILURE;
+  elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  std::cout << "Reactor timer: " << elapsed.count() / 1000.0 << " ms"
+            << std::endl;
+
+  return elapsed < std::chrono::milliseconds(30) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
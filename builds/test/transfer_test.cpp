@@ -0,0 +1,173 @@
+#include <array>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "tcp.hpp"
+
+/*
+  send_vec resuming after writes a signal cut short, across more buffers
+  than one sendmsg takes, receive_vec splitting one read, send_file with
+  an offset and past end of file, then relay() moving data both ways and
+  passing each side's end of stream on.
+ */
+std::string pattern(const std::size_t n, const std::size_t seed) {
+  std::string s(n, '\0');
+  for (std::size_t i = 0; i < n; i++)
+    s[i] = static_cast<char>('a' + (i * 7 + seed) % 26);
+  return s;
+}
+
+bool pair(tcp_socket &a, tcp_socket &b) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    return false;
+  a.sockfd = fds[0];
+  b.sockfd = fds[1];
+  return true;
+}
+
+// reads until eof, slowly, so the writer keeps blocking.
+std::string drain(tcp_socket &sock, const bool slow) {
+  std::string out;
+  std::array<char, 16384> buf;
+  while (true) {
+    const ssize_t n = sock.receive(buf);
+    if (n <= 0)
+      return out;
+    out.append(buf.data(), n);
+    if (slow)
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+}
+
+void interrupted(int) {}
+
+int main() {
+  // without SA_RESTART a blocked sendmsg that made progress returns short.
+  struct sigaction sa {};
+  sa.sa_handler = interrupted;
+  sigaction(SIGALRM, &sa, nullptr);
+
+  tcp_socket writer, reader;
+  if (!pair(writer, reader))
+    return EXIT_FAILURE;
+
+  // 1500 buffers of uneven size, more than IOV_MAX.
+  std::vector<std::string> parts;
+  std::string expected;
+  for (std::size_t i = 0; i < 1500; i++) {
+    parts.push_back(pattern(1000 + i % 977, i));
+    expected += parts.back();
+  }
+  std::vector<iovec> iov;
+  for (auto &p : parts)
+    iov.push_back({p.data(), std::size(p)});
+
+  // only the sending thread takes the alarm.
+  sigset_t alarm;
+  sigemptyset(&alarm);
+  sigaddset(&alarm, SIGALRM);
+  pthread_sigmask(SIG_BLOCK, &alarm, nullptr);
+  std::string gathered;
+  std::thread slow_reader([&] { gathered = drain(reader, true); });
+  pthread_sigmask(SIG_UNBLOCK, &alarm, nullptr);
+
+  itimerval every{{0, 500}, {0, 500}};
+  setitimer(ITIMER_REAL, &every, nullptr);
+  const ssize_t sent = writer.send_vec(iov);
+  itimerval off{};
+  setitimer(ITIMER_REAL, &off, nullptr);
+  writer.close();
+  slow_reader.join();
+  reader.close();
+
+  std::cout << "send_vec: " << sent << " of " << std::size(expected)
+            << std::endl;
+  if (sent != static_cast<ssize_t>(std::size(expected)) ||
+      gathered != expected)
+    return EXIT_FAILURE;
+
+  if (!pair(writer, reader) || writer.send(std::string("hello world")) != 11)
+    return EXIT_FAILURE;
+  char head[5], tail[16];
+  iovec split[2] = {{head, sizeof(head)}, {tail, sizeof(tail)}};
+  const ssize_t got = reader.receive_vec(split);
+  writer.close();
+  reader.close();
+  if (got != 11 || std::string(head, 5) != "hello" ||
+      std::string(tail, 6) != " world")
+    return EXIT_FAILURE;
+
+  const std::string contents = pattern(300000, 3);
+  std::FILE *file = std::tmpfile();
+  if (file == nullptr ||
+      std::fwrite(contents.data(), 1, std::size(contents), file) !=
+          std::size(contents) ||
+      std::fflush(file) != 0)
+    return EXIT_FAILURE;
+
+  if (!pair(writer, reader))
+    return EXIT_FAILURE;
+  std::string sliced;
+  std::thread file_reader([&] { sliced = drain(reader, false); });
+  const ssize_t middle = writer.send_file(fileno(file), 1000, 200000);
+  // asks for more than is left, stops at end of file.
+  const ssize_t rest = writer.send_file(fileno(file), 250000, 100000);
+  writer.close();
+  file_reader.join();
+  reader.close();
+  std::fclose(file);
+
+  std::cout << "send_file: " << middle << " + " << rest << std::endl;
+  if (middle != 200000 || rest != 50000 ||
+      sliced != contents.substr(1000, 200000) + contents.substr(250000))
+    return EXIT_FAILURE;
+
+  // client <-> a, relay(a, b), b <-> server.
+  tcp_socket client, a, b, server;
+  if (!pair(client, a) || !pair(b, server))
+    return EXIT_FAILURE;
+
+  ssize_t relayed = 0;
+  std::thread relaying([&] { relayed = relay(a, b); });
+
+  const std::string request = pattern(400000, 5);
+  const std::string response = pattern(700000, 11);
+  std::string at_server, at_client;
+  std::thread server_side([&] {
+    // everything the client sent, then eof once it shut down its half.
+    at_server = drain(server, false);
+    server.send(response);
+    server.close();
+  });
+  std::thread client_side([&] { at_client = drain(client, false); });
+
+  const ssize_t request_sent = client.send(request);
+  ::shutdown(client.sockfd, SHUT_WR);
+  server_side.join();
+  client_side.join();
+  relaying.join();
+  client.close();
+  a.close();
+  b.close();
+
+  std::cout << "relay: " << relayed << " bytes" << std::endl;
+  return request_sent == static_cast<ssize_t>(std::size(request)) &&
+                 at_server == request && at_client == response &&
+                 relayed == static_cast<ssize_t>(std::size(request) +
+                                                 std::size(response))
+             ? EXIT_SUCCESS
+             : EXIT_FAILURE;
+}
@@ -0,0 +1,70 @@
+#include <array>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "udp.hpp"
+
+/*
+  Moves a few hundred datagrams across loopback with sendmmsg/recvmmsg.
+ */
+int main() {
+  constexpr std::size_t datagram_count = 300;
+
+  udp_resolver r;
+  auto local = r.resolve("127.0.0.1", "9102");
+
+  udp_socket receiver;
+  if (!receiver.bind(local[0]))
+    return EXIT_FAILURE;
+
+  udp_socket sender;
+  if (!sender.bind(r.resolve("127.0.0.1", "9103")[0]))
+    return EXIT_FAILURE;
+
+  std::vector<std::string> payloads(datagram_count);
+  std::vector<endpoint> destinations(datagram_count, local[0]);
+  for (std::size_t i = 0; i < datagram_count; i++)
+    payloads[i] = "datagram " + std::to_string(i);
+
+  std::array<std::array<char, 1500>, 128> buffers;
+  std::array<endpoint, 128> from;
+  std::array<std::size_t, 128> lengths;
+
+  // in rounds, so the receive queue never overflows and drops datagrams.
+  constexpr std::size_t round = 100;
+  std::size_t sent = 0;
+  std::size_t received = 0;
+  std::size_t calls = 0;
+  bool in_order = true;
+  while (sent < datagram_count) {
+    int count = sender.send_batch(
+        std::span(payloads).subspan(sent, round),
+        std::span<const endpoint>(destinations).subspan(sent, round));
+    if (count <= 0)
+      break;
+    sent += count;
+
+    while (received < sent) {
+      count = receiver.receive_batch(buffers, from, lengths);
+      if (count <= 0)
+        break;
+
+      for (int i = 0; i < count; i++)
+        if (std::string(std::data(buffers[i]), lengths[i]) !=
+            payloads[received + i])
+          in_order = false;
+
+      received += count;
+      calls++;
+    }
+  }
+
+  std::cout << "Received " << received << " datagrams in " << calls
+            << " calls" << std::endl;
+
+  sender.close();
+  receiver.close();
+  return received == datagram_count && in_order ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,70 @@
+#include <array>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "udp.hpp"
+
+/*
+  Sends one buffer split by the kernel (GSO) and reassembles the datagrams
+  through GRO on a loopback receiver.
+ */
+int main() {
+  constexpr std::size_t segment_size = 1200;
+  constexpr std::size_t segment_count = 40;
+
+  udp_resolver r;
+  auto local = r.resolve("127.0.0.1", "9104");
+
+  udp_socket receiver;
+  if (!receiver.bind(local[0]))
+    return EXIT_FAILURE;
+  if (!receiver.set_gro())
+    std::cerr << "UDP_GRO not supported, expecting plain datagrams"
+              << std::endl;
+
+  udp_socket sender;
+  if (!sender.bind(r.resolve("127.0.0.1", "9105")[0]))
+    return EXIT_FAILURE;
+
+  // every segment is filled with its own index, the last one is short.
+  std::string payload;
+  for (std::size_t i = 0; i < segment_count; i++)
+    payload.append(i + 1 < segment_count ? segment_size : segment_size / 2,
+                   static_cast<char>('A' + i % 26));
+
+  ssize_t sent = sender.send_segmented(payload, local[0], segment_size);
+  std::cout << "Sent " << sent << " bytes in one call" << std::endl;
+  if (sent != static_cast<ssize_t>(payload.size()))
+    return EXIT_FAILURE;
+
+  std::vector<std::byte> buffer(65536);
+  std::vector<std::span<const std::byte>> segments;
+  std::size_t seen = 0;
+  std::size_t calls = 0;
+  bool intact = true;
+  while (seen < segment_count) {
+    endpoint from;
+    if (receiver.receive_coalesced(buffer, from, segments) <= 0)
+      break;
+
+    calls++;
+    for (const auto &segment : segments) {
+      const std::size_t expected_size =
+          seen + 1 < segment_count ? segment_size : segment_size / 2;
+      if (std::size(segment) != expected_size ||
+          static_cast<char>(segment.front()) !=
+              static_cast<char>('A' + seen % 26))
+        intact = false;
+      seen++;
+    }
+  }
+
+  std::cout << "Received " << seen << " datagrams in " << calls << " calls"
+            << std::endl;
+
+  sender.close();
+  receiver.close();
+  return seen == segment_count && intact ? EXIT_SUCCESS : EXIT_FAILURE;
+}
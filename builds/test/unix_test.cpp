@@ -0,0 +1,98 @@
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "unix.hpp"
+
+/*
+  Stream echo over an abstract address, message boundaries on a seqpacket
+  pair, a pipe passed with SCM_RIGHTS, cleanup of a filesystem path, and
+  bind leaving a live listener's path alone but replacing a stale one.
+ */
+int main() {
+  bool ok = true;
+
+  unix_socket listener;
+  if (!listener.bind("@enet/unix-test") || !listener.listen(8))
+    return EXIT_FAILURE;
+
+  unix_socket client;
+  ok &= client.connect("@enet/unix-test");
+  unix_socket server = listener.accept();
+
+  std::uint64_t value = 0;
+  const std::uint64_t sent = 0x0123456789abcdef;
+  client.send(std::string_view(reinterpret_cast<const char *>(&sent),
+                               sizeof(sent)));
+  ok &= server.receive_into(value) == sizeof(value) && value == sent;
+
+  // seqpacket keeps each send a separate message.
+  auto [left, right] = unix_socket::pair(SOCK_SEQPACKET);
+  left.send(std::string("first"));
+  left.send(std::string("second"));
+  std::array<char, 64> buf;
+  ssize_t n = right.receive(buf);
+  ok &= std::string(std::data(buf), n) == "first";
+  n = right.receive(buf);
+  ok &= std::string(std::data(buf), n) == "second";
+
+  // the read end of a pipe travels to the other side.
+  int pipefd[2];
+  if (::pipe(pipefd) == -1)
+    return EXIT_FAILURE;
+  const int fds[] = {pipefd[0]};
+  ok &= client.send_fds(std::string("fd"), fds) == 2;
+  ::close(pipefd[0]);
+
+  std::vector<int> received;
+  n = server.receive_fds(buf, received);
+  ok &= n == 2 && std::size(received) == 1;
+  if (std::size(received) == 1) {
+    ok &= ::write(pipefd[1], "via pipe", 8) == 8;
+    ok &= ::read(received[0], std::data(buf), 8) == 8 &&
+          std::string(std::data(buf), 8) == "via pipe";
+    ::close(received[0]);
+  }
+  ::close(pipefd[1]);
+
+  // a filesystem listener removes its socket file on close.
+  const std::string path = "/tmp/enet_unix_test.sock";
+  unix_socket file_listener;
+  ok &= file_listener.bind(path) && file_listener.listen(1);
+  struct stat st;
+  ok &= ::stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode);
+
+  // a second listener must not take the path of a live one.
+  unix_socket intruder;
+  ok &= !intruder.bind(path);
+  unix_socket caller;
+  ok &= caller.connect(path);
+  caller.close();
+  file_listener.close();
+  ok &= ::stat(path.c_str(), &st) == -1;
+
+  // a socket file nobody listens on any more is replaced.
+  const int stale = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::strcpy(addr.sun_path, path.c_str());
+  ok &= ::bind(stale, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0;
+  ::close(stale);
+  ok &= file_listener.bind(path) && file_listener.listen(1);
+  file_listener.close();
+
+  std::cout << (ok ? "Unix sockets behaved" : "Unix socket mismatch")
+            << std::endl;
+
+  for (auto *sock : {&client, &server, &listener, &left, &right})
+    sock->close();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,323 @@
+#ifndef ACCEPTOR_HPP
+#define ACCEPTOR_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "endpoint.hpp"
+#include "io_result.hpp"
+#include "log.hpp"
+#include "reactor.hpp"
+
+/*
+  Admission limits for an acceptor, 0 disables a limit.
+
+  At max_connections the acceptor stops accepting and leaves new
+  connections in the kernel backlog until release() frees a slot. A
+  source over max_per_source is accepted and closed right away, since
+  the backlog cannot be skipped selectively. Under memory pressure, or
+  when accept runs out of descriptors, accepting pauses for pause_ms.
+
+  under_pressure replaces the default check, MemAvailable below
+  min_available_kb, which is re-read at most every pressure_check_ms.
+ */
+struct admission_policy {
+  std::size_t max_connections = 0;
+  std::size_t max_per_source = 0;
+  std::size_t batch = 64;
+  std::uint64_t min_available_kb = 0;
+  int pressure_check_ms = 100;
+  int pause_ms = 100;
+  std::function<bool()> under_pressure;
+};
+
+/*
+  What the acceptor did, readable from any thread.
+ */
+struct admission_stats {
+  std::atomic<std::uint64_t> accepted = 0;
+  std::atomic<std::uint64_t> rejected_source = 0;
+  std::atomic<std::uint64_t> deferred_full = 0;
+  std::atomic<std::uint64_t> pauses = 0;
+  std::atomic<std::uint64_t> errors = 0;
+};
+
+/*
+  Backlog state as the kernel sees it. queued and backlog are for this
+  listener (TCP_INFO on a listening socket), overflows and drops are the
+  host-wide ListenOverflows and ListenDrops from /proc/net/netstat.
+ */
+struct listen_counters {
+  std::uint32_t queued = 0;
+  std::uint32_t backlog = 0;
+  std::uint64_t overflows = 0;
+  std::uint64_t drops = 0;
+};
+
+/*
+  Drains a listener's accept queue in batches with accept4 (the try_accept
+  of tcp_socket and ssl_socket) and applies an admission_policy to every
+  connection. Use drain() from your own loop, or attach() to a reactor
+  which drains on readiness and resumes after a pause with a timer.
+
+  An acceptor belongs to one thread, the one calling drain() or running
+  the reactor. The handler owns each client, and must call release() with
+  its descriptor before closing it so the slot is counted free again.
+ */
+template <typename Socket> struct acceptor {
+  using handler = std::function<void(Socket client, const endpoint &from)>;
+
+  explicit acceptor(Socket &sock, admission_policy p = {})
+      : listener(sock), policy(std::move(p)) {}
+
+  ~acceptor() { detach(); }
+
+  acceptor(const acceptor &) = delete;
+  acceptor &operator=(const acceptor &) = delete;
+
+  /*
+    Accepts up to policy.batch connections, fewer if the queue empties or
+    a limit is hit. Returns the number handed to fn. Rejected and failed
+    accepts count against the batch too, exhausted tells whether the batch
+    ran out before the queue did. An error other than a transient one
+    ends the drain without setting exhausted.
+   */
+  std::size_t drain(const handler &fn) {
+    exhausted = false;
+    if (paused())
+      return 0;
+    if (pressured()) {
+      pause();
+      return 0;
+    }
+
+    std::size_t handed = 0;
+    for (std::size_t i = 0;; i++) {
+      if (policy.batch != 0 && i == policy.batch) {
+        exhausted = true;
+        break;
+      }
+
+      if (policy.max_connections != 0 &&
+          std::size(sources) >= policy.max_connections) {
+        stats.deferred_full.fetch_add(1, std::memory_order_relaxed);
+        full = true;
+        break;
+      }
+
+      Socket client;
+      endpoint from;
+      const io_status status = listener.try_accept(client, &from);
+      if (status == io_status::would_block)
+        break;
+      if (status == io_status::error) {
+        if (listener.last_error.out_of_resources()) {
+          log_warn("Accept paused: ", listener.last_error.message());
+          pause();
+          break;
+        }
+        stats.errors.fetch_add(1, std::memory_order_relaxed);
+        if (listener.last_error.transient())
+          continue;
+        // the listener itself is broken (closed, not listening), retrying
+        // would only spin.
+        log_error("Accept failed: ", listener.last_error.message());
+        break;
+      }
+
+      std::string key = source_key(from);
+      std::size_t &count = per_source[key];
+      if (policy.max_per_source != 0 && count >= policy.max_per_source) {
+        stats.rejected_source.fetch_add(1, std::memory_order_relaxed);
+        client.close();
+        continue;
+      }
+
+      count++;
+      sources[client.sockfd] = std::move(key);
+      stats.accepted.fetch_add(1, std::memory_order_relaxed);
+      handed++;
+      fn(std::move(client), from);
+    }
+
+    return handed;
+  }
+
+  /*
+    Registers the listener with loop. Every readiness event drains the
+    queue, a pause or a full table is picked up again by a timer or by
+    release().
+   */
+  bool attach(reactor &r, handler fn) {
+    loop = &r;
+    on_accept = std::move(fn);
+    return loop->add(listener, EPOLLIN, [this](std::uint32_t) { service(); });
+  }
+
+  void detach() {
+    if (loop == nullptr)
+      return;
+    loop->timers.cancel(resume_timer);
+    loop->remove(listener.sockfd);
+    loop = nullptr;
+  }
+
+  /*
+    The connection on fd is gone. Frees its slot, and resumes accepting
+    if the table was full.
+   */
+  void release(const int fd) {
+    auto it = sources.find(fd);
+    if (it == std::end(sources))
+      return;
+
+    auto count = per_source.find(it->second);
+    if (count != std::end(per_source) && --count->second == 0)
+      per_source.erase(count);
+    sources.erase(it);
+
+    // from the next turn of the loop, release() may run inside the handler.
+    if (full && loop != nullptr && !loop->timers.armed(resume_timer)) {
+      full = false;
+      resume_timer = loop->timers.schedule(std::chrono::milliseconds(0),
+                                           [this] { service(); });
+    }
+  }
+
+  std::size_t connections() const { return std::size(sources); }
+
+  listen_counters counters() const {
+    listen_counters c;
+    tcp_info info{};
+    socklen_t len = sizeof(info);
+    // on a listener unacked is the accept queue length, sacked its limit.
+    if (getsockopt(listener.sockfd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+      c.queued = info.tcpi_unacked;
+      c.backlog = info.tcpi_sacked;
+    }
+
+    std::ifstream netstat("/proc/net/netstat");
+    std::string names, values;
+    while (std::getline(netstat, names) && std::getline(netstat, values)) {
+      if (!names.starts_with("TcpExt:"))
+        continue;
+
+      std::istringstream n(names), v(values);
+      std::string name, value;
+      while (n >> name && v >> value) {
+        if (name == "ListenOverflows")
+          c.overflows = std::stoull(value);
+        else if (name == "ListenDrops")
+          c.drops = std::stoull(value);
+      }
+    }
+
+    return c;
+  }
+
+  /*
+    One batch per turn of the loop. Edge-triggered readiness does not fire
+    again for connections left queued, so a full batch or a pause
+    schedules the next one on the loop's timers.
+   */
+  void service() {
+    drain(on_accept);
+    if (loop == nullptr || loop->timers.armed(resume_timer))
+      return;
+
+    if (paused())
+      resume_timer = loop->timers.schedule(
+          std::chrono::milliseconds(policy.pause_ms), [this] { service(); });
+    else if (exhausted)
+      resume_timer = loop->timers.schedule(std::chrono::milliseconds(0),
+                                           [this] { service(); });
+  }
+
+  bool paused() const {
+    return std::chrono::steady_clock::now() < paused_until;
+  }
+
+  void pause() {
+    paused_until = std::chrono::steady_clock::now() +
+                   std::chrono::milliseconds(policy.pause_ms);
+    stats.pauses.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  bool pressured() {
+    if (policy.under_pressure)
+      return policy.under_pressure();
+    if (policy.min_available_kb == 0)
+      return false;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= next_pressure_check) {
+      next_pressure_check =
+          now + std::chrono::milliseconds(policy.pressure_check_ms);
+      const std::uint64_t available = available_kb();
+      low_memory = available != 0 && available < policy.min_available_kb;
+    }
+
+    return low_memory;
+  }
+
+  static std::uint64_t available_kb() {
+    std::ifstream meminfo("/proc/meminfo");
+    std::string name;
+    std::uint64_t kb;
+    while (meminfo >> name >> kb) {
+      if (name == "MemAvailable:")
+        return kb;
+      meminfo.ignore(64, '\n');
+    }
+    return 0;
+  }
+
+  /*
+    Address bytes without the port, so all connections of a host count
+    together.
+   */
+  static std::string source_key(const endpoint &from) {
+    if (from.family == AF_INET) {
+      const auto &in = reinterpret_cast<const sockaddr_in &>(from.storage);
+      return std::string(reinterpret_cast<const char *>(&in.sin_addr),
+                         sizeof(in.sin_addr));
+    }
+    if (from.family == AF_INET6) {
+      const auto &in6 = reinterpret_cast<const sockaddr_in6 &>(from.storage);
+      return std::string(reinterpret_cast<const char *>(&in6.sin6_addr),
+                         sizeof(in6.sin6_addr));
+    }
+    return {};
+  }
+
+  Socket &listener;
+  admission_policy policy;
+  admission_stats stats;
+  reactor *loop = nullptr;
+  handler on_accept;
+  timer_wheel::timer_id resume_timer = timer_wheel::invalid;
+  // the last drain() used up its batch, connections may still be queued.
+  bool exhausted = false;
+  bool full = false;
+  bool low_memory = false;
+  std::chrono::steady_clock::time_point paused_until{};
+  std::chrono::steady_clock::time_point next_pressure_check{};
+  std::unordered_map<int, std::string> sources;
+  std::unordered_map<std::string, std::size_t> per_source;
+};
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+  Receive buffers without per-call stack arrays or growing strings.
+  Sockets read straight into fixed-size pooled blocks, a buffer_chain
+  strings blocks together, and upper layers look at, slice and drop the
+  bytes in place. The one copy left is the one into the caller's own
+  container, sized exactly.
+ */
+
+/*
+  A pooled block: a refcount and size header followed by the bytes.
+ */
+struct buffer_block {
+  std::atomic<std::uint32_t> refs;
+  std::uint32_t size;
+
+  std::byte *data() { return reinterpret_cast<std::byte *>(this + 1); }
+};
+
+/*
+  Process-wide free list of block_size blocks. Each thread keeps a small
+  cache in front of it, so allocation normally takes no lock. At most
+  max_cached free blocks are kept, the rest go back to the system.
+ */
+struct buffer_pool {
+  static constexpr std::size_t block_size = 16 * 1024;
+  static constexpr std::size_t capacity = block_size - sizeof(buffer_block);
+  static constexpr std::size_t max_cached = 1024;
+  static constexpr std::size_t local_cached = 32;
+
+  static buffer_pool &shared() {
+    static buffer_pool instance;
+    return instance;
+  }
+
+  ~buffer_pool() {
+    for (auto *b : free)
+      ::operator delete(b);
+  }
+
+  static buffer_block *acquire() {
+    auto &local = cache();
+    buffer_block *b;
+    if (!local.blocks.empty()) {
+      b = local.blocks.back();
+      local.blocks.pop_back();
+    } else {
+      b = shared().take();
+    }
+
+    b->refs.store(1, std::memory_order_relaxed);
+    b->size = 0;
+    return b;
+  }
+
+  static void release(buffer_block *b) {
+    if (b->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+      return;
+
+    auto &local = cache();
+    if (local.blocks.size() < local_cached)
+      local.blocks.push_back(b);
+    else
+      shared().give(b);
+  }
+
+  buffer_block *take() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!free.empty()) {
+        buffer_block *b = free.back();
+        free.pop_back();
+        return b;
+      }
+    }
+
+    return new (::operator new(block_size)) buffer_block{};
+  }
+
+  void give(buffer_block *b) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (free.size() < max_cached) {
+        free.push_back(b);
+        return;
+      }
+    }
+
+    ::operator delete(b);
+  }
+
+  /*
+    Per-thread cache, handed back to the shared list when the thread
+    exits.
+   */
+  struct local_cache {
+    ~local_cache() {
+      for (auto *b : blocks)
+        shared().give(b);
+    }
+    std::vector<buffer_block *> blocks;
+  };
+
+  static local_cache &cache() {
+    static thread_local local_cache c;
+    return c;
+  }
+
+  std::mutex mutex;
+  std::vector<buffer_block *> free;
+};
+
+/*
+  Shared view of part of a block. Copies share the block, the block goes
+  back to the pool with its last reference.
+ */
+struct buffer_ref {
+  buffer_ref() = default;
+  explicit buffer_ref(buffer_block *b) : block(b) {}
+  buffer_ref(const buffer_ref &other)
+      : block(other.block), offset(other.offset), length(other.length) {
+    if (block != nullptr)
+      block->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  buffer_ref(buffer_ref &&other) noexcept
+      : block(std::exchange(other.block, nullptr)), offset(other.offset),
+        length(other.length) {}
+  buffer_ref &operator=(buffer_ref other) noexcept {
+    std::swap(block, other.block);
+    std::swap(offset, other.offset);
+    std::swap(length, other.length);
+    return *this;
+  }
+  ~buffer_ref() {
+    if (block != nullptr)
+      buffer_pool::release(block);
+  }
+
+  std::span<const std::byte> bytes() const {
+    return {block->data() + offset, length};
+  }
+  std::string_view view() const {
+    return {reinterpret_cast<const char *>(block->data() + offset), length};
+  }
+
+  /*
+    Only the sole owner may write after the view.
+   */
+  bool writable() const {
+    return block->refs.load(std::memory_order_acquire) == 1 &&
+           offset + length == block->size;
+  }
+
+  buffer_block *block = nullptr;
+  std::uint32_t offset = 0;
+  std::uint32_t length = 0;
+};
+
+/*
+  Byte queue made of pooled blocks. Receive with prepare()/commit() or
+  receive(sock), look at the bytes with find()/segments(), take them
+  with consume()/slice() or copy them out once with copy_to().
+
+  limit bounds what one chain holds, prepare() returns an empty span once
+  it is reached, so a peer cannot make a connection buffer grow forever.
+ */
+struct buffer_chain {
+  static constexpr std::size_t npos = std::string_view::npos;
+  static constexpr std::size_t default_limit = 64 * 1024 * 1024;
+
+  explicit buffer_chain(const std::size_t max = default_limit) : limit(max) {}
+
+  std::size_t size() const { return total; }
+  bool empty() const { return total == 0; }
+
+  /*
+    Free space at the end of the last block, or of a new one.
+   */
+  std::span<std::byte> prepare() {
+    if (total >= limit)
+      return {};
+
+    if (segments.empty() || !segments.back().writable() ||
+        segments.back().block->size == buffer_pool::capacity) {
+      segments.emplace_back(buffer_pool::acquire());
+    }
+
+    buffer_block *b = segments.back().block;
+    const std::size_t room =
+        std::min(buffer_pool::capacity - b->size, limit - total);
+    return {b->data() + b->size, room};
+  }
+
+  void commit(const std::size_t n) {
+    buffer_ref &last = segments.back();
+    last.block->size += n;
+    last.length += n;
+    total += n;
+  }
+
+  /*
+    One receive call straight into the chain. Returns what the socket
+    returned, or -1 once limit is reached.
+   */
+  template <typename Socket> ssize_t receive(Socket &sock) {
+    std::span<std::byte> space = prepare();
+    if (space.empty())
+      return -1;
+
+    const ssize_t bytes = sock.receive(space);
+    if (bytes > 0)
+      commit(bytes);
+    return bytes;
+  }
+
+  /*
+    Receives until the peer closes and appends everything to out. The
+    chain is flushed into out whenever it reaches limit, so a long stream
+    is never cut short.
+   */
+  template <typename Socket, typename Container>
+  void receive_all(Socket &sock, Container &out) {
+    while (true) {
+      const ssize_t bytes = receive(sock);
+      if (bytes > 0)
+        continue;
+      if (bytes == -1 && total >= limit) {
+        append_to(out);
+        clear();
+        continue;
+      }
+      break;
+    }
+
+    append_to(out);
+    clear();
+  }
+
+  /*
+    Drops n bytes from the front, handing emptied blocks back.
+   */
+  void consume(std::size_t n) {
+    n = std::min(n, total);
+    total -= n;
+    std::size_t drop = 0;
+    while (n > 0) {
+      buffer_ref &front = segments[drop];
+      if (n < front.length) {
+        front.offset += n;
+        front.length -= n;
+        break;
+      }
+
+      n -= front.length;
+      drop++;
+    }
+
+    segments.erase(std::begin(segments), std::begin(segments) + drop);
+  }
+
+  /*
+    Shares the n bytes at offset as a new chain, no bytes are copied.
+   */
+  buffer_chain slice(std::size_t offset, std::size_t n) const {
+    buffer_chain out(limit);
+    for (const auto &seg : segments) {
+      if (n == 0)
+        break;
+      if (offset >= seg.length) {
+        offset -= seg.length;
+        continue;
+      }
+
+      buffer_ref part = seg;
+      part.offset += offset;
+      part.length = std::min<std::size_t>(seg.length - offset, n);
+      n -= part.length;
+      out.total += part.length;
+      out.segments.push_back(std::move(part));
+      offset = 0;
+    }
+
+    return out;
+  }
+
+  /*
+    Position of needle at or after from, npos if absent. Matches may span
+    blocks.
+   */
+  std::size_t find(const std::string_view needle,
+                   const std::size_t from = 0) const {
+    if (needle.empty())
+      return from <= total ? from : npos;
+
+    const std::size_t keep = needle.size() - 1;
+    // the last bytes before the current block, for matches across it, and
+    // those followed by the block's first bytes. Both keep their capacity.
+    std::string window;
+    std::string joined;
+    std::size_t base = 0;
+    for (const auto &seg : segments) {
+      const std::string_view s = seg.view();
+      if (!window.empty()) {
+        const std::size_t joined_base = base - window.size();
+        joined.assign(window);
+        joined.append(s.substr(0, keep));
+        const std::size_t i =
+            joined.find(needle, from > joined_base ? from - joined_base : 0);
+        if (i != npos && i < window.size())
+          return joined_base + i;
+      }
+
+      const std::size_t start = from > base ? from - base : 0;
+      if (start < s.size()) {
+        const std::size_t i = s.find(needle, start);
+        if (i != npos)
+          return base + i;
+      }
+
+      if (s.size() >= keep) {
+        window.assign(s.substr(s.size() - keep));
+      } else {
+        window.append(s);
+        if (window.size() > keep)
+          window.erase(0, window.size() - keep);
+      }
+      base += s.size();
+    }
+
+    return npos;
+  }
+
+  /*
+    Copies count bytes from offset into out, returns the amount copied.
+   */
+  std::size_t copy_to(std::byte *out, std::size_t offset,
+                      std::size_t count) const {
+    std::size_t copied = 0;
+    for (const auto &seg : segments) {
+      if (count == 0)
+        break;
+      if (offset >= seg.length) {
+        offset -= seg.length;
+        continue;
+      }
+
+      const std::size_t n = std::min<std::size_t>(seg.length - offset, count);
+      std::copy_n(seg.bytes().data() + offset, n, out + copied);
+      copied += n;
+      count -= n;
+      offset = 0;
+    }
+
+    return copied;
+  }
+
+  /*
+    Appends the bytes in [offset, offset + count) to a byte container.
+   */
+  template <typename Container>
+  void append_to(Container &out, const std::size_t offset = 0,
+                 std::size_t count = npos) const {
+    if (offset >= total)
+      return;
+    count = std::min(count, total - offset);
+
+    const std::size_t at = std::size(out);
+    out.resize(at + count / sizeof(*std::data(out)));
+    copy_to(reinterpret_cast<std::byte *>(std::data(out)) +
+                at * sizeof(*std::data(out)),
+            offset, count);
+  }
+
+  std::string to_string(const std::size_t offset = 0,
+                        const std::size_t count = npos) const {
+    std::string out;
+    append_to(out, offset, count);
+    return out;
+  }
+
+  /*
+    The first n bytes as one view, in place when they sit in the first
+    block, otherwise copied once into scratch.
+   */
+  std::string_view linear(std::size_t n, std::string &scratch) const {
+    n = std::min(n, total);
+    if (n == 0)
+      return {};
+    if (n <= segments.front().length)
+      return segments.front().view().substr(0, n);
+
+    scratch = to_string(0, n);
+    return scratch;
+  }
+
+  /*
+    The chain as scatter/gather entries, for writev/sendmsg.
+   */
+  std::vector<iovec> iovecs() const {
+    std::vector<iovec> out;
+    out.reserve(segments.size());
+    for (const auto &seg : segments)
+      out.push_back({const_cast<std::byte *>(seg.bytes().data()), seg.length});
+    return out;
+  }
+
+  void clear() {
+    segments.clear();
+    total = 0;
+  }
+
+  std::vector<buffer_ref> segments;
+  std::size_t total = 0;
+  std::size_t limit;
+};
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef CONNECTION_POOL_HPP
+#define CONNECTION_POOL_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "endpoint.hpp"
+
+/*
+  Keeps client connections open between requests, per host, so a request
+  to a host seen recently skips the TCP (and TLS) handshake.
+
+  A socket is leased with acquire() and handed back with release(). Idle
+  sockets are kept most recently used first, at most max_idle_per_host
+  per host and max_idle in all, and closed once idle for idle_timeout.
+  Before an idle socket is handed out it is polled, one the peer closed
+  or that has unread bytes waiting is dropped instead. At most
+  max_per_host sockets to one host exist at a time, leased or idle,
+  acquire() waits up to acquire_timeout for one to come back.
+
+  Socket is tcp_socket or ssl_socket, anything with sockfd, profile and
+  close(). Safe to share between threads.
+ */
+template <typename Socket> struct connection_pool {
+  using clock = std::chrono::steady_clock;
+
+  struct limits {
+    std::size_t max_idle_per_host = 8;
+    std::size_t max_idle = 256;
+    std::size_t max_per_host = 64;
+    std::chrono::milliseconds idle_timeout = std::chrono::seconds(30);
+    std::chrono::milliseconds acquire_timeout = std::chrono::seconds(5);
+  };
+
+  enum class lease {
+    // s holds an open connection from the pool.
+    reused,
+    // nothing idle, the caller connects s itself.
+    fresh,
+    // max_per_host reached and nothing came back in time.
+    refused,
+  };
+
+  connection_pool() = default;
+  explicit connection_pool(const limits l) : config(l) {}
+
+  ~connection_pool() {
+    for (auto &[k, h] : hosts)
+      for (auto &e : h.idle)
+        e.sock.close();
+  }
+
+  connection_pool(const connection_pool &) = delete;
+  connection_pool &operator=(const connection_pool &) = delete;
+
+  /*
+    Process-wide instance used by http_socket and https_socket.
+   */
+  static connection_pool &shared() {
+    static connection_pool instance;
+    return instance;
+  }
+
+  /*
+    Pool key of an endpoint: its name and address, so two names for one
+    address do not share connections (Host headers and TLS names differ).
+   */
+  static std::string key(const endpoint &ep) {
+    std::string k = ep.canonname;
+    k += '\0';
+    k.append(reinterpret_cast<const char *>(&ep.storage), ep.addrlen);
+    return k;
+  }
+
+  /*
+    Leases a connection to k into s. Unless refused, the lease must be
+    given back with release(), also when connecting failed.
+   */
+  lease acquire(const std::string &k, Socket &s) {
+    std::vector<Socket> stale;
+    lease result = lease::fresh;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      host &h = hosts[k];
+      const auto deadline = clock::now() + config.acquire_timeout;
+      for (bool timed_out = false;;) {
+        expire(h, clock::now(), stale);
+        if (take_alive(h, s, stale)) {
+          result = lease::reused;
+          break;
+        }
+        if (h.leased < config.max_per_host)
+          break;
+        if (timed_out) {
+          result = lease::refused;
+          break;
+        }
+        timed_out =
+            h.returned.wait_until(lock, deadline) == std::cv_status::timeout;
+      }
+
+      if (result == lease::reused)
+        reused++;
+      else if (result == lease::fresh)
+        created++;
+      else
+        refused++;
+      if (result != lease::refused)
+        h.leased++;
+    }
+
+    close_all(stale);
+    return result;
+  }
+
+  /*
+    Ends the lease on s. With reusable set and s still open it is kept
+    for the next acquire(), otherwise it is closed. s is left closed
+    either way, its profile untouched.
+   */
+  void release(const std::string &k, Socket &s, const bool reusable) {
+    Socket kept = s;
+    s = Socket{};
+    s.profile = kept.profile;
+
+    std::vector<Socket> stale;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      host &h = hosts[k];
+      if (h.leased > 0)
+        h.leased--;
+
+      const auto now = clock::now();
+      expire(h, now, stale);
+      if (reusable && kept.sockfd != -1 &&
+          std::size(h.idle) < config.max_idle_per_host) {
+        if (idle_total >= config.max_idle)
+          evict_oldest(stale);
+        h.idle.push_back({kept, now});
+        idle_total++;
+      } else if (kept.sockfd != -1) {
+        stale.push_back(kept);
+      }
+
+      h.returned.notify_one();
+    }
+
+    close_all(stale);
+  }
+
+  /*
+    Closes every socket idle for longer than idle_timeout.
+   */
+  void prune() {
+    std::vector<Socket> stale;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      const auto now = clock::now();
+      for (auto &[k, h] : hosts)
+        expire(h, now, stale);
+    }
+
+    close_all(stale);
+  }
+
+  std::size_t idle() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return idle_total;
+  }
+
+  /*
+    Whether an idle connection is still usable: not closed or reset by
+    the peer and with nothing unread, a stray byte would be taken for the
+    next response.
+   */
+  static bool alive(const int fd) {
+    pollfd p{fd, POLLIN, 0};
+    const int ready = ::poll(&p, 1, 0);
+    if (ready < 0)
+      return false;
+    if (ready == 0)
+      return true;
+    if (p.revents & (POLLERR | POLLHUP | POLLNVAL))
+      return false;
+
+    char byte;
+    return ::recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+           (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+
+  struct entry {
+    Socket sock;
+    clock::time_point since;
+  };
+
+  struct host {
+    // oldest first, acquire() takes from the back.
+    std::vector<entry> idle;
+    std::size_t leased = 0;
+    std::condition_variable returned;
+  };
+
+  /*
+    Moves h's expired sockets to stale, mutex must be held.
+   */
+  void expire(host &h, const clock::time_point now, std::vector<Socket> &stale) {
+    std::size_t n = 0;
+    while (n < std::size(h.idle) && now - h.idle[n].since >= config.idle_timeout)
+      stale.push_back(h.idle[n++].sock);
+    h.idle.erase(std::begin(h.idle), std::begin(h.idle) + n);
+    idle_total -= n;
+  }
+
+  /*
+    Most recently used live socket of h into s, dead ones to stale,
+    mutex must be held.
+   */
+  bool take_alive(host &h, Socket &s, std::vector<Socket> &stale) {
+    while (!h.idle.empty()) {
+      Socket candidate = h.idle.back().sock;
+      h.idle.pop_back();
+      idle_total--;
+      if (alive(candidate.sockfd)) {
+        candidate.profile = s.profile;
+        s = candidate;
+        return true;
+      }
+      dead++;
+      stale.push_back(candidate);
+    }
+    return false;
+  }
+
+  /*
+    Makes room under max_idle by dropping the longest idle socket of any
+    host, mutex must be held.
+   */
+  void evict_oldest(std::vector<Socket> &stale) {
+    host *oldest = nullptr;
+    for (auto &[k, h] : hosts)
+      if (!h.idle.empty() &&
+          (oldest == nullptr || h.idle.front().since < oldest->idle.front().since))
+        oldest = &h;
+    if (oldest == nullptr)
+      return;
+
+    stale.push_back(oldest->idle.front().sock);
+    oldest->idle.erase(std::begin(oldest->idle));
+    idle_total--;
+  }
+
+  static void close_all(std::vector<Socket> &stale) {
+    for (auto &s : stale)
+      s.close();
+  }
+
+  limits config;
+  std::mutex mutex;
+  std::unordered_map<std::string, host> hosts;
+  std::size_t idle_total = 0;
+
+  // counters, read under mutex.
+  std::size_t reused = 0;
+  std::size_t created = 0;
+  std::size_t dead = 0;
+  std::size_t refused = 0;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef CONNECTOR_HPP
+#define CONNECTOR_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "endpoint.hpp"
+#include "log.hpp"
+#include "socket_profile.hpp"
+
+/*
+  Happy Eyeballs (RFC 8305) connection racing over every endpoint a resolver
+  returned. Addresses are interleaved by family, a new non-blocking attempt
+  starts every attempt_delay_ms (or right away when the previous one fails),
+  and the first handshake to complete wins while the rest are closed. A dead
+  address only costs attempt_delay_ms instead of the kernel SYN timeout.
+ */
+struct connector {
+  static constexpr int default_timeout_ms = 10000;
+  static constexpr int default_attempt_delay_ms = 250;
+
+  /*
+    Returns the connected descriptor in blocking mode, or -1 once every
+    endpoint failed or timeout_ms passed. profile is applied to every
+    attempt, winner, if given, receives the endpoint that connected.
+   */
+  static int connect(const std::vector<endpoint> &endpoints,
+                     const int timeout_ms = default_timeout_ms,
+                     const socket_profile &profile = {},
+                     endpoint *winner = nullptr,
+                     const int attempt_delay_ms = default_attempt_delay_ms) {
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+    const std::vector<endpoint> order = interleave(endpoints);
+
+    std::vector<pollfd> attempts;
+    std::vector<std::size_t> attempt_index;
+    std::size_t next = 0;
+    auto next_start = clock::now();
+    int connected = -1;
+
+    while (connected == -1) {
+      const auto now = clock::now();
+      if (now >= deadline)
+        break;
+
+      if (next < std::size(order) && (now >= next_start || attempts.empty())) {
+        const int fd = start(order[next], profile);
+        if (fd != -1) {
+          attempts.push_back({fd, POLLOUT, 0});
+          attempt_index.push_back(next);
+          next_start = now + std::chrono::milliseconds(attempt_delay_ms);
+        }
+        next++;
+        continue;
+      }
+
+      if (attempts.empty())
+        break;
+
+      auto wake = deadline;
+      if (next < std::size(order))
+        wake = std::min(wake, next_start);
+      const int wait_ms = static_cast<int>(
+          std::chrono::ceil<std::chrono::milliseconds>(wake - now).count());
+
+      const int ready = ::poll(std::data(attempts), std::size(attempts),
+                               std::max(wait_ms, 0));
+      if (ready == -1 && errno != EINTR) {
+        log_error("poll failed.");
+        break;
+      }
+
+      for (std::size_t i = 0; i < std::size(attempts) && ready > 0;) {
+        if (attempts[i].revents == 0) {
+          i++;
+          continue;
+        }
+
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (::getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &len) ==
+                0 &&
+            error == 0) {
+          connected = attempts[i].fd;
+          if (winner != nullptr)
+            *winner = order[attempt_index[i]];
+          attempts.erase(std::begin(attempts) + i);
+          break;
+        }
+
+        // a failed attempt lets the next address start without waiting.
+        ::close(attempts[i].fd);
+        attempts.erase(std::begin(attempts) + i);
+        attempt_index.erase(std::begin(attempt_index) + i);
+        next_start = clock::now();
+      }
+    }
+
+    for (auto &attempt : attempts)
+      ::close(attempt.fd);
+
+    if (connected == -1) {
+      log_error("Connection failed.");
+      return -1;
+    }
+
+    ::fcntl(connected, F_SETFL, ::fcntl(connected, F_GETFL) & ~O_NONBLOCK);
+    return connected;
+  }
+
+  /*
+    Alternates address families, starting with the resolver's first choice,
+    keeping the resolver's order within each family.
+   */
+  static std::vector<endpoint>
+  interleave(const std::vector<endpoint> &endpoints) {
+    if (endpoints.empty())
+      return {};
+
+    const int first = endpoints[0].addr.sa_family;
+    std::vector<endpoint> preferred, other, order;
+    for (const auto &ep : endpoints)
+      (ep.addr.sa_family == first ? preferred : other).push_back(ep);
+
+    for (std::size_t i = 0; i < std::max(std::size(preferred), std::size(other));
+         i++) {
+      if (i < std::size(preferred))
+        order.push_back(preferred[i]);
+      if (i < std::size(other))
+        order.push_back(other[i]);
+    }
+
+    return order;
+  }
+
+  /*
+    Starts a non-blocking connect, returns the descriptor or -1 when the
+    attempt failed immediately.
+
+    TCP_FASTOPEN_CONNECT stays off: with a cached cookie connect() returns
+    at once and defers the SYN to the first write, so an attempt would
+    look connected before the address ever answered and win the race.
+   */
+  static int start(const endpoint &ep, const socket_profile &profile = {}) {
+    const int fd = ::socket(ep.addr.sa_family,
+                            SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                            IPPROTO_TCP);
+    if (fd == -1)
+      return -1;
+
+    socket_profile racing = profile;
+    racing.fastopen.reset();
+    racing.apply(fd, socket_profile::stage::connect);
+    if (::connect(fd, &ep.addr, ep.addrlen) == -1 && errno != EINPROGRESS) {
+      ::close(fd);
+      return -1;
+    }
+
+    return fd;
+  }
+};
+
+#endif
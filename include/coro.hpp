@@ -0,0 +1,563 @@
+#ifndef CORO_HPP
+#define CORO_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <utility>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "endpoint.hpp"
+#include "io_result.hpp"
+#include "log.hpp"
+#include "reactor.hpp"
+#include "socket_profile.hpp"
+
+/*
+  C++20 coroutine layer over the reactor. A flow is written as straight-line
+  code and suspends wherever the blocking API would have blocked:
+
+    task<void> echo(tcp_socket client) {
+      std::array<char, 4096> buf;
+      ssize_t n;
+      while ((n = co_await async_receive(client, buf)) > 0)
+        co_await async_send(client, std::span(std::data(buf), n));
+      scheduler::current().close(client);
+    }
+
+  A suspended flow costs one heap-allocated frame, so a single thread can
+  keep thousands of connections in flight.
+ */
+
+/*
+  Lazily started coroutine returning T. Awaiting a task starts it and
+  resumes the awaiter when it finishes, exceptions propagate to the awaiter.
+ */
+template <typename T = void> struct task;
+
+namespace detail {
+struct task_promise_base {
+  struct final_awaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> h) const noexcept {
+      auto next = h.promise().continuation;
+      return next ? next : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  final_awaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+};
+} // namespace detail
+
+template <typename T> struct task {
+  struct promise_type : detail::task_promise_base {
+    task get_return_object() {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    template <typename U> void return_value(U &&v) {
+      value.emplace(std::forward<U>(v));
+    }
+
+    std::optional<T> value;
+  };
+
+  explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+  ~task() {
+    if (handle)
+      handle.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    handle.promise().continuation = awaiter;
+    return handle;
+  }
+
+  T await_resume() {
+    if (handle.promise().error)
+      std::rethrow_exception(handle.promise().error);
+    return std::move(*handle.promise().value);
+  }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+template <> struct task<void> {
+  struct promise_type : detail::task_promise_base {
+    task get_return_object() {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    void return_void() const noexcept {}
+  };
+
+  explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+  ~task() {
+    if (handle)
+      handle.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    handle.promise().continuation = awaiter;
+    return handle;
+  }
+
+  void await_resume() {
+    if (handle.promise().error)
+      std::rethrow_exception(handle.promise().error);
+  }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+/*
+  Single threaded coroutine scheduler. Resumes ready coroutines in FIFO
+  order and parks the rest on the reactor until their descriptor is ready.
+
+  Every descriptor is registered once, edge-triggered, for both directions,
+  so the awaitables must try the operation first and only wait after
+  io_status::would_block. Sockets used here must be closed with close(),
+  which unregisters them before the descriptor number can be reused.
+ */
+struct scheduler {
+  static scheduler *&current_ptr() {
+    static thread_local scheduler *ptr = nullptr;
+    return ptr;
+  }
+
+  /*
+    The scheduler running on this thread, only valid inside run().
+   */
+  static scheduler &current() { return *current_ptr(); }
+
+  /*
+    Starts t on the next turn of the loop. The scheduler owns the flow from
+    then on, run() returns once every spawned flow has finished.
+   */
+  void spawn(task<void> t) {
+    live++;
+    ready.push_back(detach(std::move(t)).handle);
+  }
+
+  /*
+    Thread-safe, resumes h on the scheduler thread. Used to hand completions
+    from other event loops (i2p) back to their coroutine.
+   */
+  void post(const std::coroutine_handle<> h) {
+    {
+      std::lock_guard<std::mutex> lock(posted_mutex);
+      posted.push_back(h);
+    }
+    loop.wake();
+  }
+
+  struct wait_awaiter {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+      auto &w = sched.waiters[fd];
+      (write ? w.writer : w.reader) = h;
+    }
+    void await_resume() const noexcept {}
+
+    scheduler &sched;
+    int fd;
+    bool write;
+  };
+
+  /*
+    Suspends until fd is readable/writable (or has failed). The socket must
+    have been attached first.
+   */
+  wait_awaiter readable(const int fd) { return {*this, fd, false}; }
+  wait_awaiter writable(const int fd) { return {*this, fd, true}; }
+
+  struct sleep_awaiter {
+    bool await_ready() const noexcept { return delay.count() <= 0; }
+    void await_suspend(std::coroutine_handle<> h) {
+      sched.loop.timers.schedule(
+          delay, [&ready = sched.ready, h] { ready.push_back(h); });
+    }
+    void await_resume() const noexcept {}
+
+    scheduler &sched;
+    std::chrono::milliseconds delay;
+  };
+
+  /*
+    Suspends the flow for delay, on the reactor's timer wheel.
+   */
+  sleep_awaiter sleep_for(const std::chrono::milliseconds delay) {
+    return {*this, delay};
+  }
+
+  /*
+    Switches the socket to non-blocking mode and registers it, once.
+   */
+  template <typename Socket> bool attach(Socket &sock) {
+    if (loop.registrations.contains(sock.sockfd))
+      return true;
+
+    const int fd = sock.sockfd;
+    return loop.add(sock, EPOLLIN | EPOLLOUT | EPOLLRDHUP,
+                    [this, fd](const std::uint32_t events) {
+                      auto it = waiters.find(fd);
+                      if (it == std::end(waiters))
+                        return;
+
+                      const std::uint32_t failed = EPOLLERR | EPOLLHUP;
+                      if (events & (EPOLLIN | EPOLLRDHUP | failed) &&
+                          it->second.reader)
+                        ready.push_back(std::exchange(it->second.reader, {}));
+                      if (events & (EPOLLOUT | failed) && it->second.writer)
+                        ready.push_back(std::exchange(it->second.writer, {}));
+                    });
+  }
+
+  /*
+    Unregisters and closes the socket. Flows still waiting on it are resumed
+    and see the failure from their next try_* call.
+   */
+  template <typename Socket> void close(Socket &sock) {
+    loop.remove(sock.sockfd);
+    auto it = waiters.find(sock.sockfd);
+    if (it != std::end(waiters)) {
+      if (it->second.reader)
+        ready.push_back(it->second.reader);
+      if (it->second.writer)
+        ready.push_back(it->second.writer);
+      waiters.erase(it);
+    }
+
+    sock.close();
+  }
+
+  /*
+    Runs until every spawned flow has finished or stop() is called.
+   */
+  void run() {
+    scheduler *previous = std::exchange(current_ptr(), this);
+    running = true;
+    while (running && live > 0) {
+      {
+        std::lock_guard<std::mutex> lock(posted_mutex);
+        ready.insert(std::end(ready), std::begin(posted), std::end(posted));
+        posted.clear();
+      }
+
+      while (!std::empty(ready)) {
+        auto h = ready.front();
+        ready.pop_front();
+        h.resume();
+      }
+
+      if (running && live > 0 && loop.run_once(-1) == -1)
+        break;
+    }
+
+    current_ptr() = previous;
+  }
+
+  /*
+    Thread-safe. Flows that have not finished stay suspended.
+   */
+  void stop() {
+    running = false;
+    loop.wake();
+  }
+
+  std::size_t flows() const { return live; }
+
+  /*
+    Eagerly destroyed wrapper that owns a spawned task.
+   */
+  struct detached {
+    struct promise_type {
+      detached get_return_object() {
+        return {std::coroutine_handle<promise_type>::from_promise(*this)};
+      }
+      std::suspend_always initial_suspend() const noexcept { return {}; }
+      std::suspend_never final_suspend() const noexcept { return {}; }
+      void return_void() const noexcept {}
+      void unhandled_exception() const noexcept {
+        log_error("Unhandled exception in coroutine.");
+      }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  detached detach(task<void> t) {
+    try {
+      co_await t;
+    } catch (const std::exception &e) {
+      log_error("Coroutine failed: ", e.what());
+    }
+    live--;
+  }
+
+  struct fd_waiters {
+    std::coroutine_handle<> reader;
+    std::coroutine_handle<> writer;
+  };
+
+  reactor loop;
+  std::atomic<bool> running = false;
+  std::size_t live = 0;
+  std::deque<std::coroutine_handle<>> ready;
+  std::unordered_map<int, fd_waiters> waiters;
+  std::mutex posted_mutex;
+  std::deque<std::coroutine_handle<>> posted;
+};
+
+/*
+  Awaitable socket operations. They work with tcp_socket, udp_socket and
+  ssl_socket through the try_* interface and must run on a scheduler.
+ */
+
+/*
+  Drives the TLS handshake of an ssl_socket that was set up with
+  try_accept or init_client.
+ */
+template <typename Socket> task<bool> async_handshake(Socket &sock) {
+  scheduler &sched = scheduler::current();
+  if (!sched.attach(sock))
+    co_return false;
+
+  for (;;) {
+    switch (sock.try_handshake()) {
+    case io_status::ok:
+      co_return true;
+    case io_status::would_block:
+      if (sock.wants_write())
+        co_await sched.writable(sock.sockfd);
+      else
+        co_await sched.readable(sock.sockfd);
+      break;
+    default:
+      co_return false;
+    }
+  }
+}
+
+/*
+  Completes with the accepted client, or a socket with sockfd == -1 on
+  failure. ssl_socket clients are returned after the TLS handshake.
+ */
+template <typename Socket> task<Socket> async_accept(Socket &listener) {
+  scheduler &sched = scheduler::current();
+  if (!sched.attach(listener))
+    co_return Socket{};
+
+  for (;;) {
+    Socket client;
+    const io_status status = listener.try_accept(client);
+    if (status == io_status::would_block) {
+      co_await sched.readable(listener.sockfd);
+      continue;
+    }
+
+    if (status != io_status::ok)
+      co_return Socket{};
+
+    if constexpr (requires { client.try_handshake(); }) {
+      if (!co_await async_handshake(client)) {
+        sched.close(client);
+        co_return Socket{};
+      }
+    }
+
+    co_return client;
+  }
+}
+
+/*
+  Non-blocking connect. For ssl_socket the TLS handshake is completed as
+  well.
+ */
+template <typename Socket>
+task<bool> async_connect(Socket &sock, const endpoint ep) {
+  scheduler &sched = scheduler::current();
+  sock.sockfd =
+      ::socket(ep.addr.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+               IPPROTO_TCP);
+  if (sock.sockfd == -1) {
+    log_error("Failed to create socket.");
+    co_return false;
+  }
+
+  if constexpr (requires { sock.profile; })
+    sock.profile.apply(sock.sockfd, socket_profile::stage::connect);
+
+  if (!sched.attach(sock)) {
+    sock.close();
+    co_return false;
+  }
+
+  if (::connect(sock.sockfd, &ep.addr, ep.addrlen) == -1) {
+    if (errno != EINPROGRESS) {
+      log_error("Connection failed.");
+      sched.close(sock);
+      co_return false;
+    }
+
+    co_await sched.writable(sock.sockfd);
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (::getsockopt(sock.sockfd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 ||
+        error != 0) {
+      log_error("Connection failed.");
+      sched.close(sock);
+      co_return false;
+    }
+  }
+
+  if constexpr (requires { sock.init_client(); }) {
+    sock.init_client();
+    if (!co_await async_handshake(sock)) {
+      sched.close(sock);
+      co_return false;
+    }
+  }
+
+  co_return true;
+}
+
+/*
+  Completes once all of data has been sent. Returns the byte count or -1.
+ */
+template <typename Socket, typename Container>
+task<ssize_t> async_send(Socket &sock, const Container &data) {
+  scheduler &sched = scheduler::current();
+  if (!sched.attach(sock))
+    co_return -1;
+
+  const auto *bytes = reinterpret_cast<const std::byte *>(std::data(data));
+  const std::size_t len = std::size(data) * sizeof(*std::data(data));
+  std::size_t total = 0;
+  while (total < len) {
+    const io_result r =
+        sock.try_send(std::span<const std::byte>(bytes + total, len - total));
+    if (r.ok()) {
+      total += r.bytes;
+      continue;
+    }
+
+    if (!r.would_block())
+      co_return -1;
+
+    if constexpr (requires { sock.wants_write(); }) {
+      if (!sock.wants_write()) {
+        co_await sched.readable(sock.sockfd);
+        continue;
+      }
+    }
+    co_await sched.writable(sock.sockfd);
+  }
+
+  co_return total;
+}
+
+/*
+  Completes with whatever is available, like receive(). Returns the byte
+  count, 0 on end of stream or -1.
+ */
+template <typename Socket, typename Container>
+task<ssize_t> async_receive(Socket &sock, Container &buffer) {
+  scheduler &sched = scheduler::current();
+  if (!sched.attach(sock))
+    co_return -1;
+
+  for (;;) {
+    const io_result r = sock.try_receive(buffer);
+    switch (r.status) {
+    case io_status::ok:
+      co_return r.bytes;
+    case io_status::eof:
+      co_return 0;
+    case io_status::would_block:
+      break;
+    default:
+      co_return -1;
+    }
+
+    if constexpr (requires { sock.wants_write(); }) {
+      if (sock.wants_write()) {
+        co_await sched.writable(sock.sockfd);
+        continue;
+      }
+    }
+    co_await sched.readable(sock.sockfd);
+  }
+}
+
+/*
+  Datagram variants for udp_socket.
+ */
+template <typename Socket, typename Container>
+task<ssize_t> async_send(Socket &sock, const Container &data,
+                         const endpoint to) {
+  scheduler &sched = scheduler::current();
+  if (!sched.attach(sock))
+    co_return -1;
+
+  for (;;) {
+    const io_result r = sock.try_send(data, to);
+    if (r.ok())
+      co_return r.bytes;
+    if (!r.would_block())
+      co_return -1;
+
+    co_await sched.writable(sock.sockfd);
+  }
+}
+
+template <typename Socket, typename Container>
+task<ssize_t> async_receive(Socket &sock, Container &buffer, endpoint &from) {
+  scheduler &sched = scheduler::current();
+  if (!sched.attach(sock))
+    co_return -1;
+
+  for (;;) {
+    const io_result r = sock.try_receive(buffer, from);
+    if (r.ok())
+      co_return r.bytes;
+    if (!r.would_block())
+      co_return -1;
+
+    co_await sched.readable(sock.sockfd);
+  }
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef DEADLINE_HPP
+#define DEADLINE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+
+#include <poll.h>
+
+#include "io_result.hpp"
+
+/*
+  Absolute point in time for a blocking call that takes a timeout_ms,
+  negative meaning no limit. Loops that wait several times keep one
+  deadline, so the total wait never exceeds the caller's timeout.
+ */
+struct deadline {
+  using clock = std::chrono::steady_clock;
+
+  explicit deadline(const int timeout_ms)
+      : forever(timeout_ms < 0),
+        until(clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0))) {
+  }
+
+  bool expired() const { return !forever && clock::now() >= until; }
+
+  /*
+    Milliseconds left, rounded up, -1 without a limit. Suitable for poll.
+   */
+  int remaining_ms() const {
+    if (forever)
+      return -1;
+
+    const auto left =
+        std::chrono::ceil<std::chrono::milliseconds>(until - clock::now());
+    return std::max<int>(left.count(), 0);
+  }
+
+  bool forever;
+  clock::time_point until;
+};
+
+/*
+  Waits until fd reports one of events. Returns ok, timeout or error, an
+  error or hangup on the descriptor counts as ready so the next call can
+  report it.
+ */
+inline io_status wait_for(const int fd, const short events,
+                          const deadline &until) {
+  for (;;) {
+    pollfd pfd{fd, events, 0};
+    const int rc = ::poll(&pfd, 1, until.remaining_ms());
+    if (rc > 0)
+      return io_status::ok;
+    if (rc == 0)
+      return io_status::timeout;
+    if (errno != EINTR)
+      return io_status::error;
+  }
+}
+
+#endif
@@ -16,6 +16,7 @@
 #include <md5.h>
 #include <netinet/in.h>
 #include <random>
+#include <span>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <thread>
@@ -23,9 +24,13 @@
 
 #include "dht.h"
 #include "endpoint.hpp"
+#include "log.hpp"
+#include "reactor.hpp"
 #include "udp.hpp"
 
 struct dht_service {
+  static constexpr std::size_t periodic_batch = 16;
+
   std::array<std::uint8_t, 20> id;
   udp_socket internal;
 
@@ -45,14 +50,14 @@ struct dht_service {
     int rc;
     rc = fcntl(internal.sockfd, F_GETFL, 0);
     if (rc < 0) {
-      std::cerr << "Could not get options" << std::endl;
+      log_error("Could not get options");
       internal.close();
       return;
     }
 
     rc = fcntl(internal.sockfd, F_SETFL, (rc | O_NONBLOCK));
     if (rc < 0) {
-      std::cerr << "Could not set options" << std::endl;
+      log_error("Could not set options");
       internal.close();
       return;
     }
@@ -61,7 +66,7 @@ struct dht_service {
                   reinterpret_cast<unsigned char *>(std::data(id)),
                   (unsigned char *)"JC\0\0");
     if (rc < 0) {
-      std::cerr << "dht init error" << std::endl;
+      log_error("dht init error");
       internal.close();
       return;
     }
@@ -76,7 +81,7 @@ struct dht_service {
     }
 
     std::uniform_int_distribution<decltype(RAND_MAX)> sleep(0, RAND_MAX);
-    std::cout << "Bootstrap Count: " << std::size(bootstraps) << std::endl;
+    log_info("Bootstrap Count: ", std::size(bootstraps));
     for (const auto &ep : bootstraps) {
       char str[INET6_ADDRSTRLEN];
       if (ep.family == AF_INET)
@@ -85,7 +90,7 @@ struct dht_service {
       else
         inet_ntop(AF_INET6, &(((struct sockaddr_in *)&ep.addr)->sin_addr), str,
                   INET6_ADDRSTRLEN);
-      std::cout << std::string(str) << std::endl;
+      log_info(str);
 
       ((struct sockaddr_in *)&ep.addr)->sin_port = htons(6881); // default port.
       dht_ping_node(&ep.addr, ep.addrlen);
@@ -94,7 +99,13 @@ struct dht_service {
     }
   }
 
-  ~dht_service() { dht_uninit(); }
+  ~dht_service() {
+    if (loop != nullptr) {
+      loop->timers.cancel(periodic_timer);
+      loop->remove(internal.sockfd);
+    }
+    dht_uninit();
+  }
 
   int ping_node(const endpoint &ep) {
     return dht_ping_node(&ep.addr, ep.addrlen);
@@ -110,17 +121,29 @@ struct dht_service {
     return ss;
   }
 
+  /*
+    Drains up to periodic_batch queued packets with one recvmmsg and feeds
+    each to the dht. Returns the number of packets handled, or -1.
+   */
   int periodic(std::time_t &time_to_sleep, dht_callback_t *callback,
                void *closure = nullptr) {
-    std::array<std::uint8_t, 4096> buf;
+    // one spare byte per packet, dht_periodic wants a terminated buffer.
+    std::array<std::array<std::uint8_t, 4096>, periodic_batch> bufs;
+    std::array<std::span<std::uint8_t>, periodic_batch> views;
+    for (std::size_t i = 0; i < periodic_batch; i++)
+      views[i] = std::span<std::uint8_t>(std::data(bufs[i]), 4095);
 
-    endpoint from;
-    int rc = internal.receive(buf, from, 0);
+    std::array<endpoint, periodic_batch> from;
+    std::array<std::size_t, periodic_batch> lengths;
+    int rc = internal.receive_batch(views, from, lengths, MSG_DONTWAIT);
 
     if (rc > 0) {
-      buf[rc] = '\0';
-      dht_periodic(std::data(buf), rc, (struct sockaddr *)&from.addr,
-                   from.addrlen, &time_to_sleep, callback, closure);
+      for (int i = 0; i < rc; i++) {
+        bufs[i][lengths[i]] = '\0';
+        dht_periodic(std::data(bufs[i]), lengths[i],
+                     (struct sockaddr *)&from[i].addr, from[i].addrlen,
+                     &time_to_sleep, callback, closure);
+      }
     } else {
       dht_periodic(NULL, 0, NULL, 0, &time_to_sleep, callback, closure);
     }
@@ -128,6 +151,37 @@ struct dht_service {
     return rc;
   }
 
+  /*
+    Drives the dht from an event loop instead of a periodic() polling
+    thread: packets are handled as they arrive and dht's own timers
+    (searches, retransmits, bucket refresh) run off loop.timers.
+   */
+  bool attach(reactor &r, dht_callback_t *callback, void *closure = nullptr) {
+    if (!r.add(internal.sockfd, EPOLLIN, [this, callback, closure](auto) {
+          service(callback, closure);
+        }))
+      return false;
+
+    loop = &r;
+    service(callback, closure);
+    return true;
+  }
+
+  /*
+    Handles everything queued (the registration is edge-triggered) and
+    re-arms the timer for the delay dht_periodic asked for.
+   */
+  void service(dht_callback_t *callback, void *closure) {
+    std::time_t time_to_sleep = 1;
+    while (periodic(time_to_sleep, callback, closure) > 0)
+      ;
+
+    loop->timers.cancel(periodic_timer);
+    periodic_timer = loop->timers.schedule(
+        std::chrono::seconds(time_to_sleep),
+        [this, callback, closure] { service(callback, closure); });
+  }
+
   template <typename Container>
   int search(Container &buf, std::uint16_t port, int af,
              dht_callback_t *callback, void *closure = nullptr) {
@@ -142,6 +196,9 @@ struct dht_service {
   int insert_node(std::array<unsigned char, 20> &id, sockaddr *sa, int salen) {
     return dht_insert_node(std::data(id), sa, salen);
   }
+
+  reactor *loop = nullptr;
+  timer_wheel::timer_id periodic_timer = timer_wheel::invalid;
 };
 
 /* Functions called by the DHT. */
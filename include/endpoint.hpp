@@ -1,7 +1,9 @@
 #ifndef ENDPOINT_HPP
 #define ENDPOINT_HPP
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <string>
 
 #ifdef _WIN32
@@ -17,17 +19,21 @@
 #endif
 
 struct endpoint {
-  sockaddr addr;
-  socklen_t addrlen;
+  // storage makes room for IPv6 addresses, addr is what the socket calls take.
+  union {
+    sockaddr_storage storage{};
+    sockaddr addr;
+  };
+  socklen_t addrlen = 0;
   std::string canonname;
-  int family;
-  int flags;
-  int protocol;
-  int socktype;
+  int family = 0;
+  int flags = 0;
+  int protocol = 0;
+  int socktype = 0;
 
   endpoint(const addrinfo &info) {
-    addr = *info.ai_addr;
-    addrlen = info.ai_addrlen;
+    addrlen = std::min<socklen_t>(info.ai_addrlen, sizeof(storage));
+    std::memcpy(&storage, info.ai_addr, addrlen);
     if (info.ai_canonname != nullptr)
       canonname = std::string(info.ai_canonname);
     family = info.ai_family;
@@ -1,16 +1,25 @@
 #ifndef HTTP_HPP
 #define HTTP_HPP
 
+#include <algorithm>
 #include <array>
+#include <charconv>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iomanip>
-#include <iostream>
 #include <iterator>
 #include <sstream>
 #include <string>
 #include <string_view>
 
+#include <zlib.h>
+
+#include "buffer_pool.hpp"
+#include "connection_pool.hpp"
 #include "endpoint.hpp"
+#include "http_parser.hpp"
+#include "log.hpp"
 #include "tcp.hpp"
 #include "zstream.hpp"
 
@@ -27,10 +36,28 @@ http_resolver::resolve(const std::string &host, const std::string &service) {
 struct http_socket {
   tcp_socket internal;
   endpoint cached;
+  std::vector<endpoint> candidates;
   // network buffer, fills when receiving, so i can abstract away the http later
-  std::vector<std::byte> buffer;
-
-  bool bind(const endpoint &ep) { return internal.bind(ep); }
+  buffer_chain buffer;
+  // whether the last request received allows another on this connection,
+  // and whether its sender understands chunked responses.
+  bool peer_keep_alive = true;
+  bool peer_http11 = true;
+  // body format state, see request(). peer_version and peer_deflate are
+  // what the other end has shown it understands.
+  int peer_version = 1;
+  bool peer_deflate = false;
+  bool request_binary = false;
+  bool compression = false;
+  // with pool set, connect() reuses an idle connection to the same host
+  // and close() hands the connection back instead of closing it.
+  connection_pool<tcp_socket> *pool = nullptr;
+  std::string pool_key;
+  bool leased = false;
+
+  bool bind(const endpoint &ep, const bool reuse_port = false) {
+    return internal.bind(ep, reuse_port);
+  }
   bool listen(const int max_incoming_connections) {
     return internal.listen(max_incoming_connections);
   }
@@ -44,12 +71,70 @@ struct http_socket {
 
   bool connect(const endpoint &ep) {
     cached = ep;
+    candidates.clear();
+    const auto got = lease(ep);
+    if (got != connection_pool<tcp_socket>::lease::fresh)
+      return got == connection_pool<tcp_socket>::lease::reused;
     return internal.connect(ep);
   }
 
+  /*
+    Connects to whichever resolved address answers first, reconnects race
+    the same list again. Pooled connections are kept under the first
+    address.
+   */
+  bool connect(const std::vector<endpoint> &endpoints,
+               const int timeout_ms = connector::default_timeout_ms) {
+    candidates = endpoints;
+    if (!endpoints.empty()) {
+      const auto got = lease(endpoints.front());
+      if (got != connection_pool<tcp_socket>::lease::fresh)
+        return got == connection_pool<tcp_socket>::lease::reused;
+    }
+    internal.sockfd =
+        connector::connect(endpoints, timeout_ms, internal.profile, &cached);
+    return internal.sockfd != -1;
+  }
+
+  /*
+    Gives back any connection held so far and leases one to ep, fresh when
+    there is no pool.
+   */
+  connection_pool<tcp_socket>::lease lease(const endpoint &ep) {
+    if (leased)
+      close();
+    if (pool == nullptr)
+      return connection_pool<tcp_socket>::lease::fresh;
+
+    pool_key = connection_pool<tcp_socket>::key(ep);
+    const auto got = pool->acquire(pool_key, internal);
+    leased = got != connection_pool<tcp_socket>::lease::refused;
+    if (!leased)
+      log_error("Connection pool full.");
+    buffer.clear();
+    return got;
+  }
+
+  // through the pool too, when there is one.
+  bool reconnect() {
+    if (candidates.empty())
+      return connect(endpoint(cached));
+    return connect(std::vector<endpoint>(candidates));
+  }
+
   std::string get(const std::string &uri) {
+    std::string response;
+    get(uri, [&](const std::string_view piece) { response += piece; });
+    return response;
+  }
+
+  /*
+    Streams the body of uri to on_data(std::string_view) as it arrives,
+    whether the server sizes it, chunks it or closes after it.
+   */
+  template <typename Sink> bool get(const std::string &uri, Sink &&on_data) {
     if (internal.sockfd == -1)
-      internal.connect(cached);
+      reconnect();
 
     std::string request_final;
     {
@@ -57,7 +142,7 @@ struct http_socket {
       request << "GET " << uri << " HTTP/1.1\r\n";
       request << "Host: " << cached.canonname << "\r\n";
       request << "Accept: */*\r\n";
-      request << "Connection: close\r\n";
+      request << "Connection: Keep-Alive\r\n";
       request << "\r\n";
 
       // move data, prevents copying.
@@ -66,63 +151,121 @@ struct http_socket {
 
     ssize_t sent_bytes = internal.send(request_final);
     if (sent_bytes < 0) {
-      std::cerr << "Error sending data" << std::endl;
-      return "";
+      log_error("Error sending data");
+      return false;
     }
 
-    std::string response;
-    std::array<char, 4096> receive_buffer;
-
-    ssize_t bytes = 0;
-    size_t header_end;
-    do {
-      bytes = internal.receive(receive_buffer);
-      if (bytes < 0)
-        break;
-      response.append(std::data(receive_buffer), bytes);
-      header_end = response.find("\r\n\r\n");
-    } while (header_end == std::string::npos);
-
-    bool should_close = false;
-    std::string headers = response.substr(0, response.find("\r\n\r\n"));
-
-    size_t connection_pos = headers.find("Connection:");
-    if (connection_pos == std::string::npos) {
-      size_t val_start = headers.find_first_not_of(" \t", connection_pos + 10);
-      size_t val_end = headers.find("\r\n", val_start);
-      if (val_end != std::string::npos)
-        if (headers.substr(val_start, val_end - val_start) == "close")
-          should_close = true;
+    buffer.clear();
+    http_parser parser(http_parser::kind::response);
+    if (!receive_head(parser)) {
+      // whatever the stream holds now would be read as the next response.
+      log_error("Failed to receive headers.");
+      internal.close();
+      return false;
     }
 
-    do {
-      bytes = internal.receive(receive_buffer);
-      response.append(std::data(receive_buffer), bytes);
-    } while (bytes > 0);
+    const bool complete = receive_body(parser, on_data);
+    if (!complete)
+      log_error("Failed to receive body.");
 
-    if (should_close)
+    if (!complete || !parser.keep_alive() || parser.body_until_close())
       internal.close();
 
-    return response.substr(header_end + 4);
+    return complete;
+  }
+
+  /*
+    Receives into buffer until parser has a whole head. Bytes already
+    buffered, e.g. a pipelined message, are parsed before reading more.
+   */
+  bool receive_head(http_parser &parser) {
+    while (true) {
+      const http_parse_status status = parser.parse(buffer);
+      if (status != http_parse_status::incomplete)
+        return status == http_parse_status::done;
+      if (buffer.receive(internal) <= 0)
+        return false;
+    }
   }
 
+  /*
+    Receives the body framed by parser's head and passes it to
+    on_data(std::string_view) piece by piece as it arrives, dropping head
+    and body from buffer as it goes. False if the connection ended, the
+    chunk framing broke or on_data refused a piece (see deliver) before
+    the body was complete.
+   */
+  template <typename Sink>
+  bool receive_body(const http_parser &parser, Sink &&on_data) {
+    buffer.consume(parser.head_length);
+
+    if (parser.chunked) {
+      chunked_decoder decoder;
+      while (true) {
+        buffer.consume(decoder.decode(buffer, on_data));
+        if (decoder.done())
+          return true;
+        if (decoder.failed() || buffer.receive(internal) <= 0)
+          return false;
+      }
+    }
+
+    const bool until_close = parser.body_until_close();
+    std::size_t left = parser.content_length.value_or(0);
+    while (true) {
+      const std::size_t n = until_close ? std::size(buffer)
+                                        : std::min(left, std::size(buffer));
+      std::size_t todo = n;
+      bool accepted = true;
+      for (const auto &seg : buffer.segments) {
+        if (todo == 0 || !accepted)
+          break;
+        const std::string_view piece = seg.view().substr(0, todo);
+        accepted = deliver(on_data, piece);
+        todo -= std::size(piece);
+      }
+      buffer.consume(n);
+      if (!accepted)
+        return false;
+      if (!until_close)
+        left -= n;
+
+      if (!until_close && left == 0)
+        return true;
+      if (buffer.receive(internal) <= 0)
+        return until_close;
+    }
+  }
+
+  /*
+    Bodies go out in one of two formats, told apart by X-Enet-Version:
+
+    1  the original: hex text through zstream, no version header.
+    2  the container's bytes as they are, optionally deflated when the
+       receiver has advertised Accept-Encoding: deflate.
+
+    A request is sent as version 2 once the server has answered with
+    X-Enet-Version: 2 (or peer_version is set to 2 up front), a
+    response uses the format of the request it answers, so old clients
+    and old servers keep working. compression enables deflate for bodies
+    of at least min_compress bytes, in both directions.
+   */
+  static constexpr int version = 2;
+  static constexpr std::size_t min_compress = 1024;
+
   template <typename Container_In, typename Container_Out>
   Container_Out request(const Container_In &data) {
     if (internal.sockfd == -1)
-      internal.connect(cached);
+      reconnect();
 
-    std::string byte_stream_final;
-    {
-      std::ostringstream byte_stream;
-      {
-        zstream compressor(&byte_stream);
-        for (const auto &byte : data)
-          compressor << std::hex << std::setw(2) << std::setfill('0')
-                     << static_cast<int>(byte);
-      }
-      // move data, prevents copying.
-      byte_stream_final = std::move(byte_stream).str();
-    }
+    const bool binary = peer_version >= version;
+    const bool deflated = binary && compression && peer_deflate &&
+                          byte_size(data) >= min_compress;
+    std::string encoded;
+    if (!binary)
+      encoded = legacy_encode(data);
+    else if (deflated)
+      encoded = deflate_bytes(as_bytes(data));
 
     std::string request_final;
     {
@@ -132,210 +275,343 @@ struct http_socket {
               << " HTTP/1.1\r\n";
       request << "Host: " << cached.canonname << "\r\n";
       request << "Content-Type: application/octet-stream\r\n";
-      request << "Content-Length: " << byte_stream_final.length() << "\r\n";
+      request << "Content-Length: "
+              << (binary && !deflated ? byte_size(data) : encoded.length())
+              << "\r\n";
+      if (binary)
+        request << "X-Enet-Version: " << version << "\r\n";
+      if (deflated)
+        request << "Content-Encoding: deflate\r\n";
+      if (compression)
+        request << "Accept-Encoding: deflate\r\n";
 
       // always try to keep connection, will still close if server says to.
       request << "Connection: Keep-Alive\r\n";
       request << "\r\n";
 
-      // move data, prevents copying.
-      request << std::move(byte_stream_final);
-
       // move data, prevents copying.
       request_final = std::move(request).str();
     }
 
-    ssize_t bytes = internal.send(request_final);
-    if (bytes < (ssize_t)request_final.length())
-      std::cerr << "Error: Incomplete send" << std::endl;
+    // headers and body leave in one syscall without being concatenated.
+    const iovec body = binary && !deflated ? to_iovec(data) : to_iovec(encoded);
+    ssize_t bytes = internal.send_vec({to_iovec(request_final), body});
+    if (bytes < (ssize_t)(request_final.length() + body.iov_len))
+      log_error("Error: Incomplete send");
 
-    std::string_view view(reinterpret_cast<const char *>(std::data(buffer)),
-                          std::size(buffer));
-    std::array<std::byte, 4096> receive_buffer;
+    http_parser parser(http_parser::kind::response);
+    if (!receive_head(parser)) {
+      log_error("Failed to receive headers.");
+      internal.close();
+      return {};
+    }
 
-    size_t header_end = view.find("\r\n\r\n");
-    while (header_end == std::string::npos) {
-      bytes = internal.receive(receive_buffer);
-      if (bytes < 0)
-        break;
-      std::copy(std::begin(receive_buffer), std::begin(receive_buffer) + bytes,
-                std::back_inserter(buffer));
+    std::string scratch;
+    const std::string_view head = buffer.linear(parser.head_length, scratch);
+    if (header_number(parser, head, "X-Enet-Version") >= version)
+      peer_version = version;
+    peer_deflate = lists(parser.header(head, "Accept-Encoding"), "deflate");
+    const bool inflate =
+        lists(parser.header(head, "Content-Encoding"), "deflate");
 
-      view = std::string_view(reinterpret_cast<const char *>(std::data(buffer)),
-                              std::size(buffer));
-      header_end = view.find("\r\n\r\n");
-    }
+    Container_Out out{};
+    const bool complete = receive_content(parser, binary, inflate, out);
 
-    std::string_view headers = view.substr(0, header_end);
-    bool should_close = false;
+    if (!complete || !parser.keep_alive() || parser.body_until_close())
+      internal.close();
 
-    size_t connection_pos = headers.find("Connection:");
-    if (connection_pos == std::string::npos) {
-      size_t val_start = headers.find_first_not_of(" \t", connection_pos + 10);
-      size_t val_end = headers.find("\r\n", val_start);
-      if (val_end != std::string::npos)
-        if (headers.substr(val_start, val_end - val_start) == "close")
-          should_close = true;
-    }
+    return out;
+  }
 
-    size_t content_length = 0;
-    size_t content_length_pos = headers.find("Content-Length:");
-    if (content_length_pos != std::string::npos) {
-      size_t val_start =
-          headers.find_first_not_of(" \t", content_length_pos + 15);
-      size_t val_end = headers.find("\r\n", val_start);
-      if (val_end != std::string::npos)
-        content_length = std::stoul(
-            std::string(headers.substr(val_start, val_end - val_start)));
+  template <typename Container> void receive(Container &data) {
+    http_parser parser(http_parser::kind::request);
+    if (!receive_head(parser)) {
+      log_error("Failed to receive headers.");
+      return;
     }
 
-    while (std::size(buffer) - header_end - 4 < content_length) {
-      bytes = internal.receive(receive_buffer);
-      if (bytes < 0)
-        break;
-      std::copy(std::begin(receive_buffer), std::begin(receive_buffer) + bytes,
-                std::back_inserter(buffer));
-    }
+    std::string scratch;
+    const std::string_view head = buffer.linear(parser.head_length, scratch);
+    request_binary = header_number(parser, head, "X-Enet-Version") >= version;
+    peer_deflate = lists(parser.header(head, "Accept-Encoding"), "deflate");
+    const bool inflate =
+        lists(parser.header(head, "Content-Encoding"), "deflate");
 
-    view = std::string_view(reinterpret_cast<const char *>(std::data(buffer)),
-                            std::size(buffer));
+    data.clear();
+    const bool complete = receive_content(parser, request_binary, inflate, data);
 
-    std::string content;
+    // answered by respond(), which closes if the client asked for it.
+    peer_keep_alive = complete && parser.keep_alive();
+    peer_http11 = parser.minor_version == 1;
+  }
+
+  template <typename Container> void respond(const Container &data) {
+    if (internal.sockfd == -1)
+      reconnect();
+
+    const bool binary = request_binary;
+    const bool deflated = binary && compression && peer_deflate &&
+                          byte_size(data) >= min_compress;
+    std::string encoded;
+    if (!binary)
+      encoded = legacy_encode(data);
+    else if (deflated)
+      encoded = deflate_bytes(as_bytes(data));
+
+    std::string response_final;
     {
-      std::string compressed_content = std::string(view.substr(header_end + 4));
-      std::istringstream content_stream(std::move(compressed_content));
-      zstream decompressor(&content_stream);
-      decompressor >> content;
-    }
+      std::stringstream response;
+      response << "HTTP/1.1 200 OK\r\n";
+      response << "Content-Type: application/octet-stream\r\n";
+      response << "Content-Length: "
+               << (binary && !deflated ? byte_size(data) : encoded.length())
+               << "\r\n";
+      // tells a new client it may send version 2 bodies from now on.
+      response << "X-Enet-Version: " << version << "\r\n";
+      if (deflated)
+        response << "Content-Encoding: deflate\r\n";
+      if (compression)
+        response << "Accept-Encoding: deflate\r\n";
+      response << (peer_keep_alive ? "Connection: Keep-Alive\r\n"
+                                   : "Connection: close\r\n");
+      response << "\r\n";
 
-    std::vector<std::byte> out(content.length() / 2);
-    for (size_t i = 0; i < content.length(); i += 2) {
-      out[i / 2] = static_cast<typename Container_Out::value_type>(
-          std::stoi(std::string(content.substr(i, 2)), nullptr, 16));
+      // move data, prevents copying.
+      response_final = std::move(response).str();
     }
 
-    buffer.erase(std::begin(buffer),
-                 std::begin(buffer) + header_end + content_length + 4);
+    const iovec body = binary && !deflated ? to_iovec(data) : to_iovec(encoded);
+    ssize_t bytes = internal.send_vec({to_iovec(response_final), body});
+    if (bytes < (ssize_t)(response_final.length() + body.iov_len))
+      log_error("Error: Incomplete send");
 
-    if (should_close)
+    if (!peer_keep_alive)
       internal.close();
-
-    return out;
   }
 
-  template <typename Container> void receive(Container &data) {
-    ssize_t bytes = 0;
-    std::string_view view(reinterpret_cast<const char *>(std::data(buffer)),
-                          std::size(buffer));
-    std::array<std::byte, 4096> receive_buffer;
-
-    size_t header_end = view.find("\r\n\r\n");
-    while (header_end == std::string::npos) {
-      bytes = internal.receive(receive_buffer);
-      if (bytes < 0)
-        break;
-      std::copy(std::begin(receive_buffer), std::begin(receive_buffer) + bytes,
-                std::back_inserter(buffer));
-
-      view = std::string_view(reinterpret_cast<const char *>(std::data(buffer)),
-                              std::size(buffer));
-      header_end = view.find("\r\n\r\n");
+  /*
+    Receives a request or response body into out in the format the head
+    announced.
+   */
+  template <typename Container>
+  bool receive_content(const http_parser &parser, const bool binary,
+                       const bool inflate, Container &out) {
+    // a peer may claim any length, nothing past buffer.limit is kept.
+    const std::size_t limit = buffer.limit;
+    if (binary && !inflate) {
+      if (parser.content_length)
+        out.reserve(std::min(*parser.content_length, limit));
+      return receive_body(parser, [&](const std::string_view piece) {
+        if (std::size(out) + std::size(piece) > limit)
+          return false;
+        append_bytes(out, piece);
+        return true;
+      });
     }
 
-    std::string_view headers = view.substr(0, header_end);
-    bool should_close = false;
+    std::string encoded;
+    bool complete =
+        receive_body(parser, [&](const std::string_view piece) {
+          if (std::size(encoded) + std::size(piece) > limit)
+            return false;
+          encoded += piece;
+          return true;
+        });
+    if (!binary)
+      legacy_decode(std::move(encoded), out);
+    else if (!inflate_bytes(encoded, out, buffer.limit))
+      complete = false;
+    return complete;
+  }
 
-    size_t connection_pos = headers.find("Connection:");
-    if (connection_pos == std::string::npos) {
-      size_t val_start = headers.find_first_not_of(" \t", connection_pos + 10);
-      size_t val_end = headers.find("\r\n", val_start);
-      if (val_end != std::string::npos)
-        if (headers.substr(val_start, val_end - val_start) == "close")
-          should_close = true;
-    }
+  template <typename Container>
+  static std::size_t byte_size(const Container &data) {
+    return std::size(data) * sizeof(*std::data(data));
+  }
 
-    size_t content_length = 0;
-    size_t content_length_pos = headers.find("Content-Length:");
-    if (content_length_pos != std::string::npos) {
-      size_t val_start =
-          headers.find_first_not_of(" \t", content_length_pos + 15);
-      size_t val_end = headers.find("\r\n", val_start);
-      if (val_end != std::string::npos)
-        content_length = std::stoul(
-            std::string(headers.substr(val_start, val_end - val_start)));
-    }
+  template <typename Container>
+  static std::string_view as_bytes(const Container &data) {
+    return {reinterpret_cast<const char *>(std::data(data)), byte_size(data)};
+  }
 
-    while (std::size(buffer) - header_end - 4 < content_length) {
-      bytes = internal.receive(receive_buffer);
-      if (bytes < 0)
-        break;
-      std::copy(std::begin(receive_buffer), std::begin(receive_buffer) + bytes,
-                std::back_inserter(buffer));
-    }
+  template <typename Container>
+  static void append_bytes(Container &out, const std::string_view bytes) {
+    static_assert(sizeof(*std::data(out)) == 1, "byte containers only");
+    const std::size_t at = std::size(out);
+    out.resize(at + std::size(bytes));
+    std::memcpy(std::data(out) + at, std::data(bytes), std::size(bytes));
+  }
 
-    view = std::string_view(reinterpret_cast<const char *>(std::data(buffer)),
-                            std::size(buffer));
+  template <typename Container>
+  static std::string legacy_encode(const Container &data) {
+    std::ostringstream byte_stream;
+    {
+      zstream compressor(&byte_stream);
+      // convert std::byte to a string representation.
+      for (const auto &byte : data)
+        compressor << std::hex << std::setw(2) << std::setfill('0')
+                   << static_cast<int>(byte);
+    }
+    // move data, prevents copying.
+    return std::move(byte_stream).str();
+  }
 
+  template <typename Container>
+  static void legacy_decode(std::string compressed, Container &out) {
     std::string content;
     {
-      std::string compressed_content = std::string(view.substr(header_end + 4));
-      std::istringstream content_stream(std::move(compressed_content));
+      std::istringstream content_stream(std::move(compressed));
       zstream decompressor(&content_stream);
       decompressor >> content;
     }
 
-    data.resize(content.length() / 2);
+    out.resize(content.length() / 2);
     for (size_t i = 0; i < content.length(); i += 2) {
-      data[i / 2] =
-          static_cast<std::byte>(std::stoi(content.substr(i, 2), nullptr, 16));
+      out[i / 2] = static_cast<typename Container::value_type>(
+          std::stoi(content.substr(i, 2), nullptr, 16));
     }
-
-    buffer.erase(std::begin(buffer),
-                 std::begin(buffer) + header_end + content_length + 4);
-
-    if (should_close)
-      internal.close();
   }
 
-  template <typename Container> void respond(const Container &data) {
-    if (internal.sockfd == -1)
-      internal.connect(cached);
+  static std::string deflate_bytes(const std::string_view in) {
+    uLongf length = compressBound(std::size(in));
+    std::string out(length, '\0');
+    if (compress2(reinterpret_cast<Bytef *>(std::data(out)), &length,
+                  reinterpret_cast<const Bytef *>(std::data(in)), std::size(in),
+                  Z_BEST_SPEED) != Z_OK) {
+      log_error("Failed to deflate body.");
+      return {};
+    }
+    out.resize(length);
+    return out;
+  }
 
-    std::string byte_stream_final;
-    {
-      std::ostringstream byte_stream;
-      {
-        zstream compressor(&byte_stream);
-        // convert std::byte to a string representation.
-        for (const auto &byte : data)
-          compressor << std::hex << std::setw(2) << std::setfill('0')
-                     << static_cast<int>(byte);
+  /*
+    Inflates into out, refusing to produce more than limit bytes.
+   */
+  template <typename Container>
+  static bool inflate_bytes(const std::string_view in, Container &out,
+                            const std::size_t limit) {
+    z_stream zs{};
+    if (inflateInit(&zs) != Z_OK)
+      return false;
+
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(std::data(in)));
+    zs.avail_in = std::size(in);
+    std::array<char, 16 * 1024> chunk;
+    int rc = Z_OK;
+    while (rc == Z_OK) {
+      zs.next_out = reinterpret_cast<Bytef *>(std::data(chunk));
+      zs.avail_out = std::size(chunk);
+      rc = inflate(&zs, Z_NO_FLUSH);
+      const std::size_t produced = std::size(chunk) - zs.avail_out;
+      if (std::size(out) + produced > limit) {
+        rc = Z_MEM_ERROR;
+        break;
       }
-      // move data, prevents copying.
-      byte_stream_final = std::move(byte_stream).str();
+      append_bytes(out, std::string_view(std::data(chunk), produced));
+      if (rc == Z_BUF_ERROR && zs.avail_in == 0)
+        break;
     }
 
-    std::string response_final;
-    {
-      std::stringstream response;
-      response << "HTTP/1.1 200 OK\r\n";
-      response << "Content-Type: application/octet-stream\r\n";
-      response << "Content-Length: " << byte_stream_final.length() << "\r\n";
+    inflateEnd(&zs);
+    if (rc != Z_STREAM_END) {
+      log_error("Failed to inflate body.");
+      return false;
+    }
+    return true;
+  }
 
-      // always try to keep connection, will still close if server says to.
-      response << "Connection: Keep-Alive\r\n";
-      response << "\r\n";
+  static std::uint64_t header_number(const http_parser &parser,
+                                     const std::string_view head,
+                                     const std::string_view name) {
+    const auto value = parser.header(head, name);
+    std::uint64_t n = 0;
+    if (value)
+      std::from_chars(std::data(*value), std::data(*value) + std::size(*value),
+                      n);
+    return n;
+  }
 
-      // move data, prevents copying.
-      response << std::move(byte_stream_final);
+  /*
+    Whether a comma separated header value lists token, parameters and
+    case ignored.
+   */
+  static bool lists(const std::optional<std::string_view> value,
+                    const std::string_view token) {
+    if (!value)
+      return false;
+
+    std::string_view rest = *value;
+    while (!rest.empty()) {
+      const std::size_t comma = rest.find(',');
+      std::string_view item = rest.substr(0, comma);
+      rest = comma == std::string_view::npos ? std::string_view()
+                                             : rest.substr(comma + 1);
+      item = item.substr(0, item.find(';'));
+      while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+        item.remove_prefix(1);
+      while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+        item.remove_suffix(1);
+      if (std::size(item) == std::size(token) &&
+          std::equal(std::begin(item), std::end(item), std::begin(token),
+                     [](const char a, const char b) {
+                       return http_parser::lower(a) == http_parser::lower(b);
+                     }))
+        return true;
+    }
+    return false;
+  }
 
-      // move data, prevents copying.
-      response_final = std::move(response).str();
+  /*
+    Streams a response of unknown length: respond_begin(), any number of
+    respond_chunk(data), then respond_end(). Each chunk goes out framed
+    as it is given. An HTTP/1.0 peer cannot read chunks, it gets the raw
+    bytes and the connection closes at the end instead.
+   */
+  bool respond_begin(const std::string_view content_type =
+                         "application/octet-stream") {
+    std::string head = "HTTP/1.1 200 OK\r\nContent-Type: ";
+    head += content_type;
+    head += "\r\n";
+    if (peer_http11)
+      head += "Transfer-Encoding: chunked\r\n";
+    else
+      peer_keep_alive = false;
+    head += peer_keep_alive ? "Connection: Keep-Alive\r\n\r\n"
+                            : "Connection: close\r\n\r\n";
+
+    return internal.send(head) == static_cast<ssize_t>(std::size(head));
+  }
+
+  template <typename Container> bool respond_chunk(const Container &data) {
+    const std::size_t n = std::size(data) * sizeof(*std::data(data));
+    // an empty chunk would read as the end of the body.
+    if (n == 0)
+      return true;
+    if (!peer_http11)
+      return internal.send(data) == static_cast<ssize_t>(n);
+
+    std::array<char, 20> size{};
+    auto [end, ec] = std::to_chars(std::data(size), std::data(size) + 16, n, 16);
+    *end++ = '\r';
+    *end++ = '\n';
+    const std::string_view header(std::data(size), end - std::data(size));
+    const std::string_view crlf = "\r\n";
+    const ssize_t sent = internal.send_vec(
+        {to_iovec(header), to_iovec(data), to_iovec(crlf)});
+    return sent == static_cast<ssize_t>(std::size(header) + n + 2);
+  }
+
+  bool respond_end() {
+    bool ok = true;
+    if (peer_http11) {
+      const std::string_view last = "0\r\n\r\n";
+      ok = internal.send(last) == static_cast<ssize_t>(std::size(last));
     }
 
-    ssize_t bytes = internal.send(response_final);
-    if (bytes < (ssize_t)response_final.length())
-      std::cerr << "Error: Incomplete send" << std::endl;
+    if (!peer_keep_alive)
+      internal.close();
+    return ok;
   }
 
   template <typename T_in, typename T_out> T_out request_into(const T_in &obj) {
@@ -374,7 +650,20 @@ struct http_socket {
     return vout;
   }
 
-  void close() { internal.close(); }
+  /*
+    A leased connection goes back to the pool, kept for reuse if the last
+    exchange left it open with nothing unread.
+   */
+  void close() {
+    if (!leased) {
+      internal.close();
+      return;
+    }
+
+    leased = false;
+    pool->release(pool_key, internal, buffer.empty());
+    buffer.clear();
+  }
 };
 
 #endif
@@ -0,0 +1,720 @@
+#ifndef HTTP_PARSER_HPP
+#define HTTP_PARSER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "simd_scan.hpp"
+
+/*
+  Resumable HTTP/1.1 request and response head parser. parse() is handed
+  everything received so far, in one piece or as a buffer_chain, and
+  carries on from the byte where the last call stopped, so a head that
+  arrives in many reads is still looked at once.
+
+  Nothing is copied out: the start line and every header are recorded as
+  offsets into the buffer, read them back with text()/header() over the
+  head (see buffer_chain::linear). The framing headers (Content-Length,
+  Transfer-Encoding, Connection) are picked up on the way.
+
+  The head ends after the blank line, head_length bytes in. Whatever
+  follows is body or the next message and is left alone.
+ */
+enum class http_parse_status {
+  incomplete,
+  done,
+  error,
+};
+
+struct http_span {
+  std::uint32_t offset = 0;
+  std::uint32_t length = 0;
+};
+
+struct http_header {
+  http_span name;
+  http_span value;
+};
+
+struct http_parser {
+  enum class kind { request, response };
+
+  static constexpr std::size_t max_head = 64 * 1024;
+  static constexpr std::size_t max_headers = 128;
+
+  explicit http_parser(const kind k = kind::response) : type(k) { reset(); }
+
+  /*
+    Ready for the next message, whose first byte is at offset 0 again.
+   */
+  void reset() {
+    at = type == kind::request ? state::start : state::version;
+    parsed = 0;
+    head_length = 0;
+    minor_version = 1;
+    status = 0;
+    method = target = reason = {};
+    headers.clear();
+    content_length.reset();
+    chunked = false;
+    close = false;
+    keep_alive_token = false;
+    valid_length = true;
+    framing = field::other;
+    token = {};
+    token_length = 0;
+  }
+
+  http_parse_status parse(const std::string_view data) {
+    if (parsed >= std::size(data))
+      return result();
+    return step(data.substr(parsed));
+  }
+
+  http_parse_status parse(const buffer_chain &chain) {
+    std::size_t base = 0;
+    for (const auto &seg : chain.segments) {
+      if (at == state::done || at == state::error)
+        break;
+
+      const std::string_view s = seg.view();
+      if (parsed < base + std::size(s))
+        step(s.substr(parsed - base));
+      base += std::size(s);
+    }
+
+    return result();
+  }
+
+  http_parse_status result() const {
+    if (at == state::done)
+      return http_parse_status::done;
+    if (at == state::error)
+      return http_parse_status::error;
+    return http_parse_status::incomplete;
+  }
+
+  /*
+    Whether the connection may carry another message after this one.
+   */
+  bool keep_alive() const {
+    if (close)
+      return false;
+    return minor_version == 1 || keep_alive_token;
+  }
+
+  /*
+    A response that is neither chunked nor sized runs until the peer
+    closes. Requests without either have no body.
+   */
+  bool body_until_close() const {
+    if (type == kind::request || chunked || content_length)
+      return false;
+    return status >= 200 && status != 204 && status != 304;
+  }
+
+  static std::string_view text(const std::string_view head,
+                               const http_span span) {
+    return head.substr(span.offset, span.length);
+  }
+
+  /*
+    Value of the first header called name, compared case-insensitively.
+   */
+  std::optional<std::string_view> header(const std::string_view head,
+                                         const std::string_view name) const {
+    for (const auto &h : headers) {
+      if (h.name.length != std::size(name))
+        continue;
+
+      const std::string_view candidate = text(head, h.name);
+      bool same = true;
+      for (std::size_t i = 0; same && i < std::size(name); i++)
+        same = lower(candidate[i]) == lower(name[i]);
+      if (same)
+        return text(head, h.value);
+    }
+
+    return std::nullopt;
+  }
+
+  enum class state : std::uint8_t {
+    start,
+    method,
+    target,
+    version,
+    status_code,
+    reason,
+    line_lf,
+    header_start,
+    name,
+    value_ows,
+    value,
+    end_lf,
+    done,
+    error,
+  };
+
+  // the framing headers, recognised while their names go by.
+  enum class field : std::uint8_t {
+    other,
+    content_length,
+    transfer_encoding,
+    connection,
+  };
+
+  static constexpr std::size_t token_capacity = 128;
+
+  /*
+    bytes start at offset parsed of the message.
+   */
+  http_parse_status step(const std::string_view bytes) {
+    std::size_t i = 0;
+    for (; i < std::size(bytes) && at != state::done && at != state::error;
+         i++) {
+      const unsigned char c = bytes[i];
+      const std::uint32_t pos = parsed + i;
+      if (pos >= max_head) {
+        at = state::error;
+        break;
+      }
+
+      // runs inside the target, a reason, a name or a value are skipped
+      // with one scan, the byte that ends the run goes through the switch.
+      if (const std::size_t run = skip(
+              bytes.data() + i, std::min(std::size(bytes) - i, max_head - pos),
+              pos)) {
+        i += run - 1;
+        continue;
+      }
+
+      switch (at) {
+      case state::start:
+        // a request may follow stray blank lines of the previous one.
+        if (c == '\r' || c == '\n')
+          break;
+        if (!is_token(c)) {
+          at = state::error;
+          break;
+        }
+        method = {pos, 1};
+        at = state::method;
+        break;
+
+      case state::method:
+        if (c == ' ') {
+          at = state::target;
+          target = {pos + 1, 0};
+        } else if (is_token(c)) {
+          method.length++;
+        } else {
+          at = state::error;
+        }
+        break;
+
+      case state::target:
+        if (c == ' ') {
+          at = target.length != 0 ? state::version : state::error;
+          token_length = 0;
+        } else if (c > ' ' && c != 0x7f) {
+          target.length++;
+        } else {
+          at = state::error;
+        }
+        break;
+
+      case state::version:
+        if (type == kind::response && c == ' ') {
+          at = version_ok() ? state::status_code : state::error;
+          token_length = 0;
+        } else if (type == kind::request && (c == '\r' || c == '\n')) {
+          at = !version_ok() ? state::error
+               : c == '\r'   ? state::line_lf
+                             : state::header_start;
+        } else if (is_ctl(c) || !keep(c)) {
+          at = state::error;
+        }
+        break;
+
+      case state::status_code:
+        if (c >= '0' && c <= '9' && token_length < 3) {
+          status = status * 10 + (c - '0');
+          token_length++;
+        } else if (token_length == 3 && (c == ' ' || c == '\r' || c == '\n')) {
+          reason = {pos + (c == ' '), 0};
+          at = c == ' '    ? state::reason
+               : c == '\r' ? state::line_lf
+                           : state::header_start;
+        } else {
+          at = state::error;
+        }
+        break;
+
+      case state::reason:
+        if (c == '\r' || c == '\n')
+          at = c == '\r' ? state::line_lf : state::header_start;
+        else if (is_ctl(c) && c != '\t')
+          at = state::error;
+        else
+          reason.length++;
+        break;
+
+      case state::line_lf:
+        at = c == '\n' ? state::header_start : state::error;
+        break;
+
+      case state::header_start:
+        if (c == '\r') {
+          at = state::end_lf;
+        } else if (c == '\n') {
+          finish(pos);
+        } else if (is_token(c) && std::size(headers) < max_headers) {
+          current = {{pos, 1}, {}};
+          token_length = 0;
+          keep(lower(c));
+          at = state::name;
+        } else {
+          // obsolete line folding lands here too, it is not accepted.
+          at = state::error;
+        }
+        break;
+
+      case state::name:
+        if (c == ':') {
+          recognise();
+          at = state::value_ows;
+        } else if (is_token(c)) {
+          current.name.length++;
+          keep(lower(c));
+        } else {
+          at = state::error;
+        }
+        break;
+
+      case state::value_ows:
+        if (c == ' ' || c == '\t')
+          break;
+        current.value = {pos, 0};
+        token_length = 0;
+        [[fallthrough]];
+
+      case state::value:
+        if (c == '\r' || c == '\n') {
+          if (!store())
+            at = state::error;
+          else
+            at = c == '\r' ? state::line_lf : state::header_start;
+        } else if (is_ctl(c) && c != '\t') {
+          at = state::error;
+        } else {
+          at = state::value;
+          // trailing whitespace is not part of the value.
+          if (c != ' ' && c != '\t')
+            current.value.length = pos + 1 - current.value.offset;
+          if (framing != field::other && !keep(lower(c)))
+            at = state::error;
+        }
+        break;
+
+      case state::end_lf:
+        if (c == '\n')
+          finish(pos);
+        else
+          at = state::error;
+        break;
+
+      case state::done:
+      case state::error:
+        break;
+      }
+    }
+
+    parsed += i;
+    return result();
+  }
+
+  /*
+    Consumes the bytes at p, offset pos, that cannot change the state,
+    returns how many. Framing header values are left to the switch, they are
+    collected a byte at a time.
+   */
+  std::size_t skip(const char *p, const std::size_t n,
+                   const std::uint32_t pos) {
+    std::size_t run;
+    switch (at) {
+    case state::target:
+      run = simd_scan::target(p, n);
+      target.length += run;
+      return run;
+
+    case state::reason:
+      run = simd_scan::value(p, n);
+      reason.length += run;
+      return run;
+
+    case state::name:
+      run = simd_scan::token(p, n);
+      current.name.length += run;
+      for (std::size_t i = 0; i < run && token_length < token_capacity; i++)
+        keep(lower(p[i]));
+      return run;
+
+    case state::value:
+      if (framing != field::other)
+        return 0;
+      run = simd_scan::value(p, n);
+      // trailing whitespace is not part of the value.
+      for (std::size_t end = run; end > 0; end--)
+        if (p[end - 1] != ' ' && p[end - 1] != '\t') {
+          current.value.length = pos + end - current.value.offset;
+          break;
+        }
+      return run;
+
+    default:
+      return 0;
+    }
+  }
+
+  void finish(const std::uint32_t pos) {
+    head_length = pos + 1;
+    at = state::done;
+    // both framings on a request is how requests get smuggled.
+    if (type == kind::request && chunked && content_length)
+      at = state::error;
+  }
+
+  void recognise() {
+    const std::string_view name(std::data(token), token_length);
+    framing = field::other;
+    if (name == "content-length")
+      framing = field::content_length;
+    else if (name == "transfer-encoding")
+      framing = field::transfer_encoding;
+    else if (name == "connection")
+      framing = field::connection;
+  }
+
+  /*
+    The header is complete, records it and applies it if it frames the
+    message. False if it is malformed.
+   */
+  bool store() {
+    headers.push_back(current);
+    if (framing == field::other)
+      return true;
+
+    std::string_view value(std::data(token), token_length);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+      value.remove_suffix(1);
+    framing_value(value);
+    const bool ok = framing != field::content_length || valid_length;
+    framing = field::other;
+    return ok;
+  }
+
+  void framing_value(const std::string_view value) {
+    switch (framing) {
+    case field::content_length: {
+      std::size_t n = 0;
+      valid_length = !value.empty();
+      for (const char c : value) {
+        if (c < '0' || c > '9' || n > (SIZE_MAX - 9) / 10) {
+          valid_length = false;
+          return;
+        }
+        n = n * 10 + (c - '0');
+      }
+      // repeated headers must agree.
+      if (content_length && *content_length != n)
+        valid_length = false;
+      content_length = n;
+      break;
+    }
+    case field::transfer_encoding: {
+      // chunked has to be the final coding.
+      const std::size_t comma = value.rfind(',');
+      std::string_view last =
+          comma == std::string_view::npos ? value : value.substr(comma + 1);
+      while (!last.empty() && (last.front() == ' ' || last.front() == '\t'))
+        last.remove_prefix(1);
+      chunked = last == "chunked";
+      break;
+    }
+    case field::connection:
+      for (std::size_t from = 0; from <= std::size(value);) {
+        std::size_t comma = value.find(',', from);
+        if (comma == std::string_view::npos)
+          comma = std::size(value);
+        std::string_view option = value.substr(from, comma - from);
+        while (!option.empty() && (option.front() == ' ' || option.front() == '\t'))
+          option.remove_prefix(1);
+        while (!option.empty() && (option.back() == ' ' || option.back() == '\t'))
+          option.remove_suffix(1);
+        if (option == "close")
+          close = true;
+        else if (option == "keep-alive")
+          keep_alive_token = true;
+        from = comma + 1;
+      }
+      break;
+    case field::other:
+      break;
+    }
+  }
+
+  /*
+    Appends to the token being collected (version, framing header name or
+    value), false once it would not fit.
+   */
+  bool keep(const char c) {
+    if (token_length == token_capacity)
+      return false;
+    token[token_length++] = c;
+    return true;
+  }
+
+  bool version_ok() {
+    const std::string_view v(std::data(token), token_length);
+    if (v == "HTTP/1.1")
+      minor_version = 1;
+    else if (v == "HTTP/1.0")
+      minor_version = 0;
+    else
+      return false;
+    return true;
+  }
+
+  static constexpr char lower(const char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+  }
+
+  static constexpr bool is_ctl(const unsigned char c) {
+    return c < ' ' || c == 0x7f;
+  }
+
+  static constexpr bool is_token(const unsigned char c) {
+    return simd_scan::is_token(c);
+  }
+
+  kind type;
+  state at;
+  field framing = field::other;
+  std::uint32_t parsed;
+  std::uint32_t head_length;
+  int minor_version;
+  int status;
+  http_span method;
+  http_span target;
+  http_span reason;
+  std::vector<http_header> headers;
+  std::optional<std::size_t> content_length;
+  bool chunked;
+  bool close;
+  bool keep_alive_token;
+  bool valid_length = true;
+  http_header current;
+  std::array<char, token_capacity> token;
+  std::size_t token_length;
+};
+
+/*
+  Hands piece to a body sink. A sink returning bool may refuse it, e.g.
+  past a size limit, which ends the body as failed.
+ */
+template <typename Sink>
+bool deliver(Sink &sink, const std::string_view piece) {
+  if constexpr (std::is_same_v<std::invoke_result_t<Sink &, std::string_view>,
+                               bool>) {
+    return sink(piece);
+  } else {
+    sink(piece);
+    return true;
+  }
+}
+
+/*
+  Incremental decoder for Transfer-Encoding: chunked. decode() is handed
+  the bytes after the head as they arrive and passes the chunk data to
+  sink(std::string_view) straight out of its input, in as many pieces as
+  it arrived in. It returns how many bytes it used, the caller drops them
+  and hands over the rest with the next read. Extensions and trailers are
+  skipped, a piece the sink refuses (see deliver) fails the decoder.
+ */
+struct chunked_decoder {
+  static constexpr std::size_t max_line = 4096;
+  static constexpr std::size_t max_digits = 15;
+
+  enum class state : std::uint8_t {
+    size,
+    extension,
+    size_lf,
+    data,
+    data_cr,
+    data_lf,
+    trailer_start,
+    trailer,
+    trailer_lf,
+    end_lf,
+    done,
+    error,
+  };
+
+  bool done() const { return at == state::done; }
+  bool failed() const { return at == state::error; }
+
+  template <typename Sink>
+  std::size_t decode(const std::string_view in, Sink &&sink) {
+    std::size_t i = 0;
+    for (; i < std::size(in) && at != state::done && at != state::error; i++) {
+      const char c = in[i];
+      switch (at) {
+      case state::size:
+        if (const int digit = hex(c); digit >= 0) {
+          left = left * 16 + digit;
+          at = ++digits > max_digits ? state::error : state::size;
+        } else if (digits == 0) {
+          at = state::error;
+        } else if (c == ';' || c == ' ' || c == '\t') {
+          at = state::extension;
+        } else if (c == '\r') {
+          at = state::size_lf;
+        } else if (c == '\n') {
+          sized();
+        } else {
+          at = state::error;
+        }
+        break;
+
+      case state::extension:
+        if (c == '\r')
+          at = state::size_lf;
+        else if (c == '\n')
+          sized();
+        else if (++line > max_line)
+          at = state::error;
+        break;
+
+      case state::size_lf:
+        if (c == '\n')
+          sized();
+        else
+          at = state::error;
+        break;
+
+      case state::data: {
+        const std::size_t n =
+            std::min<std::uint64_t>(left, std::size(in) - i);
+        if (!deliver(sink, in.substr(i, n))) {
+          at = state::error;
+          break;
+        }
+        left -= n;
+        i += n - 1;
+        if (left == 0)
+          at = state::data_cr;
+        break;
+      }
+
+      case state::data_cr:
+        if (c == '\r')
+          at = state::data_lf;
+        else if (c == '\n')
+          next_chunk();
+        else
+          at = state::error;
+        break;
+
+      case state::data_lf:
+        if (c == '\n')
+          next_chunk();
+        else
+          at = state::error;
+        break;
+
+      case state::trailer_start:
+        line = 0;
+        if (c == '\r')
+          at = state::end_lf;
+        else if (c == '\n')
+          at = state::done;
+        else
+          at = state::trailer;
+        break;
+
+      case state::trailer:
+        if (c == '\r')
+          at = state::trailer_lf;
+        else if (c == '\n')
+          at = state::trailer_start;
+        else if (++line > max_line)
+          at = state::error;
+        break;
+
+      case state::trailer_lf:
+        at = c == '\n' ? state::trailer_start : state::error;
+        break;
+
+      case state::end_lf:
+        at = c == '\n' ? state::done : state::error;
+        break;
+
+      case state::done:
+      case state::error:
+        break;
+      }
+    }
+
+    return i;
+  }
+
+  /*
+    Decodes from the front of chain, block by block.
+   */
+  template <typename Sink>
+  std::size_t decode(const buffer_chain &chain, Sink &&sink) {
+    std::size_t used = 0;
+    for (const auto &seg : chain.segments) {
+      const std::size_t n = decode(seg.view(), sink);
+      used += n;
+      if (n < seg.length)
+        break;
+    }
+    return used;
+  }
+
+  void sized() {
+    at = left == 0 ? state::trailer_start : state::data;
+    line = 0;
+  }
+
+  void next_chunk() {
+    at = state::size;
+    left = 0;
+    digits = 0;
+  }
+
+  static int hex(const char c) {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+
+  state at = state::size;
+  std::uint64_t left = 0;
+  std::size_t digits = 0;
+  std::size_t line = 0;
+};
+
+#endif
@@ -7,6 +7,9 @@
 #include <openssl/err.h>
 #include <openssl/ssl.h>
 
+#include "buffer_pool.hpp"
+#include "connection_pool.hpp"
+#include "http_parser.hpp"
 #include "ssl.hpp"
 
 struct https_resolver {
@@ -22,30 +25,114 @@ https_resolver::resolve(const std::string &host, const std::string &service) {
 struct https_socket {
   ssl_socket internal;
   std::string write_buffer;
+  // bytes received past the last response.
+  buffer_chain buffer;
+  // as in http_socket, a pooled connection keeps its TLS session. Only a
+  // connection whose last response was complete and kept alive goes back
+  // for reuse.
+  connection_pool<ssl_socket> *pool = nullptr;
+  std::string pool_key;
+  bool leased = false;
+  bool reusable = false;
 
   void connect(const std::vector<endpoint> &endpoints);
   std::string request(const std::string &data);
   void close();
 };
 
-void https_socket::connect(const std::vector<endpoint> &endpoints) {
-  internal.connect(*(endpoints.begin()));
+inline void https_socket::connect(const std::vector<endpoint> &endpoints) {
+  if (leased)
+    close();
+  buffer.clear();
+  reusable = false;
+  if (pool != nullptr && !endpoints.empty()) {
+    pool_key = connection_pool<ssl_socket>::key(endpoints.front());
+    const auto got = pool->acquire(pool_key, internal);
+    leased = got != connection_pool<ssl_socket>::lease::refused;
+    if (!leased)
+      log_error("Connection pool full.");
+    if (got != connection_pool<ssl_socket>::lease::fresh)
+      return;
+  }
+
+  internal.connect(endpoints);
 }
 
-std::string https_socket::request(const std::string &data) {
+/*
+  Sends data, an HTTP request, and returns the response as received, head
+  and framed body. The response ends where its Content-Length or chunked
+  framing says, so the connection can carry the next request. A reply
+  that is not HTTP is read until the peer closes.
+ */
+inline std::string https_socket::request(const std::string &data) {
+  reusable = false;
   internal.send(data);
+
+  http_parser parser(http_parser::kind::response);
+  http_parse_status status;
+  while ((status = parser.parse(buffer)) == http_parse_status::incomplete)
+    if (buffer.receive(internal) <= 0)
+      break;
+
   std::string response;
-  std::array<char, 4096> receive_buffer;
+  if (status != http_parse_status::done) {
+    buffer.receive_all(internal, response);
+    return response;
+  }
 
-  std::size_t bytes = 0;
-  do {
-    bytes = internal.receive(receive_buffer);
-    response.append(receive_buffer.data(), bytes);
-  } while (bytes > 0);
+  buffer.append_to(response, 0, parser.head_length);
+  buffer.consume(parser.head_length);
 
+  bool complete = false;
+  if (parser.chunked) {
+    chunked_decoder decoder;
+    while (true) {
+      const std::size_t used = decoder.decode(buffer, [](std::string_view) {});
+      buffer.append_to(response, 0, used);
+      buffer.consume(used);
+      if (decoder.done()) {
+        complete = true;
+        break;
+      }
+      if (decoder.failed() || buffer.receive(internal) <= 0)
+        break;
+    }
+  } else if (parser.body_until_close()) {
+    do {
+      buffer.append_to(response);
+      buffer.clear();
+    } while (buffer.receive(internal) > 0);
+  } else {
+    std::size_t left = parser.content_length.value_or(0);
+    while (true) {
+      const std::size_t n = std::min(left, std::size(buffer));
+      buffer.append_to(response, 0, n);
+      buffer.consume(n);
+      left -= n;
+      if (left == 0) {
+        complete = true;
+        break;
+      }
+      if (buffer.receive(internal) <= 0)
+        break;
+    }
+  }
+
+  reusable = complete && parser.keep_alive();
   return response;
 }
 
-void https_socket::close() { internal.close(); }
+inline void https_socket::close() {
+  if (!leased) {
+    internal.close();
+    buffer.clear();
+    return;
+  }
+
+  leased = false;
+  pool->release(pool_key, internal, reusable && buffer.empty());
+  buffer.clear();
+  reusable = false;
+}
 
 #endif
@@ -1,8 +1,9 @@
 #ifndef I2P_HPP
 #define I2P_HPP
 
+#include <algorithm>
+#include <coroutine>
 #include <cstdint>
-#include <iostream>
 #include <limits>
 #include <memory>
 #include <vector>
@@ -11,7 +12,10 @@
 #include "Identity.h"
 #include "Streaming.h"
 #include "api.h"
+#include "coro.hpp"
+#include "deadline.hpp"
 #include "endpoint.hpp"
+#include "log.hpp"
 #include "singleton.hpp"
 #include "tcp.hpp"
 
@@ -91,12 +95,11 @@ struct i2p_socket {
     ssize_t bytes_sent = stream->Send(
         reinterpret_cast<const uint8_t *>(std::data(data)), std::size(data));
     if (bytes_sent == -1) {
-      std::cerr << "Failed to send data." << std::endl;
+      log_error("Failed to send data.");
       return -1;
     }
 
-    std::cerr << "Bytes Sent: " << bytes_sent << " Data Size: " << data.size()
-              << std::endl;
+    log_debug("Bytes Sent: ", bytes_sent, " Data Size: ", data.size());
     return bytes_sent;
   }
 
@@ -113,51 +116,229 @@ struct i2p_socket {
     }
 
     if (bytes_read == -1) {
-      std::cerr << "Failed to receive data." << std::endl;
+      log_error("Failed to receive data.");
       return -1;
     }
 
     return bytes_read;
   }
 
-  template <typename Container> ssize_t receive_some(Container &buffer) {
-    size_t total_bytes_read = 0;
-    while (total_bytes_read < std::size(buffer)) {
-      ssize_t bytes_read = 0;
-      const auto begin =
-          std::addressof(*(std::begin(buffer) + total_bytes_read));
-      const std::size_t left = std::size(buffer) - total_bytes_read;
-
-      if (stream->GetStatus() == i2p::stream::eStreamStatusNew ||
-          stream->GetStatus() == i2p::stream::eStreamStatusOpen) {
-        bytes_read = stream->Receive(reinterpret_cast<uint8_t *>(begin), left,
-                                     std::numeric_limits<int>::max());
-      } else {
-        bytes_read = stream->ReadSome(reinterpret_cast<uint8_t *>(begin), left);
+  /*
+    See tcp_socket::receive_exact. The stream's own receive timeout has
+    whole second granularity, so the deadline is rounded up to that.
+   */
+  template <typename Container>
+  io_result receive_exact(Container &buffer, const int timeout_ms = -1) {
+    auto *bytes = reinterpret_cast<uint8_t *>(std::data(buffer));
+    const std::size_t len = std::size(buffer) * sizeof(*std::data(buffer));
+    const deadline until(timeout_ms);
+    std::size_t total = 0;
+    while (total < len) {
+      const bool open =
+          stream->GetStatus() == i2p::stream::eStreamStatusNew ||
+          stream->GetStatus() == i2p::stream::eStreamStatusOpen;
+
+      // closed, hand out what is still queued then report the end.
+      if (!open) {
+        const std::size_t bytes_read =
+            stream->ReadSome(bytes + total, len - total);
+        if (bytes_read == 0)
+          return {static_cast<ssize_t>(total), io_status::eof};
+        total += bytes_read;
+        continue;
       }
 
-      if (bytes_read == -1) {
-        std::cerr << "Failed to receive data." << std::endl;
-        return -1;
-      } else if (bytes_read > 0)
-        total_bytes_read += bytes_read;
+      if (until.expired())
+        return {static_cast<ssize_t>(total), io_status::timeout};
+
+      const int seconds = until.forever
+                              ? std::numeric_limits<int>::max()
+                              : std::max(1, (until.remaining_ms() + 999) / 1000);
+      total += stream->Receive(bytes + total, len - total, seconds);
     }
 
-    return total_bytes_read;
+    return {static_cast<ssize_t>(total), io_status::ok};
+  }
+
+  template <typename Container>
+  ssize_t receive_some(Container &buffer, const int timeout_ms = -1) {
+    return receive_exact(buffer, timeout_ms).bytes;
   }
 
-  template <typename T> ssize_t receive_into(T &obj) {
+  template <typename T>
+  ssize_t receive_into(T &obj, const int timeout_ms = -1) {
     union var {
       T obj;
       std::array<std::byte, sizeof(T)> bytes;
     };
 
     var v;
-    ssize_t len = receive_some(v.bytes);
-    obj = v.obj;
-    return len;
+    const io_result r = receive_exact(v.bytes, timeout_ms);
+    if (r.ok())
+      obj = v.obj;
+    return r.bytes;
   }
 
   void close() { stream->Close(); }
 };
+
+/*
+  Awaitable operations for i2p streams, on top of i2pd's own asynchronous
+  calls. Those complete on the i2pd service thread, the result is handed
+  back to the coroutine's scheduler.
+ */
+
+/*
+  Completes once the lease set of b64 is found and a stream to it opened,
+  false when either fails.
+ */
+inline task<bool> async_connect(i2p_socket &sock, const std::string &b64,
+                                const uint16_t port) {
+  struct connect_awaiter {
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+      destination->CreateStream(
+          [this, h](std::shared_ptr<i2p::stream::Stream> stream) {
+            result = std::move(stream);
+            sched.post(h);
+          },
+          ident, port);
+    }
+
+    std::shared_ptr<i2p::stream::Stream> await_resume() noexcept {
+      return std::move(result);
+    }
+
+    std::shared_ptr<i2p::client::ClientDestination> destination;
+    i2p::data::IdentHash ident;
+    uint16_t port;
+    scheduler &sched;
+    std::shared_ptr<i2p::stream::Stream> result = nullptr;
+  };
+
+  auto destination = i2p_session::instance().get_local_destination();
+  if (!destination) {
+    log_error("I2P session not started.");
+    co_return false;
+  }
+
+  i2p::data::IdentityEx remote;
+  remote.FromBase64(b64);
+  sock.stream = co_await connect_awaiter{
+      destination, remote.GetIdentHash(), port, scheduler::current()};
+  if (!sock.stream) {
+    log_error("Connection failed.");
+    co_return false;
+  }
+  co_return true;
+}
+
+/*
+  Completes with the next incoming stream of the session, taken ahead of
+  the session's own acceptor, or a socket without stream on failure.
+ */
+inline task<i2p_socket> async_accept(i2p_session &session) {
+  struct accept_awaiter {
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+      destination->AcceptOnce(
+          [this, h](std::shared_ptr<i2p::stream::Stream> stream) {
+            result = std::move(stream);
+            sched.post(h);
+          });
+    }
+
+    std::shared_ptr<i2p::stream::Stream> await_resume() noexcept {
+      return std::move(result);
+    }
+
+    std::shared_ptr<i2p::client::ClientDestination> destination;
+    scheduler &sched;
+    std::shared_ptr<i2p::stream::Stream> result = nullptr;
+  };
+
+  i2p_socket client;
+  auto destination = session.get_local_destination();
+  if (!destination) {
+    log_error("I2P session not started.");
+    co_return client;
+  }
+
+  client.stream = co_await accept_awaiter{destination, scheduler::current()};
+  if (!client.stream)
+    log_error("Failed to accept connection.");
+  co_return client;
+}
+
+/*
+  Completes once all of data is queued on the stream. Returns the byte
+  count or -1.
+ */
+template <typename Container>
+task<ssize_t> async_send(i2p_socket &sock, const Container &data) {
+  struct send_awaiter {
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+      sock.stream->AsyncSend(
+          reinterpret_cast<const uint8_t *>(std::data(data)), len,
+          [this, h](const boost::system::error_code &ec) {
+            result = ec ? -1 : static_cast<ssize_t>(len);
+            sched.post(h);
+          });
+    }
+
+    ssize_t await_resume() const noexcept { return result; }
+
+    i2p_socket &sock;
+    const Container &data;
+    std::size_t len;
+    scheduler &sched;
+    ssize_t result = -1;
+  };
+
+  const ssize_t bytes = co_await send_awaiter{
+      sock, data, std::size(data) * sizeof(*std::data(data)),
+      scheduler::current()};
+  if (bytes == -1)
+    log_error("Failed to send data.");
+  co_return bytes;
+}
+
+/*
+  Completes with whatever is available, like receive().
+ */
+template <typename Container>
+task<ssize_t> async_receive(i2p_socket &sock, Container &buffer) {
+  struct receive_awaiter {
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+      sock.stream->AsyncReceive(
+          boost::asio::buffer(std::data(buffer),
+                              std::size(buffer) * sizeof(*std::data(buffer))),
+          [this, h](const boost::system::error_code &ec,
+                    const std::size_t bytes) {
+            result = ec && bytes == 0 ? -1 : static_cast<ssize_t>(bytes);
+            sched.post(h);
+          },
+          std::numeric_limits<int>::max());
+    }
+
+    ssize_t await_resume() const noexcept { return result; }
+
+    i2p_socket &sock;
+    Container &buffer;
+    scheduler &sched;
+    ssize_t result = -1;
+  };
+
+  const ssize_t bytes =
+      co_await receive_awaiter{sock, buffer, scheduler::current()};
+  if (bytes == -1)
+    log_error("Failed to receive data.");
+  co_return bytes;
+}
 #endif
@@ -0,0 +1,505 @@
+#ifndef IO_ENGINE_HPP
+#define IO_ENGINE_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "endpoint.hpp"
+#include "reactor.hpp"
+#include "socket_profile.hpp"
+
+#ifdef ENET_IO_URING
+#include "uring.hpp"
+#endif
+
+/*
+  Completion based execution engine for the socket wrappers. Built with
+  ENET_IO_URING (the makefile's URING=1) it runs on io_uring, and falls back
+  to emulating the same completions on top of the epoll reactor when the
+  ring cannot be created (old kernel, seccomp, io_uring_disabled sysctl).
+
+  Every completion receives the kernel style result: >= 0 is the byte count
+  or accepted descriptor, < 0 is -errno. Buffers handed to send/receive must
+  stay alive until their completion has run, and sockets used with the
+  engine must be closed through io_engine::close so pending operations are
+  cancelled.
+ */
+struct io_engine {
+  using completion = std::function<void(int result)>;
+  using data_handler =
+      std::function<void(int result, std::span<const std::byte> data)>;
+
+  static constexpr std::uint16_t buffer_group = 1;
+
+  io_engine(const unsigned entries = 256,
+            const std::size_t recv_buffer_size = 4096,
+            const unsigned recv_buffer_count = 256)
+      : buffer_size(recv_buffer_size), buffer_count(recv_buffer_count),
+        recv_pool(recv_buffer_size * recv_buffer_count) {
+#ifdef ENET_IO_URING
+    if (ring.init(entries)) {
+      use_uring = true;
+      ring.provide_buffers(std::data(recv_pool), buffer_size, buffer_count,
+                           buffer_group, 0);
+      arm_wake();
+    }
+#else
+    (void)entries;
+#endif
+  }
+
+  io_engine(const io_engine &) = delete;
+  io_engine &operator=(const io_engine &) = delete;
+
+  bool using_uring() const { return use_uring; }
+
+  /*
+    With multishot set the completion runs once per accepted connection
+    until the listener is closed or an error is reported.
+   */
+  template <typename Socket>
+  void accept(Socket &listener, completion fn, const bool multishot = false) {
+#ifdef ENET_IO_URING
+    if (use_uring) {
+      arm_accept(listener.sockfd, std::move(fn), multishot);
+      return;
+    }
+#endif
+    queue_read(listener, {op_kind::accept, nullptr, 0, multishot,
+                          std::move(fn), nullptr});
+  }
+
+  /*
+    Opens a non-blocking stream socket for ep and connects it.
+   */
+  template <typename Socket>
+  void connect(Socket &sock, const endpoint &ep, completion fn) {
+    sock.sockfd = ::socket(ep.addr.sa_family,
+                           SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock.sockfd == -1) {
+      const int err = errno;
+      finished.push_back([fn = std::move(fn), err] { fn(-err); });
+      return;
+    }
+
+    if constexpr (requires { sock.profile; })
+      sock.profile.apply(sock.sockfd, socket_profile::stage::connect);
+
+#ifdef ENET_IO_URING
+    if (use_uring) {
+      ring.connect(sock.sockfd, &ep.addr, ep.addrlen,
+                   [fn = std::move(fn)](int res, std::uint32_t) { fn(res); });
+      return;
+    }
+#endif
+    if (::connect(sock.sockfd, &ep.addr, ep.addrlen) == 0) {
+      finished.push_back([fn = std::move(fn)] { fn(0); });
+      return;
+    }
+
+    if (errno != EINPROGRESS) {
+      const int err = errno;
+      finished.push_back([fn = std::move(fn), err] { fn(-err); });
+      return;
+    }
+
+    queue_write(sock,
+                {op_kind::connect, nullptr, 0, false, std::move(fn), nullptr});
+  }
+
+  template <typename Socket, typename Container>
+  void send(Socket &sock, const Container &data, completion fn) {
+#ifdef ENET_IO_URING
+    if (use_uring) {
+      ring.send(sock.sockfd, std::data(data), std::size(data),
+                [fn = std::move(fn)](int res, std::uint32_t) { fn(res); });
+      return;
+    }
+#endif
+    queue_write(sock,
+                {op_kind::send, const_cast<void *>(static_cast<const void *>(
+                                    std::data(data))),
+                 std::size(data), false, std::move(fn), nullptr});
+  }
+
+  template <typename Socket, typename Container>
+  void receive(Socket &sock, Container &buffer, completion fn) {
+#ifdef ENET_IO_URING
+    if (use_uring) {
+      ring.recv(sock.sockfd, std::data(buffer), std::size(buffer),
+                [fn = std::move(fn)](int res, std::uint32_t) { fn(res); });
+      return;
+    }
+#endif
+    queue_read(sock, {op_kind::recv, std::data(buffer), std::size(buffer),
+                      false, std::move(fn), nullptr});
+  }
+
+  /*
+    Delivers every chunk of incoming data from the engine's own buffer pool,
+    the span is only valid during the call. Ends after reporting eof (0) or
+    an error.
+   */
+  template <typename Socket> void receive_multishot(Socket &sock, data_handler fn) {
+#ifdef ENET_IO_URING
+    if (use_uring) {
+      arm_multishot(sock.sockfd, std::move(fn));
+      return;
+    }
+#endif
+    queue_read(sock,
+               {op_kind::recv_multishot, nullptr, 0, true, nullptr, std::move(fn)});
+  }
+
+  /*
+    Registered buffers are pinned once by the kernel instead of on every
+    operation. send_fixed/receive_fixed address a slice of one of them.
+   */
+  bool register_buffers(std::vector<iovec> buffers) {
+    registered = std::move(buffers);
+#ifdef ENET_IO_URING
+    if (use_uring)
+      return ring.register_buffers(registered);
+#endif
+    return true;
+  }
+
+  bool register_files(const std::vector<int> &fds) {
+#ifdef ENET_IO_URING
+    if (use_uring)
+      return ring.register_files(fds);
+#else
+    (void)fds;
+#endif
+    return true;
+  }
+
+  template <typename Socket>
+  void send_fixed(Socket &sock, const std::uint16_t index,
+                  const std::size_t offset, const std::size_t len,
+                  completion fn) {
+    auto *base = static_cast<std::byte *>(registered[index].iov_base) + offset;
+#ifdef ENET_IO_URING
+    if (use_uring) {
+      ring.write_fixed(sock.sockfd, base, len, index,
+                       [fn = std::move(fn)](int res, std::uint32_t) { fn(res); });
+      return;
+    }
+#endif
+    send(sock, std::span<const std::byte>(base, len), std::move(fn));
+  }
+
+  template <typename Socket>
+  void receive_fixed(Socket &sock, const std::uint16_t index,
+                     const std::size_t offset, const std::size_t len,
+                     completion fn) {
+    auto *base = static_cast<std::byte *>(registered[index].iov_base) + offset;
+#ifdef ENET_IO_URING
+    if (use_uring) {
+      ring.read_fixed(sock.sockfd, base, len, index,
+                      [fn = std::move(fn)](int res, std::uint32_t) { fn(res); });
+      return;
+    }
+#endif
+    std::span<std::byte> slice(base, len);
+    receive(sock, slice, std::move(fn));
+  }
+
+  /*
+    Cancels everything pending on the socket (completions see -ECANCELED)
+    and closes it.
+   */
+  template <typename Socket> void close(Socket &sock) {
+    const int fd = sock.sockfd;
+    if (fd == -1)
+      return;
+
+#ifdef ENET_IO_URING
+    if (use_uring) {
+      ring.cancel_fd(fd);
+      ring.submit();
+      sock.close();
+      return;
+    }
+#endif
+    auto it = descriptors.find(fd);
+    if (it != std::end(descriptors)) {
+      for (auto *ops : {&it->second.reads, &it->second.writes})
+        for (auto &op : *ops)
+          finished.push_back([op = std::move(op)] { op.complete(-ECANCELED); });
+      descriptors.erase(it);
+      poller.remove(fd);
+    }
+
+    sock.close();
+  }
+
+  /*
+    Submits everything queued since the last call as one batch, then waits
+    up to timeout_ms (-1 blocks, 0 polls) and runs the completions.
+   */
+  int run_once(const int timeout_ms = -1) {
+#ifdef ENET_IO_URING
+    if (use_uring) {
+      int ran = drain_finished();
+      if (ran > 0 || timeout_ms == 0)
+        return ran + ring.run_once(false);
+      return ring.run_once(true, timeout_ms);
+    }
+#endif
+    int ran = drain_finished();
+
+    std::vector<int> kicked;
+    kicked.swap(kicks);
+    for (const int fd : kicked)
+      ran += progress(fd);
+
+    const bool busy = !finished.empty() || !kicks.empty() || ran > 0;
+    if (poller.run_once(busy ? 0 : timeout_ms) == -1)
+      return -1;
+
+    return ran + drain_finished();
+  }
+
+  void run() {
+    running = true;
+    while (running)
+      if (run_once() == -1)
+        break;
+  }
+
+  /*
+    Not thread-safe, call from a completion to leave run().
+   */
+  void stop() {
+    running = false;
+#ifdef ENET_IO_URING
+    if (use_uring) {
+      const std::uint64_t one = 1;
+      [[maybe_unused]] ssize_t rc = ::write(poller.wakefd, &one, sizeof(one));
+      return;
+    }
+#endif
+    poller.wake();
+  }
+
+  enum class op_kind { accept, connect, send, recv, recv_multishot };
+
+  struct pending_op {
+    op_kind kind;
+    void *buf;
+    std::size_t len;
+    bool multishot;
+    completion fn;
+    data_handler data_fn;
+
+    void complete(const int res) const {
+      if (fn)
+        fn(res);
+      else if (data_fn)
+        data_fn(res, {});
+    }
+  };
+
+  struct descriptor {
+    std::deque<pending_op> reads;
+    std::deque<pending_op> writes;
+  };
+
+  int drain_finished() {
+    int ran = 0;
+    while (!finished.empty()) {
+      std::vector<std::function<void()>> batch;
+      batch.swap(finished);
+      for (auto &fn : batch)
+        fn();
+      ran += std::size(batch);
+    }
+    return ran;
+  }
+
+  template <typename Socket> void queue_read(Socket &sock, pending_op op) {
+    watch(sock).reads.push_back(std::move(op));
+    kicks.push_back(sock.sockfd);
+  }
+
+  template <typename Socket> void queue_write(Socket &sock, pending_op op) {
+    watch(sock).writes.push_back(std::move(op));
+    kicks.push_back(sock.sockfd);
+  }
+
+  /*
+    Registers sock on first use. The reactor switches it to non-blocking,
+    progress() calls accept4/recv/send inline and must never wait in them.
+   */
+  template <typename Socket> descriptor &watch(Socket &sock) {
+    const int fd = sock.sockfd;
+    auto it = descriptors.find(fd);
+    if (it != std::end(descriptors))
+      return it->second;
+
+    descriptor &d = descriptors[fd];
+    poller.add(sock, EPOLLIN | EPOLLOUT | EPOLLRDHUP,
+               [this, fd](std::uint32_t) { progress(fd); });
+    return d;
+  }
+
+  /*
+    Runs every operation on fd that can make progress without blocking.
+    Completions run inline since this is only ever called from run_once.
+   */
+  int progress(const int fd) {
+    int ran = 0;
+    auto it = descriptors.find(fd);
+    if (it == std::end(descriptors))
+      return 0;
+
+    auto &reads = it->second.reads;
+    while (!reads.empty()) {
+      pending_op &op = reads.front();
+      int res;
+      if (op.kind == op_kind::accept) {
+        res = ::accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      } else if (op.kind == op_kind::recv) {
+        res = ::recv(fd, op.buf, op.len, 0);
+      } else {
+        res = ::recv(fd, std::data(recv_pool), buffer_size, 0);
+      }
+
+      if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      if (res == -1 && errno == EINTR)
+        continue;
+      if (res == -1)
+        res = -errno;
+
+      // multishot ops stay at the front until they fail or see eof.
+      const bool done = !op.multishot ||
+                        (op.kind == op_kind::accept ? res < 0 : res <= 0);
+      if (op.kind == op_kind::recv_multishot) {
+        data_handler fn = op.data_fn;
+        if (done)
+          reads.pop_front();
+        fn(res, std::span<const std::byte>(std::data(recv_pool),
+                                           res > 0 ? res : 0));
+      } else {
+        completion fn = op.fn;
+        if (done)
+          reads.pop_front();
+        fn(res);
+      }
+      ran++;
+
+      // the handler may have closed the descriptor.
+      it = descriptors.find(fd);
+      if (it == std::end(descriptors))
+        return ran;
+    }
+
+    auto &writes = it->second.writes;
+    while (!writes.empty()) {
+      pending_op &op = writes.front();
+      int res;
+      if (op.kind == op_kind::connect) {
+        pollfd pfd{fd, POLLOUT, 0};
+        if (::poll(&pfd, 1, 0) == 0)
+          break;
+
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        res = -err;
+      } else {
+        res = ::send(fd, op.buf, op.len, MSG_NOSIGNAL);
+        if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+          break;
+        if (res == -1 && errno == EINTR)
+          continue;
+        if (res == -1)
+          res = -errno;
+      }
+
+      completion fn = std::move(op.fn);
+      writes.pop_front();
+      fn(res);
+      ran++;
+
+      it = descriptors.find(fd);
+      if (it == std::end(descriptors))
+        return ran;
+    }
+
+    return ran;
+  }
+
+#ifdef ENET_IO_URING
+  void arm_accept(const int fd, completion fn, const bool multishot) {
+    ring.accept(
+        fd,
+        [this, fd, fn = std::move(fn), multishot](int res,
+                                                  std::uint32_t flags) {
+          fn(res);
+          // the kernel may end a multishot accept early, keep it armed.
+          if (multishot && res >= 0 && !(flags & IORING_CQE_F_MORE))
+            arm_accept(fd, fn, true);
+        },
+        multishot);
+  }
+
+  void arm_multishot(const int fd, data_handler fn) {
+    ring.recv_multishot(
+        fd, buffer_group,
+        [this, fd, fn = std::move(fn)](int res, std::uint32_t flags) {
+          if (flags & IORING_CQE_F_BUFFER) {
+            const std::uint16_t id = uring::buffer_id(flags);
+            std::byte *buf = std::data(recv_pool) + id * buffer_size;
+            fn(res, std::span<const std::byte>(buf, res > 0 ? res : 0));
+            ring.provide_buffers(buf, buffer_size, 1, buffer_group, id);
+          } else if (res != -ENOBUFS) {
+            fn(res, {});
+          }
+
+          // out of buffers or ended early by the kernel, re-arm once the
+          // consumed buffer is back in the group.
+          if (!(flags & IORING_CQE_F_MORE) && (res > 0 || res == -ENOBUFS))
+            arm_multishot(fd, fn);
+        });
+  }
+
+  void arm_wake() {
+    ring.read(poller.wakefd, &wake_value, sizeof(wake_value),
+              [this](int res, std::uint32_t) {
+                if (res >= 0)
+                  arm_wake();
+              });
+  }
+
+  uring ring;
+  std::uint64_t wake_value = 0;
+#endif
+
+  bool use_uring = false;
+  bool running = false;
+  std::size_t buffer_size;
+  unsigned buffer_count;
+  std::vector<std::byte> recv_pool;
+  std::vector<iovec> registered;
+
+  reactor poller;
+  std::unordered_map<int, descriptor> descriptors;
+  std::vector<int> kicks;
+  std::vector<std::function<void()>> finished;
+};
+
+#endif
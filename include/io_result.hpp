@@ -0,0 +1,98 @@
+#ifndef IO_RESULT_HPP
+#define IO_RESULT_HPP
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include <netdb.h>
+#include <sys/types.h>
+
+/*
+  Outcome of a non-blocking socket operation. The blocking send/receive calls
+  keep returning a plain ssize_t, the try_* variants return this so the caller
+  can tell "nothing to do right now" apart from a real failure or a closed
+  peer. The calls that take a deadline report timeout when it passes.
+ */
+enum class io_status {
+  ok,
+  would_block,
+  eof,
+  timeout,
+  error,
+};
+
+struct io_result {
+  ssize_t bytes;
+  io_status status;
+
+  bool ok() const { return status == io_status::ok; }
+  bool would_block() const { return status == io_status::would_block; }
+};
+
+/*
+  Why the last call on a socket failed. The socket wrappers keep one as
+  last_error next to their -1/false/io_status::error returns, so callers
+  can branch on the cause without parsing log output.
+ */
+enum class error_domain {
+  none,
+  system,   // errno
+  ssl,      // SSL_get_error
+  resolver, // getaddrinfo
+};
+
+struct net_error {
+  int code = 0;
+  error_domain domain = error_domain::none;
+
+  explicit operator bool() const { return domain != error_domain::none; }
+
+  // descriptors or memory ran out, retrying at once fails the same way.
+  bool out_of_resources() const {
+    return domain == error_domain::system &&
+           (code == EMFILE || code == ENFILE || code == ENOBUFS ||
+            code == ENOMEM);
+  }
+
+  /*
+    accept failed for the connection at the head of the queue only (the
+    peer gave up or its network went away), the next one may be fine.
+   */
+  bool transient() const {
+    if (domain != error_domain::system)
+      return false;
+    switch (code) {
+    case ECONNABORTED:
+    case EPROTO:
+    case EPERM:
+    case ETIMEDOUT:
+    case ENETDOWN:
+    case ENETUNREACH:
+    case EHOSTDOWN:
+    case EHOSTUNREACH:
+    case ENONET:
+    case ENOPROTOOPT:
+    case EOPNOTSUPP:
+    case EINTR:
+      return true;
+    }
+    return false;
+  }
+
+  std::string message() const {
+    switch (domain) {
+    case error_domain::none:
+      return "no error";
+    case error_domain::system:
+      return std::system_category().message(code);
+    case error_domain::ssl:
+      return "SSL error " + std::to_string(code);
+    case error_domain::resolver:
+      return gai_strerror(code);
+    }
+    return "unknown error";
+  }
+};
+
+#endif
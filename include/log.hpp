@@ -0,0 +1,251 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "io_result.hpp"
+
+/*
+  Diagnostics off the hot path. A log call formats into a fixed record
+  in a per-thread ring and returns, a background thread writes batches of
+  records to stderr with one write(2). Nothing is shared between logging
+  threads, so no stream lock serializes them. When a ring is full the
+  record is dropped and counted, logging never blocks.
+
+  Levels below ENET_LOG_LEVEL (0 debug, 1 info, 2 warn, 3 error, 4 off)
+  format and write nothing, but the caller still evaluates the arguments.
+  Guard a costly one with logger::enabled():
+
+    log_error("Failed to send data.");
+    log_debug("Bytes Sent: ", n, " Data Size: ", size);
+    if constexpr (logger::enabled(log_level::debug))
+      log_debug("State: ", describe());
+ */
+#ifndef ENET_LOG_LEVEL
+#define ENET_LOG_LEVEL 1
+#endif
+
+enum class log_level : int { debug, info, warn, error, off };
+
+struct logger {
+  static constexpr log_level compiled_level =
+      static_cast<log_level>(ENET_LOG_LEVEL);
+  static constexpr std::size_t ring_size = 1024;
+  static constexpr std::size_t text_size = 240;
+  static constexpr std::chrono::milliseconds flush_interval{10};
+
+  struct record {
+    log_level level;
+    std::uint32_t length;
+    char text[text_size];
+  };
+
+  /*
+    Single producer (its thread) single consumer (the flusher) ring.
+   */
+  struct ring {
+    alignas(64) std::atomic<std::uint64_t> head = 0;
+    alignas(64) std::atomic<std::uint64_t> tail = 0;
+    std::atomic<std::uint64_t> dropped = 0;
+    std::array<record, ring_size> records;
+  };
+
+  /*
+    Never destroyed, threads and static destructors may still log during
+    exit. Whatever is queued when exit() runs is written out then. A
+    forked child has no flusher until its next thread logs, its records
+    are written at exit.
+   */
+  static logger &instance() {
+    static logger *l = [] {
+      auto *created = new logger;
+      std::atexit([] { instance().flush(); });
+      pthread_atfork([] { instance().mutex.lock(); },
+                     [] { instance().mutex.unlock(); },
+                     [] {
+                       instance().started = false;
+                       instance().mutex.unlock();
+                     });
+      return created;
+    }();
+    return *l;
+  }
+
+  static constexpr bool enabled(const log_level level) {
+    return level >= compiled_level && level != log_level::off;
+  }
+
+  template <log_level level, typename... Args>
+  static void write(const Args &...args) {
+    if constexpr (enabled(level)) {
+      ring &r = local();
+      const std::uint64_t head = r.head.load(std::memory_order_relaxed);
+      if (head - r.tail.load(std::memory_order_acquire) == ring_size) {
+        r.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+
+      record &rec = r.records[head % ring_size];
+      rec.level = level;
+      rec.length = 0;
+      (append(rec, args), ...);
+      r.head.store(head + 1, std::memory_order_release);
+    }
+  }
+
+  /*
+    Writes out everything logged so far, from any thread.
+   */
+  void flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    drain();
+  }
+
+  template <typename T> static void append(record &rec, const T &value) {
+    char *out = rec.text + rec.length;
+    char *end = rec.text + text_size;
+    if constexpr (std::is_same_v<T, char>) {
+      if (out != end)
+        *out++ = value;
+    } else if constexpr (std::is_same_v<T, bool>) {
+      out = copy(out, end, value ? "true" : "false");
+    } else if constexpr (std::is_integral_v<T> || std::is_floating_point_v<T>) {
+      auto [ptr, ec] = std::to_chars(out, end, value);
+      if (ec == std::errc())
+        out = ptr;
+    } else if constexpr (std::is_enum_v<T>) {
+      append(rec, static_cast<std::underlying_type_t<T>>(value));
+      return;
+    } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+      out = copy(out, end, value);
+    } else {
+      static_assert(sizeof(T) == 0, "logger cannot format this type");
+    }
+
+    rec.length = out - rec.text;
+  }
+
+  static char *copy(char *out, char *end, const std::string_view s) {
+    const std::size_t n = std::min<std::size_t>(s.size(), end - out);
+    std::memcpy(out, s.data(), n);
+    return out + n;
+  }
+
+  /*
+    The calling thread's ring, registered on first use. The registry
+    shares ownership, so records of an exited thread still get written.
+   */
+  static ring &local() {
+    static thread_local std::shared_ptr<ring> r = [] {
+      auto created = std::make_shared<ring>();
+      instance().attach(created);
+      return created;
+    }();
+    return *r;
+  }
+
+  void attach(std::shared_ptr<ring> r) {
+    std::lock_guard<std::mutex> lock(mutex);
+    rings.push_back(std::move(r));
+    if (!started) {
+      std::thread([this] { run(); }).detach();
+      started = true;
+    }
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      drain();
+      wake.wait_for(lock, flush_interval);
+    }
+  }
+
+  /*
+    mutex must be held, it makes the caller the only consumer.
+   */
+  void drain() {
+    static constexpr std::string_view names[] = {"debug: ", "info: ",
+                                                 "warn: ", "error: "};
+    std::string batch;
+    for (auto &r : rings) {
+      const std::uint64_t head = r->head.load(std::memory_order_acquire);
+      std::uint64_t tail = r->tail.load(std::memory_order_relaxed);
+      for (; tail != head; tail++) {
+        const record &rec = r->records[tail % ring_size];
+        batch += names[static_cast<int>(rec.level)];
+        batch.append(rec.text, rec.length);
+        batch += '\n';
+      }
+      r->tail.store(tail, std::memory_order_release);
+
+      if (const auto lost = r->dropped.exchange(0, std::memory_order_relaxed))
+        batch += "warn: " + std::to_string(lost) + " log records dropped.\n";
+    }
+
+    // rings of exited threads, once written out.
+    std::erase_if(rings, [](const auto &r) {
+      return r.use_count() == 1 && r->head.load() == r->tail.load();
+    });
+
+    for (std::size_t done = 0; done < batch.size();) {
+      const ssize_t n = ::write(STDERR_FILENO, batch.data() + done,
+                                batch.size() - done);
+      if (n <= 0)
+        break;
+      done += n;
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<std::shared_ptr<ring>> rings;
+  bool started = false;
+};
+
+template <typename... Args> void log_debug(const Args &...args) {
+  logger::write<log_level::debug>(args...);
+}
+template <typename... Args> void log_info(const Args &...args) {
+  logger::write<log_level::info>(args...);
+}
+template <typename... Args> void log_warn(const Args &...args) {
+  logger::write<log_level::warn>(args...);
+}
+template <typename... Args> void log_error(const Args &...args) {
+  logger::write<log_level::error>(args...);
+}
+
+/*
+  Records why a socket call failed and logs it with the cause. The cause
+  is only turned into text when errors are logged at all.
+ */
+inline void log_failure(net_error &error, const char *what,
+                        const int code = errno,
+                        const error_domain domain = error_domain::system) {
+  error = {code, domain};
+  if constexpr (logger::enabled(log_level::error))
+    log_error(what, " (", error.message(), ")");
+}
+
+#endif
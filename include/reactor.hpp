@@ -0,0 +1,206 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "log.hpp"
+#include "timer_wheel.hpp"
+
+/*
+  Edge-triggered epoll reactor. Sockets are registered once with the events
+  they care about and the handler is invoked with the ready event mask.
+
+  Because registration is edge-triggered a handler is only called again once
+  new data (or buffer space) arrives, so it must drain the socket with the
+  try_* calls until they report io_status::would_block.
+
+  timers is a wheel driven by the same loop: epoll_wait never sleeps past
+  the next deadline and due timers run right after the socket handlers.
+ */
+struct reactor {
+  using handler = std::function<void(std::uint32_t events)>;
+
+  static constexpr std::size_t max_events = 1024;
+
+  reactor() : events(max_events) {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+      log_error("Failed to create epoll instance.");
+      return;
+    }
+
+    wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakefd == -1) {
+      log_error("Failed to create eventfd.");
+      return;
+    }
+
+    // the wake descriptor is the only registration with a null data.ptr.
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = nullptr;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+  }
+
+  ~reactor() {
+    if (wakefd != -1)
+      ::close(wakefd);
+    if (epfd != -1)
+      ::close(epfd);
+  }
+
+  reactor(const reactor &) = delete;
+  reactor &operator=(const reactor &) = delete;
+
+  bool add(const int fd, const std::uint32_t interest, handler fn) {
+    auto reg = std::make_unique<registration>();
+    reg->fd = fd;
+    reg->fn = std::move(fn);
+
+    epoll_event ev{};
+    ev.events = interest | EPOLLET;
+    ev.data.ptr = reg.get();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+      log_error("Failed to register descriptor.");
+      return false;
+    }
+
+    registrations[fd] = std::move(reg);
+    return true;
+  }
+
+  /*
+    Switches the socket to non-blocking mode and registers it. Works with any
+    of the socket wrappers (tcp_socket, udp_socket, ssl_socket).
+   */
+  template <typename Socket>
+  bool add(Socket &sock, const std::uint32_t interest, handler fn) {
+    if (!sock.set_nonblocking()) {
+      log_error("Failed to set socket non-blocking.");
+      return false;
+    }
+
+    return add(sock.sockfd, interest, std::move(fn));
+  }
+
+  bool modify(const int fd, const std::uint32_t interest) {
+    auto it = registrations.find(fd);
+    if (it == std::end(registrations))
+      return false;
+
+    epoll_event ev{};
+    ev.events = interest | EPOLLET;
+    ev.data.ptr = it->second.get();
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) != -1;
+  }
+
+  /*
+    Safe to call from inside a handler, including the handler being removed.
+    Must be called before the descriptor is closed.
+   */
+  bool remove(const int fd) {
+    auto it = registrations.find(fd);
+    if (it == std::end(registrations))
+      return false;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    it->second->fd = -1;
+    retired.push_back(std::move(it->second));
+    registrations.erase(it);
+    return true;
+  }
+
+  /*
+    Waits up to timeout_ms (-1 blocks), or until the next timer is due, and
+    dispatches every ready handler and expired timer. Returns the number of
+    handlers and timers run, or -1 on error.
+   */
+  int run_once(const int timeout_ms = -1) {
+    int wait_ms = timers.next_timeout_ms();
+    if (wait_ms == -1 || (timeout_ms != -1 && timeout_ms < wait_ms))
+      wait_ms = timeout_ms;
+
+    int ready;
+    do {
+      ready = epoll_wait(epfd, std::data(events), std::size(events), wait_ms);
+    } while (ready == -1 && errno == EINTR);
+
+    if (ready == -1) {
+      log_error("epoll_wait failed.");
+      return -1;
+    }
+
+    int dispatched = 0;
+    for (int i = 0; i < ready; i++) {
+      auto *reg = static_cast<registration *>(events[i].data.ptr);
+      if (reg == nullptr) {
+        std::uint64_t count;
+        while (::read(wakefd, &count, sizeof(count)) > 0)
+          ;
+        continue;
+      }
+
+      // removed by an earlier handler in this batch.
+      if (reg->fd == -1)
+        continue;
+
+      reg->fn(events[i].events);
+      dispatched++;
+    }
+
+    retired.clear();
+    dispatched += timers.advance();
+    return dispatched;
+  }
+
+  /*
+    Dispatches until stop(). A stop() issued before run() starts is kept,
+    run() then returns at once.
+   */
+  void run() {
+    while (running.load(std::memory_order_acquire))
+      if (run_once() == -1)
+        break;
+  }
+
+  /*
+    Thread-safe, wakes up a blocked run().
+   */
+  void stop() {
+    running.store(false, std::memory_order_release);
+    wake();
+  }
+
+  void wake() {
+    const std::uint64_t one = 1;
+    [[maybe_unused]] ssize_t rc = ::write(wakefd, &one, sizeof(one));
+  }
+
+  std::size_t size() const { return registrations.size(); }
+
+  struct registration {
+    int fd;
+    handler fn;
+  };
+
+  int epfd = -1;
+  int wakefd = -1;
+  // only stop() clears it, so a stop racing ahead of run() is not lost.
+  std::atomic<bool> running = true;
+  std::vector<epoll_event> events;
+  std::unordered_map<int, std::unique_ptr<registration>> registrations;
+  std::vector<std::unique_ptr<registration>> retired;
+  timer_wheel timers;
+};
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef RESOLVER_HPP
+#define RESOLVER_HPP
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "endpoint.hpp"
+#include "log.hpp"
+
+/*
+  Name lookups shared by tcp_resolver, udp_resolver and ssl_resolver.
+
+  Answers are cached for their TTL, failures for negative_ttl. Concurrent
+  lookups of the same name share one in-flight query, and a hit within the
+  last prefetch_fraction of its TTL returns the cached answer while a
+  refresh runs in the background, so hot names never block on expiry.
+
+  Lookups go through a list of sources, the first one with an answer wins.
+  The default is getaddrinfo. It does not report TTLs, so its answers are
+  kept for default_ttl.
+ */
+struct dns_resolver {
+  using clock = std::chrono::steady_clock;
+
+  struct answer {
+    std::vector<endpoint> endpoints;
+    std::chrono::milliseconds ttl;
+  };
+
+  using source = std::function<answer(
+      const std::string &host, const std::string &service, int socktype)>;
+
+  static constexpr std::chrono::milliseconds default_ttl =
+      std::chrono::seconds(60);
+  static constexpr std::chrono::milliseconds negative_ttl =
+      std::chrono::seconds(5);
+  static constexpr double prefetch_fraction = 0.1;
+  static constexpr std::size_t max_entries = 4096;
+
+  dns_resolver() : sources{getaddrinfo_source()} {}
+  explicit dns_resolver(std::vector<source> s) : sources(std::move(s)) {}
+
+  ~dns_resolver() { drain(); }
+
+  dns_resolver(const dns_resolver &) = delete;
+  dns_resolver &operator=(const dns_resolver &) = delete;
+
+  /*
+    Process-wide instance used by the socket resolvers.
+   */
+  static dns_resolver &shared() {
+    static dns_resolver instance;
+    return instance;
+  }
+
+  std::vector<endpoint> resolve(const std::string &host,
+                                const std::string &service,
+                                const int socktype) {
+    return resolve_async(host, service, socktype).get();
+  }
+
+  std::shared_future<std::vector<endpoint>>
+  resolve_async(const std::string &host, const std::string &service,
+                const int socktype) {
+    const std::string k = key(host, service, socktype);
+    const auto now = clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto hit = cache.find(k);
+    if (hit != std::end(cache) && hit->second.expires > now) {
+      hits++;
+      if (now >= hit->second.prefetch_at && !inflight.contains(k)) {
+        prefetches++;
+        start(k, host, service, socktype);
+      }
+
+      std::promise<std::vector<endpoint>> ready;
+      ready.set_value(hit->second.endpoints);
+      return ready.get_future().share();
+    }
+
+    auto pending = inflight.find(k);
+    if (pending != std::end(inflight)) {
+      coalesced++;
+      return pending->second;
+    }
+
+    misses++;
+    return start(k, host, service, socktype);
+  }
+
+  /*
+    Drops every cached answer, in-flight lookups still complete.
+   */
+  void flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    cache.clear();
+  }
+
+  /*
+    Waits for every in-flight lookup.
+   */
+  void drain() {
+    std::vector<std::shared_future<std::vector<endpoint>>> waiting;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &[k, f] : inflight)
+        waiting.push_back(f);
+    }
+
+    for (auto &f : waiting)
+      f.wait();
+  }
+
+  /*
+    Plain getaddrinfo, an empty service resolves the address only.
+   */
+  static source getaddrinfo_source(const int flags = 0) {
+    return [flags](const std::string &host, const std::string &service,
+                   const int socktype) {
+      struct addrinfo hints, *res;
+      int status;
+
+      memset(&hints, 0, sizeof hints);
+      hints.ai_family = AF_UNSPEC; // IPv4 or IPv6
+      hints.ai_socktype = socktype;
+      hints.ai_flags = flags;
+
+      answer a{{}, default_ttl};
+      auto *service_str = service.length() ? service.c_str() : nullptr;
+      if ((status = getaddrinfo(host.c_str(), service_str, &hints, &res)) !=
+          0) {
+        log_warn("getaddrinfo error: ", gai_strerror(status));
+        return a;
+      }
+
+      for (struct addrinfo *p = res; p != nullptr; p = p->ai_next)
+        a.endpoints.emplace_back(*p);
+
+      freeaddrinfo(res);
+      return a;
+    };
+  }
+
+  /*
+    Answers from a hosts(5) style file, read once. Names that are not in
+    the file fall through to the next source.
+   */
+  static source hosts_file_source(const std::string &path,
+                                  const std::chrono::milliseconds ttl =
+                                      default_ttl) {
+    std::unordered_multimap<std::string, std::string> names;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream fields(line);
+      std::string address, name;
+      if (!(fields >> address))
+        continue;
+      while (fields >> name)
+        names.emplace(name, address);
+    }
+
+    const source numeric = getaddrinfo_source(AI_NUMERICHOST);
+    return [names = std::move(names), numeric,
+            ttl](const std::string &host, const std::string &service,
+                 const int socktype) {
+      answer a{{}, ttl};
+      auto [first, last] = names.equal_range(host);
+      for (auto it = first; it != last; ++it) {
+        auto found = numeric(it->second, service, socktype).endpoints;
+        a.endpoints.insert(std::end(a.endpoints), std::begin(found),
+                           std::end(found));
+      }
+
+      return a;
+    };
+  }
+
+  struct entry {
+    std::vector<endpoint> endpoints;
+    clock::time_point expires;
+    clock::time_point prefetch_at;
+  };
+
+  static std::string key(const std::string &host, const std::string &service,
+                         const int socktype) {
+    return host + '\0' + service + '\0' + std::to_string(socktype);
+  }
+
+  /*
+    Launches a lookup and registers it as in-flight, mutex must be held.
+    The answer is cached before the future becomes ready, so once drain()
+    returns no lookup thread touches the resolver any more.
+   */
+  std::shared_future<std::vector<endpoint>> start(const std::string &k,
+                                                  const std::string &host,
+                                                  const std::string &service,
+                                                  const int socktype) {
+    // a detached thread and a promise rather than std::async, whose last
+    // future would block (on its own thread, for a prefetch) in store().
+    auto done = std::make_shared<std::promise<std::vector<endpoint>>>();
+    auto f = done->get_future().share();
+    std::thread([this, done, k, host, service, socktype] {
+      answer a{{}, negative_ttl};
+      for (auto &lookup : sources) {
+        a = lookup(host, service, socktype);
+        if (!a.endpoints.empty())
+          break;
+      }
+      if (a.endpoints.empty())
+        a.ttl = negative_ttl;
+
+      store(k, a);
+      done->set_value(std::move(a.endpoints));
+    }).detach();
+
+    inflight.emplace(k, f);
+    return f;
+  }
+
+  void store(const std::string &k, const answer &a) {
+    const auto now = clock::now();
+    const auto prefetch_window =
+        std::chrono::duration_cast<clock::duration>(a.ttl * prefetch_fraction);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (std::size(cache) >= max_entries) {
+      std::erase_if(cache, [now](const auto &e) {
+        return e.second.expires <= now;
+      });
+      if (std::size(cache) >= max_entries)
+        cache.erase(std::begin(cache));
+    }
+
+    cache[k] = {a.endpoints, now + a.ttl, now + a.ttl - prefetch_window};
+    inflight.erase(k);
+  }
+
+  std::vector<source> sources;
+  std::mutex mutex;
+  std::unordered_map<std::string, entry> cache;
+  std::unordered_map<std::string, std::shared_future<std::vector<endpoint>>>
+      inflight;
+
+  // counters, read under mutex.
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+  std::size_t coalesced = 0;
+  std::size_t prefetches = 0;
+};
+
+#endif
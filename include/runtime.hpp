@@ -0,0 +1,305 @@
+#ifndef RUNTIME_HPP
+#define RUNTIME_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "log.hpp"
+#include "reactor.hpp"
+#include "work_queue.hpp"
+
+/*
+  Thread-per-core runtime: one reactor per core, each on its own pinned
+  thread, plus a work-stealing pool for CPU-bound work (compression, TLS
+  handshakes, hashing) that would otherwise stall a loop.
+
+    runtime rt;
+    rt.start();
+    rt.post(0, [&] {
+      rt.loop().add(sock, EPOLLIN, ...);
+    });
+
+  A socket belongs to the core that registered it and is only touched from
+  that core's thread. Other threads reach a core with post(), which goes
+  through a lock-free queue and wakes the loop only when it was idle.
+ */
+struct runtime {
+  using job = std::function<void()>;
+
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+  static constexpr int steal_attempts = 64;
+
+  runtime() = default;
+  ~runtime() { stop(); }
+
+  runtime(const runtime &) = delete;
+  runtime &operator=(const runtime &) = delete;
+
+  /*
+    cores == 0 and workers == 0 mean one per hardware thread. With
+    pin_cpus, core i is pinned to cpu i % hardware threads. The pool is
+    left to the scheduler.
+   */
+  bool start(std::size_t cores = 0, std::size_t workers = 0,
+             const bool pin_cpus = true) {
+    const std::size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    if (cores == 0)
+      cores = cpus;
+    if (workers == 0)
+      workers = cpus;
+
+    for (std::size_t i = 0; i < cores; i++) {
+      shards.push_back(std::make_unique<core>());
+      if (shards.back()->events.epfd == -1) {
+        log_error("Failed to create core event loop.");
+        shards.clear();
+        return false;
+      }
+    }
+    for (std::size_t i = 0; i < workers; i++)
+      pool.push_back(std::make_unique<worker>());
+
+    running.store(true, std::memory_order_release);
+    for (std::size_t i = 0; i < cores; i++)
+      shards[i]->thread = std::thread([this, i, pin_cpus, cpus] {
+        if (pin_cpus) {
+          cpu_set_t set;
+          CPU_ZERO(&set);
+          CPU_SET(i % cpus, &set);
+          pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        core_loop(i);
+      });
+    for (std::size_t i = 0; i < workers; i++)
+      pool[i]->thread = std::thread([this, i] { worker_loop(i); });
+
+    return true;
+  }
+
+  /*
+    Stops and joins every thread. Work still queued is dropped.
+   */
+  void stop() {
+    if (!running.exchange(false))
+      return;
+
+    for (auto &c : shards)
+      c->events.wake();
+    for (auto &w : pool)
+      signal(*w);
+
+    for (auto &c : shards)
+      if (c->thread.joinable())
+        c->thread.join();
+    for (auto &w : pool)
+      if (w->thread.joinable())
+        w->thread.join();
+
+    for (auto &w : pool) {
+      while (auto j = w->inbox.pop())
+        delete *j;
+      while (auto j = w->jobs.pop())
+        delete *j;
+    }
+    shards.clear();
+    pool.clear();
+  }
+
+  std::size_t cores() const { return shards.size(); }
+  std::size_t workers() const { return pool.size(); }
+
+  /*
+    Index of the core running the calling thread, npos elsewhere.
+   */
+  static std::size_t current_core() { return current_core_ref(); }
+
+  /*
+    The reactor of core i, or of the calling core. Only use it from that
+    core's thread.
+   */
+  reactor &loop(const std::size_t i) { return shards[i]->events; }
+  reactor &loop() { return loop(current_core()); }
+
+  /*
+    Thread-safe, runs fn on core i's thread.
+   */
+  void post(const std::size_t i, job fn) {
+    core &c = *shards[i];
+    c.inbox.push(std::move(fn));
+    // one wakeup per idle period, not per message.
+    if (!c.notified.exchange(true, std::memory_order_acq_rel))
+      c.events.wake();
+  }
+
+  /*
+    Thread-safe, runs fn on the pool. From a pool thread the job goes to
+    that worker's own deque, otherwise to one worker's inbox round robin.
+   */
+  void submit(job fn) {
+    job *j = new job(std::move(fn));
+    const std::size_t self = current_worker_ref();
+    if (self != npos && current_pool_ref() == this) {
+      pool[self]->jobs.push(j);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      // whoever sleeps may steal it, the owner is busy running this one.
+      for (auto &w : pool)
+        if (w->sleeping.load(std::memory_order_relaxed)) {
+          signal(*w);
+          break;
+        }
+      return;
+    }
+
+    worker &w = *pool[next_worker.fetch_add(1, std::memory_order_relaxed) %
+                      pool.size()];
+    w.inbox.push(j);
+    signal(w);
+  }
+
+  /*
+    From a core: runs work on the pool, then done(result) back on the
+    calling core, so the result can touch that core's sockets. Called from
+    any other thread there is no core to come back to, nothing runs and
+    false is returned.
+   */
+  template <typename Work, typename Done> bool offload(Work work, Done done) {
+    const std::size_t origin = current_core();
+    if (origin >= shards.size()) {
+      log_error("offload() called from outside a core.");
+      return false;
+    }
+
+    submit([this, origin, work = std::move(work),
+            done = std::move(done)]() mutable {
+      if constexpr (std::is_void_v<decltype(work())>) {
+        work();
+        post(origin, std::move(done));
+      } else {
+        post(origin, [done = std::move(done), r = work()]() mutable {
+          done(std::move(r));
+        });
+      }
+    });
+    return true;
+  }
+
+  struct core {
+    reactor events;
+    mpsc_queue<job> inbox;
+    std::atomic<bool> notified = false;
+    std::thread thread;
+  };
+
+  struct worker {
+    work_stealing_deque<job *> jobs;
+    mpsc_queue<job *> inbox;
+    std::atomic<std::uint32_t> wakeups = 0;
+    std::atomic<bool> sleeping = false;
+    std::thread thread;
+  };
+
+  static std::size_t &current_core_ref() {
+    static thread_local std::size_t index = npos;
+    return index;
+  }
+  static std::size_t &current_worker_ref() {
+    static thread_local std::size_t index = npos;
+    return index;
+  }
+  // tells workers of two runtimes apart.
+  static runtime *&current_pool_ref() {
+    static thread_local runtime *owner = nullptr;
+    return owner;
+  }
+
+  void core_loop(const std::size_t i) {
+    current_core_ref() = i;
+    core &c = *shards[i];
+    while (running.load(std::memory_order_acquire)) {
+      // clear first, a post after this point wakes the next run_once.
+      c.notified.exchange(false, std::memory_order_acq_rel);
+      while (auto fn = c.inbox.pop())
+        (*fn)();
+
+      if (!c.inbox.empty())
+        continue;
+      if (c.events.run_once(-1) == -1)
+        break;
+    }
+    current_core_ref() = npos;
+  }
+
+  void worker_loop(const std::size_t i) {
+    current_worker_ref() = i;
+    current_pool_ref() = this;
+    worker &self = *pool[i];
+    std::minstd_rand victim(i + 1);
+
+    while (running.load(std::memory_order_acquire)) {
+      if (job *j = find(self, victim)) {
+        (*j)();
+        delete j;
+        continue;
+      }
+
+      // announce, then look once more: submit() stores the job before it
+      // checks sleeping, so one of the two sides always sees the other.
+      self.sleeping.store(true, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      const std::uint32_t seen = self.wakeups.load(std::memory_order_seq_cst);
+      job *j = find(self, victim);
+      if (j == nullptr && running.load(std::memory_order_acquire))
+        self.wakeups.wait(seen, std::memory_order_seq_cst);
+      self.sleeping.store(false, std::memory_order_relaxed);
+
+      if (j != nullptr) {
+        (*j)();
+        delete j;
+      }
+    }
+  }
+
+  job *find(worker &self, std::minstd_rand &victim) {
+    while (auto j = self.inbox.pop())
+      self.jobs.push(*j);
+    if (auto j = self.jobs.pop())
+      return *j;
+
+    if (pool.size() > 1)
+      for (int attempt = 0; attempt < steal_attempts; attempt++) {
+        worker &other = *pool[victim() % pool.size()];
+        if (&other == &self)
+          continue;
+        if (auto j = other.jobs.steal())
+          return *j;
+      }
+
+    return nullptr;
+  }
+
+  static void signal(worker &w) {
+    w.wakeups.fetch_add(1, std::memory_order_seq_cst);
+    if (w.sleeping.load(std::memory_order_seq_cst))
+      w.wakeups.notify_one();
+  }
+
+  std::atomic<bool> running = false;
+  std::atomic<std::size_t> next_worker = 0;
+  std::vector<std::unique_ptr<core>> shards;
+  std::vector<std::unique_ptr<worker>> pool;
+};
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef SHARDED_LISTENER_HPP
+#define SHARDED_LISTENER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+#include "endpoint.hpp"
+#include "io_result.hpp"
+#include "log.hpp"
+
+/*
+  One SO_REUSEPORT listening socket and one accept loop per worker thread.
+  The kernel hashes incoming connections across the sockets, so there is no
+  shared accept queue or lock between workers. Works with any socket that
+  has bind(ep, reuse_port)/listen/accept (tcp_socket, ssl_socket,
+  http_socket).
+
+  The handler runs on the worker thread that accepted the connection and
+  owns the client socket from then on. A shard that runs out of
+  descriptors or memory stops accepting for pause_ms, as acceptor does.
+ */
+template <typename Socket> struct sharded_listener {
+  using handler = std::function<void(Socket client, std::size_t shard)>;
+
+  static constexpr int pause_ms = 100;
+
+  sharded_listener() = default;
+  ~sharded_listener() { stop(); }
+
+  sharded_listener(const sharded_listener &) = delete;
+  sharded_listener &operator=(const sharded_listener &) = delete;
+
+  /*
+    shards == 0 means one per hardware thread. With pin_cpus, worker i is
+    pinned to cpu i % hardware threads.
+   */
+  bool start(const endpoint &ep, std::size_t shards, const int backlog,
+             handler fn, const bool pin_cpus = false) {
+    const std::size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    if (shards == 0)
+      shards = cpus;
+
+    // bind every shard before any accepts, so a failure leaves nothing half
+    // running.
+    listeners.resize(shards);
+    for (auto &listener : listeners) {
+      if (!listener.bind(ep, true) || !listener.listen(backlog)) {
+        log_error("Failed to open listener shard.");
+        listeners.clear();
+        return false;
+      }
+    }
+
+    stopping.store(false, std::memory_order_release);
+    for (std::size_t i = 0; i < shards; i++) {
+      workers.emplace_back([this, i, fn, pin_cpus, cpus] {
+        if (pin_cpus) {
+          cpu_set_t set;
+          CPU_ZERO(&set);
+          CPU_SET(i % cpus, &set);
+          pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        accept_loop(i, fn);
+      });
+    }
+
+    return true;
+  }
+
+  /*
+    Wakes every blocked accept, joins the workers and closes the listeners.
+   */
+  void stop() {
+    stopping.store(true, std::memory_order_release);
+    for (auto &listener : listeners)
+      ::shutdown(fd_of(listener), SHUT_RDWR);
+
+    join();
+
+    for (auto &listener : listeners)
+      listener.close();
+    listeners.clear();
+  }
+
+  void join() {
+    for (auto &worker : workers)
+      if (worker.joinable())
+        worker.join();
+    workers.clear();
+  }
+
+  std::size_t size() const { return listeners.size(); }
+
+  void accept_loop(const std::size_t shard, const handler &fn) {
+    Socket &listener = listeners[shard];
+    while (!stopping.load(std::memory_order_acquire)) {
+      Socket client = listener.accept();
+      if (fd_of(client) != -1) {
+        fn(std::move(client), shard);
+        continue;
+      }
+
+      // the same error would come straight back, give descriptors time
+      // to be freed instead of spinning.
+      const net_error &error = error_of(listener);
+      if (error.out_of_resources() &&
+          !stopping.load(std::memory_order_acquire)) {
+        log_warn("Accept paused: ", error.message());
+        pauses.fetch_add(1, std::memory_order_relaxed);
+        std::this_thread::sleep_for(std::chrono::milliseconds(pause_ms));
+      }
+    }
+  }
+
+  static int fd_of(const Socket &sock) {
+    if constexpr (requires { sock.sockfd; })
+      return sock.sockfd;
+    else
+      return sock.internal.sockfd;
+  }
+
+  static const net_error &error_of(const Socket &sock) {
+    if constexpr (requires { sock.last_error; })
+      return sock.last_error;
+    else
+      return sock.internal.last_error;
+  }
+
+  std::atomic<bool> stopping = false;
+  // accept pauses of all shards together.
+  std::atomic<std::uint64_t> pauses = 0;
+  std::vector<Socket> listeners;
+  std::vector<std::thread> workers;
+};
+
+#endif
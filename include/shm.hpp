@@ -0,0 +1,415 @@
+#ifndef SHM_HPP
+#define SHM_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <utility>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "deadline.hpp"
+#include "io_result.hpp"
+#include "log.hpp"
+
+/*
+  Shared-memory transport between two processes on one host, with the
+  send/receive/receive_into surface of tcp_socket. One memfd holds two
+  single-producer single-consumer byte rings, one per direction.
+
+  The creating process calls create() and hands memfd to its peer, either
+  by fork or with unix_socket::send_fds, and the peer calls attach().
+
+  Each side only touches the other's cache line to publish a new position.
+  A futex is only involved when a reader finds its ring empty, or a writer
+  finds it full, for longer than a short spin. The waiting side raises a
+  flag, and the other side issues the wake only when it sees that flag, so
+  a busy pipeline makes no system calls at all.
+ */
+struct shm_socket {
+  static constexpr std::size_t default_capacity = 1 << 20;
+  static constexpr std::uint64_t magic = 0x656e657473686d31; // "enetshm1"
+
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                std::atomic<std::uint32_t>::is_always_lock_free);
+
+  /*
+    Control block of one direction. Everything the producer checks on
+    every send sits on its own cache line next to head, the consumer's
+    flag included, and the other way around, so the lines only bounce
+    when a position is published or a side goes to sleep.
+   */
+  struct ring {
+    alignas(64) std::atomic<std::uint64_t> head;
+    std::atomic<std::uint32_t> data_seq;
+    std::atomic<std::uint32_t> consumer_waiting;
+    alignas(64) std::atomic<std::uint64_t> tail;
+    std::atomic<std::uint32_t> space_seq;
+    std::atomic<std::uint32_t> producer_waiting;
+  };
+
+  struct layout {
+    std::uint64_t magic;
+    std::uint64_t capacity;
+    alignas(64) std::atomic<std::uint32_t> closed;
+    ring rings[2];
+  };
+
+  static constexpr std::size_t data_offset = 4096;
+  static constexpr int spin_iterations = 2048;
+  static_assert(sizeof(layout) <= data_offset);
+
+  shm_socket() = default;
+
+  // close() unmaps the region, so only one object may own it.
+  shm_socket(const shm_socket &) = delete;
+  shm_socket &operator=(const shm_socket &) = delete;
+
+  shm_socket(shm_socket &&other) noexcept
+      : memfd(std::exchange(other.memfd, -1)), side(other.side),
+        shared(std::exchange(other.shared, nullptr)),
+        mapped(std::exchange(other.mapped, 0)) {}
+
+  shm_socket &operator=(shm_socket &&other) noexcept {
+    if (this != &other) {
+      close();
+      memfd = std::exchange(other.memfd, -1);
+      side = other.side;
+      shared = std::exchange(other.shared, nullptr);
+      mapped = std::exchange(other.mapped, 0);
+    }
+    return *this;
+  }
+
+  /*
+    Creates the region, capacity is rounded up to a power of two per
+    direction. The creator sends on ring 0 and receives on ring 1.
+   */
+  bool create(const std::size_t capacity = default_capacity) {
+    std::size_t cap = 4096;
+    while (cap < capacity)
+      cap <<= 1;
+
+    memfd = ::memfd_create("enet-shm", MFD_CLOEXEC);
+    if (memfd == -1) {
+      log_error("Failed to create memfd.");
+      return false;
+    }
+
+    if (::ftruncate(memfd, data_offset + 2 * cap) == -1 || !map()) {
+      log_error("Failed to size shared memory.");
+      close();
+      return false;
+    }
+
+    // a fresh memfd is zero filled, which is the empty state of both rings.
+    shared->capacity = cap;
+    shared->magic = magic;
+    side = 0;
+    return true;
+  }
+
+  /*
+    Maps a region made by create() in another process. Takes ownership of
+    fd. The header comes from the other process, its capacity is checked
+    against the mapping before any ring is touched.
+   */
+  bool attach(const int fd) {
+    memfd = fd;
+    if (!map() || shared->magic != magic || !fits(shared->capacity)) {
+      log_error("Not an enet shared memory region.");
+      close();
+      return false;
+    }
+
+    side = 1;
+    return true;
+  }
+
+  /*
+    Copies all of data into the ring, waiting for the peer to make room.
+    Returns the byte count, or -1 once the peer has closed.
+   */
+  template <typename Container> ssize_t send(const Container &data) {
+    if (shared == nullptr) {
+      log_error("Socket not connected.");
+      return -1;
+    }
+
+    ring &r = shared->rings[side];
+    std::byte *base = buffer(side);
+    const auto *bytes = reinterpret_cast<const std::byte *>(std::data(data));
+    const std::size_t len = std::size(data) * sizeof(*std::data(data));
+    const std::uint64_t cap = shared->capacity;
+    const deadline forever(-1);
+    std::size_t total = 0;
+    while (total < len) {
+      if (shared->closed.load(std::memory_order_acquire)) {
+        log_error("Failed to send data.");
+        return -1;
+      }
+
+      const std::uint64_t head = r.head.load(std::memory_order_relaxed);
+      const std::uint64_t room =
+          cap - (head - r.tail.load(std::memory_order_acquire));
+      if (room == 0) {
+        wait(r.producer_waiting, r.space_seq, forever, [&] {
+          return head - r.tail.load(std::memory_order_acquire) < cap ||
+                 shared->closed.load(std::memory_order_acquire);
+        });
+        continue;
+      }
+
+      const std::size_t n = std::min<std::size_t>(room, len - total);
+      copy_in(base, cap, head, bytes + total, n);
+      r.head.store(head + n, std::memory_order_release);
+      notify(r.consumer_waiting, r.data_seq);
+      total += n;
+    }
+
+    return total;
+  }
+
+  /*
+    Waits for data and returns what is there, up to the buffer size. 0
+    once the peer has closed and the ring is drained.
+   */
+  template <typename Container> ssize_t receive(Container &buffer) {
+    const io_result r = read(buffer, false, -1);
+    if (r.status == io_status::error) {
+      log_error("Failed to receive data.");
+      return -1;
+    }
+
+    return r.bytes;
+  }
+
+  /*
+    See tcp_socket::receive_exact.
+   */
+  template <typename Container>
+  io_result receive_exact(Container &buffer, const int timeout_ms = -1) {
+    return read(buffer, true, timeout_ms);
+  }
+
+  template <typename Container>
+  ssize_t receive_some(Container &buffer, const int timeout_ms = -1) {
+    return receive_exact(buffer, timeout_ms).bytes;
+  }
+
+  /*
+    Receive exactly this object.
+   */
+  template <typename T>
+  ssize_t receive_into(T &obj, const int timeout_ms = -1) {
+    union var {
+      T obj;
+      std::array<std::byte, sizeof(T)> bytes;
+    };
+
+    var v;
+    const io_result r = receive_exact(v.bytes, timeout_ms);
+    if (r.ok())
+      obj = v.obj;
+    return r.bytes;
+  }
+
+  /*
+    Marks the connection closed for both sides, wakes any waiter and
+    unmaps the region.
+   */
+  void close() {
+    if (shared != nullptr) {
+      shared->closed.store(1, std::memory_order_release);
+      for (auto &r : shared->rings) {
+        r.data_seq.fetch_add(1);
+        r.space_seq.fetch_add(1);
+        futex(r.data_seq, FUTEX_WAKE, INT32_MAX, nullptr);
+        futex(r.space_seq, FUTEX_WAKE, INT32_MAX, nullptr);
+      }
+
+      ::munmap(shared, mapped);
+      shared = nullptr;
+    }
+
+    if (memfd != -1) {
+      ::close(memfd);
+      memfd = -1;
+    }
+  }
+
+  bool map() {
+    struct stat st;
+    if (::fstat(memfd, &st) == -1 ||
+        static_cast<std::size_t>(st.st_size) <= data_offset)
+      return false;
+
+    void *addr = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, memfd, 0);
+    if (addr == MAP_FAILED)
+      return false;
+
+    shared = static_cast<layout *>(addr);
+    mapped = st.st_size;
+    return true;
+  }
+
+  // both rings of a power of two capacity lie inside the mapping.
+  bool fits(const std::uint64_t cap) const {
+    return cap != 0 && (cap & (cap - 1)) == 0 &&
+           cap <= (mapped - data_offset) / 2;
+  }
+
+  std::byte *buffer(const int direction) const {
+    return reinterpret_cast<std::byte *>(shared) + data_offset +
+           direction * shared->capacity;
+  }
+
+  /*
+    With exact, keeps reading until buffer is full, otherwise returns as
+    soon as anything was read.
+   */
+  template <typename Container>
+  io_result read(Container &buffer_out, const bool exact,
+                 const int timeout_ms) {
+    if (shared == nullptr)
+      return {-1, io_status::error};
+
+    ring &r = shared->rings[1 - side];
+    const std::byte *base = buffer(1 - side);
+    auto *bytes = reinterpret_cast<std::byte *>(std::data(buffer_out));
+    const std::size_t len = std::size(buffer_out) * sizeof(*std::data(buffer_out));
+    const std::uint64_t cap = shared->capacity;
+    const deadline until(timeout_ms);
+    std::size_t total = 0;
+    while (total < len) {
+      const std::uint64_t tail = r.tail.load(std::memory_order_relaxed);
+      const std::uint64_t available =
+          r.head.load(std::memory_order_acquire) - tail;
+      if (available == 0) {
+        if (total > 0 && !exact)
+          break;
+        if (shared->closed.load(std::memory_order_acquire))
+          return {static_cast<ssize_t>(total), io_status::eof};
+
+        const io_status s =
+            wait(r.consumer_waiting, r.data_seq, until, [&] {
+              return r.head.load(std::memory_order_acquire) != tail ||
+                     shared->closed.load(std::memory_order_acquire);
+            });
+        if (s != io_status::ok)
+          return {static_cast<ssize_t>(total), s};
+        continue;
+      }
+
+      const std::size_t n = std::min<std::size_t>(available, len - total);
+      copy_out(base, cap, tail, bytes + total, n);
+      r.tail.store(tail + n, std::memory_order_release);
+      notify(r.producer_waiting, r.space_seq);
+      total += n;
+    }
+
+    return {static_cast<ssize_t>(total), io_status::ok};
+  }
+
+  static void copy_in(std::byte *base, const std::uint64_t cap,
+                      const std::uint64_t pos, const std::byte *src,
+                      const std::size_t n) {
+    const std::size_t offset = pos & (cap - 1);
+    const std::size_t first = std::min<std::size_t>(n, cap - offset);
+    std::memcpy(base + offset, src, first);
+    std::memcpy(base, src + first, n - first);
+  }
+
+  static void copy_out(const std::byte *base, const std::uint64_t cap,
+                       const std::uint64_t pos, std::byte *dst,
+                       const std::size_t n) {
+    const std::size_t offset = pos & (cap - 1);
+    const std::size_t first = std::min<std::size_t>(n, cap - offset);
+    std::memcpy(dst, base + offset, first);
+    std::memcpy(dst + first, base, n - first);
+  }
+
+  /*
+    Sleeps on seq until ready() holds. The flag is raised before ready()
+    is checked again, and notify() stores before it checks the flag, so
+    with both fences one of the two sides always sees the other.
+   */
+  template <typename Ready>
+  static io_status wait(std::atomic<std::uint32_t> &waiting,
+                        std::atomic<std::uint32_t> &seq, const deadline &until,
+                        Ready ready) {
+    // the peer is usually mid-copy, a short spin saves two system calls.
+    // On a single cpu the peer cannot make progress while we spin.
+    static const int spins =
+        std::thread::hardware_concurrency() > 1 ? spin_iterations : 0;
+    for (int i = 0; i < spins; i++) {
+      if (ready())
+        return io_status::ok;
+      cpu_relax();
+    }
+
+    waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const std::uint32_t observed = seq.load();
+
+    io_status status = io_status::ok;
+    if (!ready()) {
+      if (until.expired()) {
+        status = io_status::timeout;
+      } else if (until.forever) {
+        futex(seq, FUTEX_WAIT, observed, nullptr);
+      } else {
+        const int ms = until.remaining_ms();
+        timespec ts{ms / 1000, (ms % 1000) * 1000000L};
+        if (futex(seq, FUTEX_WAIT, observed, &ts) == -1 && errno == ETIMEDOUT)
+          status = io_status::timeout;
+      }
+    }
+
+    waiting.store(0, std::memory_order_relaxed);
+    return status;
+  }
+
+  static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+  }
+
+  static void notify(std::atomic<std::uint32_t> &waiting,
+                     std::atomic<std::uint32_t> &seq) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) == 0)
+      return;
+
+    seq.fetch_add(1);
+    futex(seq, FUTEX_WAKE, 1, nullptr);
+  }
+
+  // shared (not private) futexes, the words live in memory of two processes.
+  static long futex(std::atomic<std::uint32_t> &word, const int op,
+                    const std::uint32_t value, const timespec *timeout) {
+    return ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), op,
+                     value, timeout, nullptr, 0);
+  }
+
+  int memfd = -1;
+  int side = 0;
+  layout *shared = nullptr;
+  std::size_t mapped = 0;
+};
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef SIMD_SCAN_HPP
+#define SIMD_SCAN_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ENET_SIMD_X86 1
+#endif
+
+/*
+  Byte class scans for the HTTP parser, 16 or 32 bytes per step. Each
+  returns how many leading bytes belong to the class, so the parser can
+  skip a run and handle only the byte that ends it:
+
+    value  - field-value and reason-phrase bytes, stops at CR, LF and
+             other controls except HT
+    token  - tchar (RFC 9110), a header name stops at ':' or junk
+    target - request-target bytes, stops at SP and controls
+
+  The AVX2, SSE4.2 or scalar versions are picked once at runtime from
+  what the CPU supports, independent of -march, so one binary runs
+  everywhere.
+ */
+struct simd_scan {
+  using scanner = std::size_t (*)(const char *, std::size_t);
+
+  struct table {
+    scanner value;
+    scanner token;
+    scanner target;
+    const char *name;
+  };
+
+  static std::size_t value(const char *p, const std::size_t n) {
+    return impl().value(p, n);
+  }
+  static std::size_t token(const char *p, const std::size_t n) {
+    return impl().token(p, n);
+  }
+  static std::size_t target(const char *p, const std::size_t n) {
+    return impl().target(p, n);
+  }
+
+  static const table &impl() {
+    static const table chosen = pick();
+    return chosen;
+  }
+
+  static table pick() {
+#ifdef ENET_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return {value_avx2, token_avx2, target_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse4.2"))
+      return {value_sse42, token_sse42, target_sse42, "sse4.2"};
+#endif
+    return scalar();
+  }
+
+  static table scalar() {
+    return {value_scalar, token_scalar, target_scalar, "scalar"};
+  }
+
+  static constexpr bool is_value(const unsigned char c) {
+    return (c >= ' ' || c == '\t') && c != 0x7f;
+  }
+  static constexpr bool is_target(const unsigned char c) {
+    return c > ' ' && c != 0x7f;
+  }
+
+  static constexpr std::array<bool, 256> token_table = [] {
+    std::array<bool, 256> t{};
+    for (int c = '0'; c <= '9'; c++)
+      t[c] = true;
+    for (int c = 'a'; c <= 'z'; c++)
+      t[c] = t[c - 'a' + 'A'] = true;
+    for (const char c : std::string_view("!#$%&'*+-.^_`|~"))
+      t[static_cast<unsigned char>(c)] = true;
+    return t;
+  }();
+
+  static constexpr bool is_token(const unsigned char c) {
+    return token_table[c];
+  }
+
+  static std::size_t value_scalar(const char *p, const std::size_t n) {
+    std::size_t i = 0;
+    while (i < n && is_value(p[i]))
+      i++;
+    return i;
+  }
+  static std::size_t token_scalar(const char *p, const std::size_t n) {
+    std::size_t i = 0;
+    while (i < n && is_token(p[i]))
+      i++;
+    return i;
+  }
+  static std::size_t target_scalar(const char *p, const std::size_t n) {
+    std::size_t i = 0;
+    while (i < n && is_target(p[i]))
+      i++;
+    return i;
+  }
+
+  /*
+    tchar as a nibble lookup: bit h of low[l] is set when byte h * 16 + l
+    is a tchar. high[h] selects bit h, bytes from 0x80 up select none.
+   */
+  static constexpr std::array<std::uint8_t, 16> token_low = [] {
+    std::array<std::uint8_t, 16> t{};
+    for (int c = 0; c < 0x80; c++)
+      if (token_table[c])
+        t[c & 0xf] |= 1 << (c >> 4);
+    return t;
+  }();
+  static constexpr std::array<std::uint8_t, 16> token_high = {
+      1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0};
+
+#ifdef ENET_SIMD_X86
+  __attribute__((target("sse4.2"))) static std::size_t
+  value_sse42(const char *p, const std::size_t n) {
+    // everything below SP except HT, and DEL.
+    const __m128i ranges = _mm_setr_epi8(0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f, 0,
+                                         0, 0, 0, 0, 0, 0, 0, 0, 0);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+      const int at = _mm_cmpestri(ranges, 6, v, 16,
+                                  _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                                      _SIDD_LEAST_SIGNIFICANT);
+      if (at != 16)
+        return i + at;
+    }
+    return i + value_scalar(p + i, n - i);
+  }
+
+  __attribute__((target("sse4.2"))) static std::size_t
+  token_sse42(const char *p, const std::size_t n) {
+    const __m128i low = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(std::data(token_low)));
+    const __m128i high = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(std::data(token_high)));
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+      const __m128i l = _mm_shuffle_epi8(low, _mm_and_si128(v, nibble));
+      const __m128i h = _mm_shuffle_epi8(
+          high, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+      const __m128i outside =
+          _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128());
+      if (const int mask = _mm_movemask_epi8(outside))
+        return i + __builtin_ctz(mask);
+    }
+    return i + token_scalar(p + i, n - i);
+  }
+
+  __attribute__((target("sse4.2"))) static std::size_t
+  target_sse42(const char *p, const std::size_t n) {
+    const __m128i ranges = _mm_setr_epi8(0x00, 0x20, 0x7f, 0x7f, 0, 0, 0, 0, 0,
+                                         0, 0, 0, 0, 0, 0, 0);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+      const int at = _mm_cmpestri(ranges, 4, v, 16,
+                                  _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
+                                      _SIDD_LEAST_SIGNIFICANT);
+      if (at != 16)
+        return i + at;
+    }
+    return i + target_scalar(p + i, n - i);
+  }
+
+  /*
+    Bytes 0x00 to limit - 1, compared signed so 0x80 and up stay out.
+   */
+  __attribute__((target("avx2"))) static __m256i below(const __m256i v,
+                                                       const char limit) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(limit), v),
+                            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(-1)));
+  }
+
+  __attribute__((target("avx2"))) static std::size_t
+  value_avx2(const char *p, const std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      const __m256i v =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+      const __m256i ctl = _mm256_andnot_si256(
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')), below(v, ' '));
+      const __m256i stop =
+          _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+      if (const unsigned mask = _mm256_movemask_epi8(stop))
+        return i + __builtin_ctz(mask);
+    }
+    return i + value_scalar(p + i, n - i);
+  }
+
+  __attribute__((target("avx2"))) static std::size_t
+  token_avx2(const char *p, const std::size_t n) {
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(std::data(token_low))));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(std::data(token_high))));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      const __m256i v =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+      const __m256i l = _mm256_shuffle_epi8(low, _mm256_and_si256(v, nibble));
+      const __m256i h = _mm256_shuffle_epi8(
+          high, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+      const __m256i outside =
+          _mm256_cmpeq_epi8(_mm256_and_si256(l, h), _mm256_setzero_si256());
+      if (const unsigned mask = _mm256_movemask_epi8(outside))
+        return i + __builtin_ctz(mask);
+    }
+    return i + token_scalar(p + i, n - i);
+  }
+
+  __attribute__((target("avx2"))) static std::size_t
+  target_avx2(const char *p, const std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      const __m256i v =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+      const __m256i stop = _mm256_or_si256(
+          below(v, ' ' + 1), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+      if (const unsigned mask = _mm256_movemask_epi8(stop))
+        return i + __builtin_ctz(mask);
+    }
+    return i + target_scalar(p + i, n - i);
+  }
+#endif
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef SOCKET_PROFILE_HPP
+#define SOCKET_PROFILE_HPP
+
+#include <optional>
+#include <string>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "log.hpp"
+
+/*
+  Declarative set of socket options. tcp_socket, udp_socket and ssl_socket
+  carry one as their profile member and apply it whenever they create or
+  accept a descriptor, so callers pick a preset instead of calling
+  setsockopt on sockfd by hand:
+
+    tcp_socket sock;
+    sock.profile = socket_profile::low_latency();
+    sock.connect(endpoints);
+
+  Unset options keep the kernel default. TCP-only options are skipped on
+  datagram sockets.
+ */
+struct socket_profile {
+  /*
+    When apply() runs: on a socket about to bind (and listen), one about to
+    connect, or one just returned by accept.
+   */
+  enum class stage { bind, connect, accept };
+
+  std::optional<bool> nodelay;
+  std::optional<bool> cork;
+  std::optional<bool> quickack;
+  std::optional<int> notsent_lowat;
+  // microseconds, raising it above net.core.busy_read needs CAP_NET_ADMIN.
+  std::optional<int> busy_poll;
+  // fixed buffers switch off the kernel's autotuning and are capped at
+  // net.core.rmem_max/wmem_max.
+  std::optional<int> rcvbuf;
+  std::optional<int> sndbuf;
+  std::string congestion;
+  // pending SYN queue length on listeners, TCP_FASTOPEN_CONNECT on clients.
+  std::optional<int> fastopen;
+
+  /*
+    Request/response traffic: no Nagle delay, immediate ACKs, and only a
+    small amount of unsent data queued in the kernel, so the newest write
+    leaves first.
+   */
+  static socket_profile low_latency() {
+    socket_profile p;
+    p.nodelay = true;
+    p.quickack = true;
+    p.notsent_lowat = 16384;
+    p.fastopen = 256;
+    return p;
+  }
+
+  /*
+    Transfers: Nagle left on so full segments go out, and large buffers
+    to cover the bandwidth-delay product.
+   */
+  static socket_profile bulk() {
+    socket_profile p;
+    p.nodelay = false;
+    p.rcvbuf = 4 * 1024 * 1024;
+    p.sndbuf = 4 * 1024 * 1024;
+    return p;
+  }
+
+  bool empty() const {
+    return !nodelay && !cork && !quickack && !notsent_lowat && !busy_poll &&
+           !rcvbuf && !sndbuf && congestion.empty() && !fastopen;
+  }
+
+  /*
+    Sets every option relevant to this stage. A failing option is logged
+    and the rest are still applied, returns false if any failed.
+   */
+  bool apply(const int fd, const stage when) const {
+    if (fd == -1 || empty())
+      return true;
+
+    int protocol = 0;
+    socklen_t len = sizeof(protocol);
+    getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &len);
+    const bool tcp = protocol == IPPROTO_TCP;
+
+    bool ok = true;
+    ok &= set(fd, SOL_SOCKET, SO_RCVBUF, rcvbuf, "SO_RCVBUF");
+    ok &= set(fd, SOL_SOCKET, SO_SNDBUF, sndbuf, "SO_SNDBUF");
+    ok &= set(fd, SOL_SOCKET, SO_BUSY_POLL, busy_poll, "SO_BUSY_POLL");
+    if (!tcp)
+      return ok;
+
+    ok &= set(fd, IPPROTO_TCP, TCP_NODELAY, nodelay, "TCP_NODELAY");
+    ok &= set(fd, IPPROTO_TCP, TCP_CORK, cork, "TCP_CORK");
+    ok &= set(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, notsent_lowat,
+              "TCP_NOTSENT_LOWAT");
+    // not sticky and meaningless on a listener.
+    if (when != stage::bind)
+      ok &= set(fd, IPPROTO_TCP, TCP_QUICKACK, quickack, "TCP_QUICKACK");
+
+    if (!congestion.empty() &&
+        setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, congestion.c_str(),
+                   congestion.size()) < 0) {
+      log_error("Failed to set TCP_CONGESTION ", congestion, ".");
+      ok = false;
+    }
+
+    if (when == stage::bind)
+      ok &= set(fd, IPPROTO_TCP, TCP_FASTOPEN, fastopen, "TCP_FASTOPEN");
+    else if (when == stage::connect && fastopen)
+      ok &= set(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                std::optional<int>(*fastopen > 0), "TCP_FASTOPEN_CONNECT");
+
+    return ok;
+  }
+
+  template <typename T>
+  static bool set(const int fd, const int level, const int name,
+                  const std::optional<T> &value, const char *what) {
+    if (!value)
+      return true;
+
+    const int v = *value;
+    if (setsockopt(fd, level, name, &v, sizeof(v)) < 0) {
+      log_error("Failed to set ", what, ".");
+      return false;
+    }
+
+    return true;
+  }
+};
+
+#endif
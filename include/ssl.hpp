@@ -2,10 +2,10 @@
 #define SSL_HPP
 
 #include <array>
+#include <cerrno>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
-#include <iostream>
 #include <openssl/rsa.h>
 #include <string>
 #include <string_view>
@@ -21,19 +21,28 @@
 #include <ws2sslip.h>
 #else
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #endif
 
+#include "buffer_pool.hpp"
+#include "connector.hpp"
+#include "deadline.hpp"
 #include "endpoint.hpp"
+#include "io_result.hpp"
+#include "log.hpp"
+#include "socket_profile.hpp"
+#include "resolver.hpp"
 
 struct ssl_resolver {
   ssl_resolver() {
 #ifdef _WIN32
     WSADATA wsData;
     if (WSAStartup(MAKEWORD(2, 2), &wsData) != 0) {
-      std::cerr << "Failed to initialize winsock." << std::endl;
+      log_error("Failed to initialize winsock.");
     }
 #endif
   }
@@ -46,26 +55,7 @@ struct ssl_resolver {
 
   std::vector<endpoint> resolve(const std::string &host,
                                 const std::string &service) {
-    struct addrinfo hints, *res;
-    int status;
-
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;     // IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM; // TCP socket
-
-    std::vector<endpoint> endpoints;
-    if ((status = getaddrinfo(host.c_str(), service.c_str(), &hints, &res)) !=
-        0) {
-      std::cerr << "getaddrinfo error: " << gai_strerror(status) << std::endl;
-      return endpoints;
-    }
-
-    for (struct addrinfo *p = res; p != nullptr; p = p->ai_next) {
-      endpoints.emplace_back(*p);
-    }
-
-    freeaddrinfo(res);
-    return endpoints;
+    return dns_resolver::shared().resolve(host, service, SOCK_STREAM);
   }
 };
 
@@ -73,19 +63,32 @@ struct ssl_socket {
   int sockfd;
   SSL *ssl;
   SSL_CTX *ssl_ctx;
+  socket_profile profile;
+  net_error last_error;
 
   ssl_socket() : sockfd(-1), ssl(nullptr), ssl_ctx(nullptr) {}
 
-  bool bind(const endpoint ep) {
-    sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  // reuse_port as in tcp_socket::bind.
+  bool bind(const endpoint ep, const bool reuse_port = false) {
+    sockfd = socket(ep.addr.sa_family, SOCK_STREAM, IPPROTO_TCP);
     if (sockfd == -1) {
-      std::cerr << "Failed to create socket." << std::endl;
+      log_failure(last_error, "Failed to create socket.");
+      return false;
+    }
+
+    profile.apply(sockfd, socket_profile::stage::bind);
+
+    const int on = 1;
+    if (reuse_port &&
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+      log_failure(last_error, "Failed to set SO_REUSEPORT.");
+      close();
       return false;
     }
 
     if (::bind(sockfd, reinterpret_cast<const sockaddr *>(&ep.addr),
-               sizeof(ep.addr)) < 0) {
-      std::cerr << "Bind failed." << std::endl;
+               ep.addrlen) < 0) {
+      log_failure(last_error, "Bind failed.");
       close();
       return false;
     }
@@ -95,7 +98,7 @@ struct ssl_socket {
 
   bool listen(const int max_incoming_connections) {
     if (::listen(sockfd, max_incoming_connections) == -1) {
-      std::cerr << "Listen Failed" << std::endl;
+      log_failure(last_error, "Listen Failed");
       close();
       return false;
     }
@@ -107,13 +110,11 @@ struct ssl_socket {
     EVP_PKEY_CTX *pkey_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
     if (!pkey_ctx || EVP_PKEY_keygen_init(pkey_ctx) <= 0 ||
         EVP_PKEY_CTX_set_rsa_keygen_bits(pkey_ctx, 2048) <= 0) {
-      std::cerr
-          << "EVP_PKEY_keygen_init or EVP_PKEY_CTX_set_rsa_keygen_bits error"
-          << std::endl;
+      log_error("EVP_PKEY_keygen_init or EVP_PKEY_CTX_set_rsa_keygen_bits error");
     }
 
     if (EVP_PKEY_keygen(pkey_ctx, &key) <= 0) {
-      std::cerr << "EVP_PKEY_keygen error" << std::endl;
+      log_error("EVP_PKEY_keygen error");
     }
 
     EVP_PKEY_CTX_free(pkey_ctx);
@@ -134,13 +135,12 @@ struct ssl_socket {
     X509_set_issuer_name(x509, name);
 
     if (X509_sign(x509, key, EVP_sha256()) == 0) {
-      std::cerr << "x509 signing error" << std::endl;
+      log_error("x509 signing error");
     }
 
     if (SSL_CTX_use_certificate(ssl_ctx, x509) <= 0 ||
         SSL_CTX_use_PrivateKey(ssl_ctx, key) <= 0) {
-      std::cerr << "SSL_CTX_use_certificate or SSL_CTX_use_PrivateKey error"
-                << std::endl;
+      log_error("SSL_CTX_use_certificate or SSL_CTX_use_PrivateKey error");
     }
 
     X509_free(x509);
@@ -150,19 +150,23 @@ struct ssl_socket {
   }
 
   ssl_socket accept() {
-    sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
     ssl_socket client_socket;
-    client_socket.sockfd =
-        ::accept(sockfd, (sockaddr *)&client_addr, &client_len);
+    do {
+      client_socket.sockfd = ::accept4(sockfd, nullptr, nullptr, SOCK_CLOEXEC);
+    } while (client_socket.sockfd == -1 && errno == EINTR);
     if (client_socket.sockfd == -1) {
-      std::cerr << "Accept failed" << std::endl;
+      log_failure(last_error, "Accept failed");
+      return client_socket;
     }
 
+    client_socket.profile = profile;
+    profile.apply(client_socket.sockfd, socket_profile::stage::accept);
     client_socket.ssl = SSL_new(ssl_ctx);
     SSL_set_fd(client_socket.ssl, client_socket.sockfd);
-    if (SSL_accept(client_socket.ssl) <= 0) {
-      std::cerr << "SSL_accept error" << std::endl;
+    const int accepted = SSL_accept(client_socket.ssl);
+    if (accepted <= 0) {
+      log_failure(last_error, "SSL_accept error",
+                  SSL_get_error(client_socket.ssl, accepted), error_domain::ssl);
       client_socket.close();
     }
 
@@ -171,43 +175,72 @@ struct ssl_socket {
 
   bool connect(const endpoint ep) {
     if (sockfd != -1) {
-      std::cerr << "Socket is already connected." << std::endl;
+      log_failure(last_error, "Socket is already connected.", EISCONN);
       return false;
     }
 
-    sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockfd = socket(ep.addr.sa_family, SOCK_STREAM, IPPROTO_TCP);
     if (sockfd == -1) {
-      std::cerr << "Failed to create socket." << std::endl;
+      log_failure(last_error, "Failed to create socket.");
       return false;
     }
 
+    profile.apply(sockfd, socket_profile::stage::connect);
+
     if (::connect(sockfd, reinterpret_cast<const sockaddr *>(&ep.addr),
-                  sizeof(ep.addr)) < 0) {
-      std::cerr << "Connection failed." << std::endl;
+                  ep.addrlen) < 0) {
+      log_failure(last_error, "Connection failed.");
       close();
       return false;
     }
 
     // Initiate ssl part
+    init_client();
+    SSL_connect(ssl);
+
+    return true;
+  }
+
+  // see tcp_socket::connect.
+  bool connect(const std::vector<endpoint> &endpoints,
+               const int timeout_ms = connector::default_timeout_ms) {
+    if (sockfd != -1) {
+      log_failure(last_error, "Socket is already connected.", EISCONN);
+      return false;
+    }
+
+    sockfd = connector::connect(endpoints, timeout_ms, profile);
+    if (sockfd == -1)
+      return false;
+
+    init_client();
+    SSL_connect(ssl);
+
+    return true;
+  }
 
+  /*
+    Wraps the already connected sockfd in a client side TLS session. The
+    handshake itself happens in SSL_connect or try_handshake.
+   */
+  void init_client() {
     SSL_library_init();
     ssl_ctx = SSL_CTX_new(SSLv23_client_method());
     ssl = SSL_new(ssl_ctx);
     SSL_set_fd(ssl, sockfd);
-    SSL_connect(ssl);
-
-    return true;
+    SSL_set_connect_state(ssl);
   }
 
   template <typename Container> ssize_t send(const Container &data) {
     if (sockfd == -1) {
-      std::cerr << "Socket not connected." << std::endl;
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
       return -1;
     }
 
     ssize_t bytes_sent = SSL_write(ssl, std::data(data), std::size(data));
     if (bytes_sent == -1) {
-      std::cerr << "Failed to send data." << std::endl;
+      log_failure(last_error, "Failed to send data.",
+                  SSL_get_error(ssl, bytes_sent), error_domain::ssl);
       return -1;
     }
 
@@ -216,55 +249,205 @@ struct ssl_socket {
 
   template <typename Container> ssize_t receive(Container &buffer) {
     if (sockfd == -1) {
-      std::cerr << "Socket not connected." << std::endl;
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
       return -1;
     }
 
     ssize_t bytes = SSL_read(ssl, std::data(buffer), std::size(buffer) - 1);
-    buffer[bytes] = '\0';
-    if (bytes == -1) {
-      std::cerr << "Failed to receive data." << std::endl;
+    if (bytes < 0) {
+      log_failure(last_error, "Failed to receive data.",
+                  SSL_get_error(ssl, bytes), error_domain::ssl);
       return -1;
     }
 
+    // terminated for char buffers, works for byte buffers (buffer_chain).
+    std::data(buffer)[bytes] = {};
     return bytes;
   }
 
-  template <typename Container> ssize_t receive_some(Container &buffer) {
-    size_t total_bytes_read = 0;
-    while (total_bytes_read < std::size(buffer)) {
-      if (sockfd == -1) {
-        std::cerr << "Socket not connected." << std::endl;
-        return -1;
+  /*
+    See tcp_socket::receive_exact. With a timeout, poll runs whenever
+    OpenSSL has no decrypted bytes buffered, a record that arrives only in
+    part can still hold SSL_read past the deadline on a blocking socket.
+   */
+  template <typename Container>
+  io_result receive_exact(Container &buffer, const int timeout_ms = -1) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return {-1, io_status::error};
+    }
+
+    auto *bytes = reinterpret_cast<char *>(std::data(buffer));
+    const std::size_t len = std::size(buffer) * sizeof(*std::data(buffer));
+    const deadline until(timeout_ms);
+    std::size_t total = 0;
+    while (total < len) {
+      if (!until.forever && SSL_pending(ssl) == 0) {
+        const io_status ready = wait_for(sockfd, POLLIN, until);
+        if (ready != io_status::ok)
+          return {static_cast<ssize_t>(total), ready};
+      }
+
+      const int bytes_read = SSL_read(ssl, bytes + total, len - total);
+      if (bytes_read > 0) {
+        total += bytes_read;
+        continue;
+      }
+
+      const io_status status = ssl_status(bytes_read);
+      if (status == io_status::eof)
+        return {static_cast<ssize_t>(total), status};
+      if (status != io_status::would_block) {
+        log_failure(last_error, "Failed to receive data.",
+                    SSL_get_error(ssl, bytes_read), error_domain::ssl);
+        return {-1, io_status::error};
       }
 
-      const auto begin =
-          std::addressof(*(std::begin(buffer) + total_bytes_read));
-      const std::size_t left = std::size(buffer) - total_bytes_read;
-      ssize_t bytes_read = SSL_read(ssl, begin, left);
-      if (bytes_read == -1) {
-        std::cerr << "Failed to receive data." << std::endl;
-        return -1;
-      } else if (bytes_read > 0)
-        total_bytes_read += bytes_read;
+      const io_status ready =
+          wait_for(sockfd, wants_write() ? POLLOUT : POLLIN, until);
+      if (ready != io_status::ok)
+        return {static_cast<ssize_t>(total), ready};
     }
 
-    return total_bytes_read;
+    return {static_cast<ssize_t>(total), io_status::ok};
+  }
+
+  template <typename Container>
+  ssize_t receive_some(Container &buffer, const int timeout_ms = -1) {
+    return receive_exact(buffer, timeout_ms).bytes;
   }
 
   /*
     Receive exactly this object.
    */
-  template <typename T> ssize_t receive_into(T &obj) {
+  template <typename T>
+  ssize_t receive_into(T &obj, const int timeout_ms = -1) {
     union var {
       T obj;
       std::array<std::byte, sizeof(T)> bytes;
     };
 
     var v;
-    ssize_t len = receive_some(v.bytes);
-    obj = v.obj;
-    return len;
+    const io_result r = receive_exact(v.bytes, timeout_ms);
+    if (r.ok())
+      obj = v.obj;
+    return r.bytes;
+  }
+
+  bool set_nonblocking(const bool enable = true) {
+#ifdef _WIN32
+    u_long mode = enable ? 1 : 0;
+    return ioctlsocket(sockfd, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags == -1)
+      return false;
+
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(sockfd, F_SETFL, flags) != -1;
+#endif
+  }
+
+  /*
+    Non-blocking variants. A TLS record may need the socket to become
+    writable to make progress on a read (and the other way around), so
+    would_block here means "wait for either direction". try_accept only
+    accepts the tcp connection, the handshake is driven by try_handshake or
+    implicitly by the first try_send/try_receive. from is as in
+    tcp_socket::try_accept.
+   */
+  io_status try_accept(ssl_socket &client, endpoint *from = nullptr) {
+    sockaddr *addr = nullptr;
+    socklen_t *addrlen = nullptr;
+    if (from != nullptr) {
+      from->addrlen = sizeof(from->storage);
+      addr = &from->addr;
+      addrlen = &from->addrlen;
+    }
+
+    int fd;
+    do {
+      fd = ::accept4(sockfd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    } while (fd == -1 && errno == EINTR);
+
+    if (fd == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return io_status::would_block;
+      last_error = {errno, error_domain::system};
+      return io_status::error;
+    }
+
+    if (from != nullptr)
+      from->family = from->addr.sa_family;
+    client.sockfd = fd;
+    client.profile = profile;
+    profile.apply(fd, socket_profile::stage::accept);
+    client.ssl = SSL_new(ssl_ctx);
+    SSL_set_fd(client.ssl, fd);
+    SSL_set_accept_state(client.ssl);
+    return io_status::ok;
+  }
+
+  io_status try_handshake() {
+    const int rc = SSL_do_handshake(ssl);
+    if (rc == 1)
+      return io_status::ok;
+    return ssl_status(rc);
+  }
+
+  template <typename Container> io_result try_send(const Container &data) {
+    const int bytes_sent = SSL_write(ssl, std::data(data), std::size(data));
+    if (bytes_sent > 0)
+      return {bytes_sent, io_status::ok};
+
+    const io_status status = ssl_status(bytes_sent);
+    return {status == io_status::error ? -1 : 0, status};
+  }
+
+  template <typename Container> io_result try_receive(Container &buffer) {
+    const int bytes_read = SSL_read(ssl, std::data(buffer), std::size(buffer));
+    if (bytes_read > 0)
+      return {bytes_read, io_status::ok};
+
+    const io_status status = ssl_status(bytes_read);
+    return {status == io_status::error ? -1 : 0, status};
+  }
+
+  // after would_block, whether TLS is waiting for the socket to be writable.
+  bool wants_write() const { return SSL_want_write(ssl); }
+
+  /*
+    A peer that closes without close_notify shows up as SSL_ERROR_SYSCALL
+    with an empty error queue (OpenSSL 1.1) or as an SSL_ERROR_SSL
+    "unexpected eof" (3.0). Both end the stream like a plain tcp close.
+   */
+  io_status ssl_status(const int rc) {
+    const int error = SSL_get_error(ssl, rc);
+    switch (error) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      return io_status::would_block;
+    case SSL_ERROR_ZERO_RETURN:
+      return io_status::eof;
+    case SSL_ERROR_SYSCALL:
+      if (ERR_peek_error() == 0 && (rc == 0 || errno == 0))
+        return io_status::eof;
+      break;
+#ifdef SSL_R_UNEXPECTED_EOF_WHILE_READING
+    case SSL_ERROR_SSL:
+      if (ERR_GET_REASON(ERR_peek_error()) ==
+          SSL_R_UNEXPECTED_EOF_WHILE_READING) {
+        ERR_clear_error();
+        return io_status::eof;
+      }
+      break;
+#endif
+    default:
+      break;
+    }
+
+    last_error = {error, error_domain::ssl};
+    return io_status::error;
   }
 
   void close() {
@@ -272,10 +455,12 @@ struct ssl_socket {
     if (ssl) {
       SSL_shutdown(ssl);
       SSL_free(ssl);
+      ssl = nullptr;
     }
 
     if (ssl_ctx) {
       SSL_CTX_free(ssl_ctx);
+      ssl_ctx = nullptr;
     }
 
     EVP_cleanup();
@@ -298,15 +483,13 @@ inline ssl_socket &operator<<(ssl_socket &sock, const std::string &data) {
   return sock;
 }
 
+/*
+  Reads until the peer closes, into pooled blocks, then copies into data
+  a chain's limit at a time.
+ */
 inline ssl_socket &operator>>(ssl_socket &sock, std::string &data) {
-  std::array<char, 4096> receive_buffer;
-
-  std::size_t bytes = 0;
-  do {
-    bytes = sock.receive(receive_buffer);
-    data.append(receive_buffer.data(), bytes);
-  } while (bytes > 0);
-
+  buffer_chain received;
+  received.receive_all(sock, data);
   return sock;
 }
 
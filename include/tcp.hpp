@@ -1,12 +1,16 @@
 #ifndef TCP_HPP
 #define TCP_HPP
 
+#include <algorithm>
 #include <array>
+#include <cerrno>
+#include <climits>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
-#include <iostream>
+#include <initializer_list>
+#include <span>
 #include <string>
 #include <string_view>
 #include <variant>
@@ -21,18 +25,36 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
 
+#include "buffer_pool.hpp"
+#include "connector.hpp"
+#include "deadline.hpp"
 #include "endpoint.hpp"
+#include "io_result.hpp"
+#include "log.hpp"
+#include "resolver.hpp"
+#include "socket_profile.hpp"
+
+/*
+  Describes a contiguous container for the vectored send/receive calls.
+ */
+template <typename Container> inline iovec to_iovec(const Container &data) {
+  return {const_cast<void *>(static_cast<const void *>(std::data(data))),
+          std::size(data) * sizeof(*std::data(data))};
+}
 
 struct tcp_resolver {
   tcp_resolver() {
 #ifdef _WIN32
     WSADATA wsData;
     if (WSAStartup(MAKEWORD(2, 2), &wsData) != 0) {
-      std::cerr << "Failed to initialize winsock." << std::endl;
+      log_error("Failed to initialize winsock.");
     }
 #endif
   }
@@ -45,42 +67,37 @@ struct tcp_resolver {
 
   std::vector<endpoint> resolve(const std::string &host,
                                 const std::string &service) {
-    struct addrinfo hints, *res;
-    int status;
-
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_INET;       // AF_UNSPEC;     // IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM; // TCP socket
-
-    std::vector<endpoint> endpoints;
-    if ((status = getaddrinfo(host.c_str(), service.c_str(), &hints, &res)) !=
-        0) {
-      std::cerr << "getaddrinfo error: " << gai_strerror(status) << std::endl;
-      return endpoints;
-    }
-
-    for (struct addrinfo *p = res; p != nullptr; p = p->ai_next) {
-      endpoints.emplace_back(*p);
-    }
-
-    freeaddrinfo(res);
-    return endpoints;
+    return dns_resolver::shared().resolve(host, service, SOCK_STREAM);
   }
 };
 
 struct tcp_socket {
   tcp_socket() : sockfd(-1) {}
 
-  bool bind(const endpoint ep) {
-    sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  /*
+    With reuse_port several sockets may bind the same endpoint and the
+    kernel spreads incoming connections across them, see sharded_listener.
+   */
+  bool bind(const endpoint ep, const bool reuse_port = false) {
+    sockfd = socket(ep.addr.sa_family, SOCK_STREAM, IPPROTO_TCP);
     if (sockfd == -1) {
-      std::cerr << "Failed to create socket." << std::endl;
+      log_failure(last_error, "Failed to create socket.");
+      return false;
+    }
+
+    profile.apply(sockfd, socket_profile::stage::bind);
+
+    const int on = 1;
+    if (reuse_port &&
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+      log_failure(last_error, "Failed to set SO_REUSEPORT.");
+      close();
       return false;
     }
 
     if (::bind(sockfd, reinterpret_cast<const sockaddr *>(&ep.addr),
-               sizeof(ep.addr)) < 0) {
-      std::cerr << "Bind failed." << std::endl;
+               ep.addrlen) < 0) {
+      log_failure(last_error, "Bind failed.");
       close();
       return false;
     }
@@ -90,7 +107,7 @@ struct tcp_socket {
 
   bool listen(const int max_incoming_connections) {
     if (::listen(sockfd, max_incoming_connections) == -1) {
-      std::cerr << "Listen Failed" << std::endl;
+      log_failure(last_error, "Listen Failed");
       close();
       return false;
     }
@@ -99,28 +116,32 @@ struct tcp_socket {
   }
 
   tcp_socket accept() {
-    sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
     tcp_socket client_socket;
-    client_socket.sockfd =
-        ::accept(sockfd, (sockaddr *)&client_addr, &client_len);
+    do {
+      client_socket.sockfd = ::accept4(sockfd, nullptr, nullptr, SOCK_CLOEXEC);
+    } while (client_socket.sockfd == -1 && errno == EINTR);
     if (client_socket.sockfd == -1) {
-      std::cerr << "Accept failed" << std::endl;
+      log_failure(last_error, "Accept failed");
+      return client_socket;
     }
 
+    client_socket.profile = profile;
+    profile.apply(client_socket.sockfd, socket_profile::stage::accept);
     return client_socket;
   }
 
   bool connect(const endpoint ep) {
-    sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockfd = socket(ep.addr.sa_family, SOCK_STREAM, IPPROTO_TCP);
     if (sockfd == -1) {
-      std::cerr << "Failed to create socket." << std::endl;
+      log_failure(last_error, "Failed to create socket.");
       return false;
     }
 
+    profile.apply(sockfd, socket_profile::stage::connect);
+
     if (::connect(sockfd, reinterpret_cast<const sockaddr *>(&ep.addr),
-                  sizeof(ep.addr)) < 0) {
-      std::cerr << "Connection failed." << std::endl;
+                  ep.addrlen) < 0) {
+      log_failure(last_error, "Connection failed.");
       close();
       return false;
     }
@@ -128,15 +149,25 @@ struct tcp_socket {
     return true;
   }
 
+  /*
+    Races every resolved endpoint (see connector) and keeps the first one
+    that connects within timeout_ms.
+   */
+  bool connect(const std::vector<endpoint> &endpoints,
+               const int timeout_ms = connector::default_timeout_ms) {
+    sockfd = connector::connect(endpoints, timeout_ms, profile);
+    return sockfd != -1;
+  }
+
   template <typename Container> ssize_t send(const Container &data) {
     if (sockfd == -1) {
-      std::cerr << "Socket not connected." << std::endl;
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
       return -1;
     }
 
     ssize_t bytes_sent = ::send(sockfd, std::data(data), std::size(data), 0);
     if (bytes_sent == -1) {
-      std::cerr << "Failed to send data." << std::endl;
+      log_failure(last_error, "Failed to send data.");
       return -1;
     }
 
@@ -145,14 +176,14 @@ struct tcp_socket {
 
   template <typename Container> ssize_t receive(Container &buffer) {
     if (sockfd == -1) {
-      std::cerr << "Socket not connected." << std::endl;
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
       return -1;
     }
 
     ssize_t bytes_read =
         ::recv(sockfd, std::data(buffer), std::size(buffer), 0);
     if (bytes_read == -1) {
-      std::cerr << "Failed to receive data." << std::endl;
+      log_failure(last_error, "Failed to receive data.");
       return -1;
     }
 
@@ -160,45 +191,264 @@ struct tcp_socket {
   }
 
   /*
-  As opposed to "receive", "receive_some" will block until the buffer is
-  completely full, as to say, it will never return if the buffer wasnt
-  satisfied.
- */
-  template <typename Container> ssize_t receive_some(Container &buffer) {
-    size_t total_bytes_read = 0;
-    while (total_bytes_read < std::size(buffer)) {
-      if (sockfd == -1) {
-        std::cerr << "Socket not connected." << std::endl;
+    Gather send, every buffer goes out in order with one sendmsg per
+    IOV_MAX buffers instead of being concatenated first. Unlike send this
+    keeps going after a short write, so it returns the full size or -1.
+   */
+  ssize_t send_vec(std::span<const iovec> buffers) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    // copied only when a write stops in the middle of a buffer.
+    std::vector<iovec> rest;
+    std::span<const iovec> pending = buffers;
+    ssize_t total = 0;
+    while (!pending.empty()) {
+      msghdr msg{};
+      msg.msg_iov = const_cast<iovec *>(std::data(pending));
+      msg.msg_iovlen = std::min<std::size_t>(std::size(pending), IOV_MAX);
+
+      ssize_t bytes_sent = ::sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+      if (bytes_sent == -1) {
+        if (errno == EINTR)
+          continue;
+        log_failure(last_error, "Failed to send data.");
         return -1;
       }
+      total += bytes_sent;
+
+      std::size_t done = 0;
+      while (done < std::size(pending) &&
+             static_cast<std::size_t>(bytes_sent) >= pending[done].iov_len) {
+        bytes_sent -= pending[done].iov_len;
+        done++;
+      }
+
+      if (bytes_sent == 0) {
+        pending = pending.subspan(done);
+        continue;
+      }
 
-      const auto begin =
-          std::addressof(*(std::begin(buffer) + total_bytes_read));
-      const std::size_t left = std::size(buffer) - total_bytes_read;
-      ssize_t bytes_read = ::recv(sockfd, begin, left, 0);
-      if (bytes_read == -1) {
-        std::cerr << "Failed to receive data." << std::endl;
+      std::vector<iovec> next(std::begin(pending) + done, std::end(pending));
+      next[0].iov_base = static_cast<char *>(next[0].iov_base) + bytes_sent;
+      next[0].iov_len -= bytes_sent;
+      rest = std::move(next);
+      pending = rest;
+    }
+
+    return total;
+  }
+
+  ssize_t send_vec(std::initializer_list<iovec> buffers) {
+    return send_vec(
+        std::span<const iovec>(std::begin(buffers), std::size(buffers)));
+  }
+
+  /*
+    Scatter receive, fills the buffers in order with a single readv worth of
+    data. Returns what receive would.
+   */
+  ssize_t receive_vec(std::span<iovec> buffers) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    ssize_t bytes_read;
+    do {
+      bytes_read = ::readv(sockfd, std::data(buffers),
+                           std::min<std::size_t>(std::size(buffers), IOV_MAX));
+    } while (bytes_read == -1 && errno == EINTR);
+
+    if (bytes_read == -1) {
+      log_failure(last_error, "Failed to receive data.");
+      return -1;
+    }
+
+    return bytes_read;
+  }
+
+  /*
+    Sends len bytes of the file behind fd starting at offset, straight from
+    the page cache. Stops early at end of file. Returns the bytes sent or
+    -1. Like relay(), a reset peer raises SIGPIPE.
+   */
+  ssize_t send_file(const int fd, off_t offset, const std::size_t len) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    std::size_t total = 0;
+    while (total < len) {
+      ssize_t bytes_sent = ::sendfile(sockfd, fd, &offset, len - total);
+      if (bytes_sent == -1) {
+        if (errno == EINTR)
+          continue;
+        log_failure(last_error, "Failed to send file.");
         return -1;
-      } else if (bytes_read > 0)
-        total_bytes_read += bytes_read;
+      }
+
+      if (bytes_sent == 0)
+        break;
+      total += bytes_sent;
+    }
+
+    return total;
+  }
+
+  /*
+    Reads until buffer is full. Without a timeout this is one MSG_WAITALL
+    recv in the common case; with one, whatever has arrived is taken and
+    poll waits for the rest. bytes is what was read before eof or timeout,
+    so a short count tells a half-closed peer apart from a slow one.
+   */
+  template <typename Container>
+  io_result receive_exact(Container &buffer, const int timeout_ms = -1) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return {-1, io_status::error};
+    }
+
+    auto *bytes = reinterpret_cast<char *>(std::data(buffer));
+    const std::size_t len = std::size(buffer) * sizeof(*std::data(buffer));
+    const deadline until(timeout_ms);
+    std::size_t total = 0;
+    while (total < len) {
+      const ssize_t bytes_read =
+          ::recv(sockfd, bytes + total, len - total,
+                 until.forever ? MSG_WAITALL : MSG_DONTWAIT);
+      if (bytes_read > 0) {
+        total += bytes_read;
+        continue;
+      }
+
+      if (bytes_read == 0)
+        return {static_cast<ssize_t>(total), io_status::eof};
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        log_failure(last_error, "Failed to receive data.");
+        return {-1, io_status::error};
+      }
+
+      const io_status ready = wait_for(sockfd, POLLIN, until);
+      if (ready != io_status::ok)
+        return {static_cast<ssize_t>(total), ready};
     }
 
-    return total_bytes_read;
+    return {static_cast<ssize_t>(total), io_status::ok};
+  }
+
+  /*
+    As opposed to "receive", "receive_some" blocks until the buffer is
+    completely full, the peer closes or timeout_ms passes. Returns the
+    number of bytes read, less than the buffer size in the latter two
+    cases, or -1.
+   */
+  template <typename Container>
+  ssize_t receive_some(Container &buffer, const int timeout_ms = -1) {
+    return receive_exact(buffer, timeout_ms).bytes;
   }
 
   /*
-    Receive exactly this object.
+    Receive exactly this object. obj is only assigned when all of it
+    arrived.
    */
-  template <typename T> ssize_t receive_into(T &obj) {
+  template <typename T>
+  ssize_t receive_into(T &obj, const int timeout_ms = -1) {
     union var {
       T obj;
       std::array<std::byte, sizeof(T)> bytes;
     };
 
     var v;
-    ssize_t len = receive_some(v.bytes);
-    obj = v.obj;
-    return len;
+    const io_result r = receive_exact(v.bytes, timeout_ms);
+    if (r.ok())
+      obj = v.obj;
+    return r.bytes;
+  }
+
+  bool set_nonblocking(const bool enable = true) {
+#ifdef _WIN32
+    u_long mode = enable ? 1 : 0;
+    return ioctlsocket(sockfd, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags == -1)
+      return false;
+
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(sockfd, F_SETFL, flags) != -1;
+#endif
+  }
+
+  /*
+    Non-blocking variants of accept/send/receive. These expect the socket to
+    have been switched with set_nonblocking() (the reactor does this on
+    registration) and never log, since would-block is the normal case.
+    try_accept fills in from, when given, with the peer address.
+   */
+  io_status try_accept(tcp_socket &client, endpoint *from = nullptr) {
+    sockaddr *addr = nullptr;
+    socklen_t *addrlen = nullptr;
+    if (from != nullptr) {
+      from->addrlen = sizeof(from->storage);
+      addr = &from->addr;
+      addrlen = &from->addrlen;
+    }
+
+    int fd;
+    do {
+      fd = ::accept4(sockfd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    } while (fd == -1 && errno == EINTR);
+
+    if (fd == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return io_status::would_block;
+      last_error = {errno, error_domain::system};
+      return io_status::error;
+    }
+
+    if (from != nullptr)
+      from->family = from->addr.sa_family;
+    client.sockfd = fd;
+    client.profile = profile;
+    profile.apply(fd, socket_profile::stage::accept);
+    return io_status::ok;
+  }
+
+  template <typename Container> io_result try_send(const Container &data) {
+    ssize_t bytes_sent;
+    do {
+      bytes_sent =
+          ::send(sockfd, std::data(data), std::size(data), MSG_NOSIGNAL);
+    } while (bytes_sent == -1 && errno == EINTR);
+
+    if (bytes_sent >= 0)
+      return {bytes_sent, io_status::ok};
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return {0, io_status::would_block};
+    last_error = {errno, error_domain::system};
+    return {-1, io_status::error};
+  }
+
+  template <typename Container> io_result try_receive(Container &buffer) {
+    ssize_t bytes_read;
+    do {
+      bytes_read = ::recv(sockfd, std::data(buffer), std::size(buffer), 0);
+    } while (bytes_read == -1 && errno == EINTR);
+
+    if (bytes_read > 0)
+      return {bytes_read, io_status::ok};
+    if (bytes_read == 0)
+      return {0, std::size(buffer) ? io_status::eof : io_status::ok};
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return {0, io_status::would_block};
+    last_error = {errno, error_domain::system};
+    return {-1, io_status::error};
   }
 
   void close() {
@@ -213,22 +463,141 @@ struct tcp_socket {
   }
 
   int sockfd;
+  socket_profile profile;
+  net_error last_error;
 };
 
+/*
+  Shuttles bytes both ways between two connected sockets until both sides
+  have closed, using splice through a pipe per direction so the data never
+  enters user space. A side that reaches end of stream has its peer's write
+  half shut down, so half-closes propagate. Returns the total bytes moved or
+  -1.
+
+  splice has no MSG_NOSIGNAL, writing to a reset peer raises SIGPIPE: the
+  process has to ignore or block it.
+ */
+inline ssize_t relay(tcp_socket &a, tcp_socket &b) {
+  struct direction {
+    int from;
+    int to;
+    int pipe[2];
+    std::size_t buffered;
+    bool eof;
+    bool done;
+  };
+
+  constexpr std::size_t chunk = 65536;
+
+  direction dirs[2] = {{a.sockfd, b.sockfd, {-1, -1}, 0, false, false},
+                       {b.sockfd, a.sockfd, {-1, -1}, 0, false, false}};
+  for (auto &dir : dirs) {
+    if (::pipe2(dir.pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+      log_error("Failed to create relay pipe.");
+      for (auto &d : dirs)
+        for (int fd : d.pipe)
+          if (fd != -1)
+            ::close(fd);
+      return -1;
+    }
+  }
+
+  // a splice into a blocking socket may sleep until the whole chunk fits,
+  // which would stall the other direction.
+  const int flags_a = fcntl(a.sockfd, F_GETFL, 0);
+  const int flags_b = fcntl(b.sockfd, F_GETFL, 0);
+  a.set_nonblocking();
+  b.set_nonblocking();
+
+  ssize_t total = 0;
+  bool failed = false;
+  while (!failed && !(dirs[0].done && dirs[1].done)) {
+    pollfd pfds[4];
+    nfds_t count = 0;
+    int slots[2][2] = {{-1, -1}, {-1, -1}};
+    for (int i = 0; i < 2; i++) {
+      direction &dir = dirs[i];
+      if (dir.done)
+        continue;
+      if (!dir.eof && dir.buffered < chunk) {
+        slots[i][0] = count;
+        pfds[count++] = {dir.from, POLLIN, 0};
+      }
+      if (dir.buffered > 0) {
+        slots[i][1] = count;
+        pfds[count++] = {dir.to, POLLOUT, 0};
+      }
+    }
+
+    if (::poll(pfds, count, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      failed = true;
+      break;
+    }
+
+    for (int i = 0; i < 2 && !failed; i++) {
+      direction &dir = dirs[i];
+      if (slots[i][0] != -1 && pfds[slots[i][0]].revents) {
+        ssize_t n = ::splice(dir.from, nullptr, dir.pipe[1], nullptr,
+                             chunk - dir.buffered,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0)
+          dir.eof = true;
+        else if (n > 0)
+          dir.buffered += n;
+        else if (errno != EAGAIN && errno != EINTR)
+          failed = true;
+      }
+
+      if (slots[i][1] != -1 && pfds[slots[i][1]].revents) {
+        ssize_t n = ::splice(dir.pipe[0], nullptr, dir.to, nullptr,
+                             dir.buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+          dir.buffered -= n;
+          total += n;
+        } else if (n == -1 && errno != EAGAIN && errno != EINTR) {
+          failed = true;
+        }
+      }
+
+      if (dir.eof && dir.buffered == 0 && !dir.done) {
+        ::shutdown(dir.to, SHUT_WR);
+        dir.done = true;
+      }
+    }
+  }
+
+  for (auto &dir : dirs) {
+    ::close(dir.pipe[0]);
+    ::close(dir.pipe[1]);
+  }
+
+  if (flags_a != -1)
+    fcntl(a.sockfd, F_SETFL, flags_a);
+  if (flags_b != -1)
+    fcntl(b.sockfd, F_SETFL, flags_b);
+
+  if (failed) {
+    log_error("Relay failed.");
+    return -1;
+  }
+
+  return total;
+}
+
 inline tcp_socket &operator<<(tcp_socket &sock, const std::string &data) {
   sock.send(data);
   return sock;
 }
 
+/*
+  Reads until the peer closes, into pooled blocks, then copies into data
+  a chain's limit at a time.
+ */
 inline tcp_socket &operator>>(tcp_socket &sock, std::string &data) {
-  std::array<char, 4096> receive_buffer;
-
-  std::size_t bytes = 0;
-  do {
-    bytes = sock.receive(receive_buffer);
-    data.append(receive_buffer.data(), bytes);
-  } while (bytes > 0);
-
+  buffer_chain received;
+  received.receive_all(sock, data);
   return sock;
 }
 
@@ -0,0 +1,294 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/*
+  Hierarchical timing wheel (Varghese & Lauck) with 1 ms resolution: four
+  levels of 256 slots covering 2^32 ms (about 49 days), later deadlines are
+  clamped to that. Scheduling and cancelling are O(1), a timer moves down
+  one level at a time as its deadline approaches and fires from level 0.
+
+  Timers live in a slab of nodes reused through a free list, a timer_id
+  carries the node's generation so a stale id (fired or cancelled) is
+  simply ignored by cancel().
+
+  Not thread-safe, it belongs to one event loop (see reactor::timers).
+ */
+struct timer_wheel {
+  using clock = std::chrono::steady_clock;
+  using callback = std::function<void()>;
+  using timer_id = std::uint64_t;
+
+  static constexpr timer_id invalid = 0;
+  static constexpr int levels = 4;
+  static constexpr int slot_bits = 8;
+  static constexpr std::uint32_t slots = 1u << slot_bits;
+  static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+  timer_wheel() : origin(clock::now()) {
+    heads.fill(none);
+    occupied.fill({});
+  }
+
+  /*
+    Deadlines round up to the next tick, a timer never fires early.
+   */
+  timer_id schedule(const std::chrono::milliseconds delay, callback fn) {
+    return schedule_at(clock::now() + delay, std::move(fn));
+  }
+
+  timer_id schedule_at(const clock::time_point when, callback fn) {
+    const auto ms =
+        std::chrono::ceil<std::chrono::milliseconds>(when - origin).count();
+    return schedule_tick(ms > 0 ? ms : 0, std::move(fn));
+  }
+
+  /*
+    Returns false if the timer already fired or was cancelled.
+   */
+  bool cancel(const timer_id id) {
+    const std::uint32_t index = id & 0xffffffff;
+    if (id == invalid || index >= std::size(nodes) ||
+        nodes[index].generation != id >> 32 || nodes[index].list == none)
+      return false;
+
+    unlink(index);
+    release(index);
+    return true;
+  }
+
+  bool armed(const timer_id id) const {
+    const std::uint32_t index = id & 0xffffffff;
+    return id != invalid && index < std::size(nodes) &&
+           nodes[index].generation == id >> 32 && nodes[index].list != none;
+  }
+
+  std::size_t size() const { return count; }
+
+  /*
+    Fires every timer due by now. Returns how many ran.
+   */
+  std::size_t advance() { return advance_to(now_tick()); }
+
+  /*
+    Fires every timer due by tick (ms since construction). Callbacks may
+    schedule and cancel timers, including ones due in this same call.
+   */
+  std::size_t advance_to(const std::uint64_t tick) {
+    std::size_t fired = 0;
+    while (current <= tick) {
+      if (count == 0) {
+        current = tick + 1;
+        break;
+      }
+
+      const std::uint32_t slot = current & (slots - 1);
+      if (slot == 0)
+        cascade();
+
+      // jump over empty level 0 slots up to the next cascade point.
+      if (heads[slot] == none) {
+        const std::uint32_t next = next_occupied(0, slot);
+        const std::uint64_t boundary = (current | (slots - 1)) + 1;
+        const std::uint64_t target =
+            next == none ? boundary : current - slot + next;
+        current = std::min(target, tick + 1);
+        continue;
+      }
+
+      fired += fire(slot);
+      current++;
+    }
+
+    return fired;
+  }
+
+  /*
+    Upper bound on the wait until the next timer may fire, -1 when none is
+    armed. Exact for timers due within 256 ms, otherwise the next cascade,
+    which is early but never late.
+   */
+  int next_timeout_ms() const {
+    if (count == 0)
+      return -1;
+
+    const std::uint64_t now = now_tick();
+    const std::uint32_t slot = current & (slots - 1);
+    std::uint64_t next;
+    const std::uint32_t found = next_occupied(0, slot);
+    if (found != none)
+      next = current - slot + found;
+    else
+      next = (current | (slots - 1)) + 1;
+
+    return next <= now ? 0 : static_cast<int>(std::min<std::uint64_t>(
+                                 next - now, std::numeric_limits<int>::max()));
+  }
+
+  std::uint64_t now_tick() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() -
+                                                                 origin)
+        .count();
+  }
+
+  struct node {
+    std::uint64_t expires = 0;
+    std::uint32_t prev = none;
+    std::uint32_t next = none;
+    std::uint32_t generation = 1;
+    std::uint32_t list = none; // slot list holding the node, none when free.
+    callback fn;
+  };
+
+  timer_id schedule_tick(std::uint64_t expires, callback fn) {
+    if (expires < current)
+      expires = current;
+    // one top level slot short of a full turn, so the slot cascades
+    // before the deadline rather than right after it.
+    const std::uint64_t horizon = (std::uint64_t(1) << (levels * slot_bits)) -
+                                  (std::uint64_t(1) << ((levels - 1) * slot_bits));
+    if (expires - current > horizon)
+      expires = current + horizon;
+
+    std::uint32_t index;
+    if (free_head != none) {
+      index = free_head;
+      free_head = nodes[index].next;
+    } else {
+      index = std::size(nodes);
+      nodes.emplace_back();
+    }
+
+    node &n = nodes[index];
+    n.expires = expires;
+    n.fn = std::move(fn);
+    insert(index);
+    count++;
+    return (timer_id(n.generation) << 32) | index;
+  }
+
+  /*
+    Level from how far away the deadline is, slot from the deadline's
+    digit at that level.
+   */
+  void insert(const std::uint32_t index) {
+    const std::uint64_t expires = nodes[index].expires;
+    const std::uint64_t delta = expires - current;
+    int level = 0;
+    while (level < levels - 1 && delta >> (slot_bits * (level + 1)))
+      level++;
+
+    const std::uint32_t slot = (expires >> (slot_bits * level)) & (slots - 1);
+    push(level * slots + slot, index);
+  }
+
+  void push(const std::uint32_t list, const std::uint32_t index) {
+    node &n = nodes[index];
+    n.list = list;
+    n.prev = none;
+    n.next = heads[list];
+    if (n.next != none)
+      nodes[n.next].prev = index;
+    heads[list] = index;
+    occupied[list / slots][(list % slots) / 64] |=
+        std::uint64_t(1) << (list % 64);
+  }
+
+  void unlink(const std::uint32_t index) {
+    node &n = nodes[index];
+    if (n.prev != none)
+      nodes[n.prev].next = n.next;
+    else
+      heads[n.list] = n.next;
+    if (n.next != none)
+      nodes[n.next].prev = n.prev;
+
+    if (heads[n.list] == none)
+      occupied[n.list / slots][(n.list % slots) / 64] &=
+          ~(std::uint64_t(1) << (n.list % 64));
+    n.list = none;
+  }
+
+  void release(const std::uint32_t index) {
+    node &n = nodes[index];
+    n.fn = nullptr;
+    n.generation++;
+    if (n.generation == 0)
+      n.generation = 1;
+    n.next = free_head;
+    free_head = index;
+    count--;
+  }
+
+  /*
+    Moves the timers of the higher level slots that are now in range one
+    or more levels down, when current crosses their boundary.
+   */
+  void cascade() {
+    for (int level = 1; level < levels; level++) {
+      const std::uint32_t slot = (current >> (slot_bits * level)) & (slots - 1);
+      const std::uint32_t list = level * slots + slot;
+      std::uint32_t index = heads[list];
+      while (index != none) {
+        const std::uint32_t next = nodes[index].next;
+        unlink(index);
+        insert(index);
+        index = next;
+      }
+
+      if (slot != 0)
+        break;
+    }
+  }
+
+  std::size_t fire(const std::uint32_t slot) {
+    std::size_t fired = 0;
+    std::uint32_t index;
+    // re-read the head every time, a callback may cancel or add to it.
+    while ((index = heads[slot]) != none) {
+      callback fn = std::move(nodes[index].fn);
+      unlink(index);
+      release(index);
+      fn();
+      fired++;
+    }
+
+    return fired;
+  }
+
+  /*
+    First occupied slot at or after from within level, none if the rest
+    of the level is empty.
+   */
+  std::uint32_t next_occupied(const int level, const std::uint32_t from) const {
+    for (std::uint32_t word = from / 64; word < slots / 64; word++) {
+      std::uint64_t bits = occupied[level][word];
+      if (word == from / 64)
+        bits &= ~std::uint64_t(0) << (from % 64);
+      if (bits != 0)
+        return word * 64 + std::countr_zero(bits);
+    }
+
+    return none;
+  }
+
+  clock::time_point origin;
+  std::uint64_t current = 0;
+  std::size_t count = 0;
+  std::uint32_t free_head = none;
+  std::vector<node> nodes;
+  std::array<std::uint32_t, levels * slots> heads;
+  std::array<std::array<std::uint64_t, slots / 64>, levels> occupied;
+};
+
+#endif
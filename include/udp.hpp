@@ -1,11 +1,13 @@
 #ifndef UDP_HPP
 #define UDP_HPP
 
+#include <algorithm>
 #include <array>
+#include <cerrno>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
-#include <iostream>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -16,20 +18,27 @@
 #include <ws2udpip.h>
 #else
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #endif
 
+#include "deadline.hpp"
 #include "endpoint.hpp"
+#include "io_result.hpp"
+#include "log.hpp"
+#include "resolver.hpp"
+#include "socket_profile.hpp"
 
 struct udp_resolver {
   udp_resolver() {
 #ifdef _WIN32
     WSADATA wsData;
     if (WSAStartup(MAKEWORD(2, 2), &wsData) != 0) {
-      std::cerr << "Failed to initialize winsock." << std::endl;
+      log_error("Failed to initialize winsock.");
     }
 #endif
   }
@@ -42,26 +51,7 @@ struct udp_resolver {
 
   std::vector<endpoint> resolve(const std::string &host,
                                 const std::string &service) {
-    struct addrinfo hints, *res;
-    int status;
-
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;    // IPv4 ----or IPv6
-    hints.ai_socktype = SOCK_DGRAM; // UDP socket
-
-    std::vector<endpoint> endpoints;
-    auto *service_str = service.length() ? service.c_str() : nullptr;
-    if ((status = getaddrinfo(host.c_str(), service_str, &hints, &res)) != 0) {
-      std::cerr << "getaddrinfo error: " << gai_strerror(status) << std::endl;
-      return endpoints;
-    }
-
-    for (struct addrinfo *p = res; p != nullptr; p = p->ai_next) {
-      endpoints.emplace_back(*p);
-    }
-
-    freeaddrinfo(res);
-    return endpoints;
+    return dns_resolver::shared().resolve(host, service, SOCK_DGRAM);
   }
 };
 
@@ -71,13 +61,15 @@ struct udp_socket {
   bool bind(const endpoint ep) {
     sockfd = socket(ep.family, SOCK_DGRAM, 0);
     if (sockfd == -1) {
-      std::cerr << "Failed to create socket." << std::endl;
+      log_failure(last_error, "Failed to create socket.");
       return false;
     }
 
+    profile.apply(sockfd, socket_profile::stage::bind);
+
     if (::bind(sockfd, reinterpret_cast<const sockaddr *>(&ep.addr),
-               sizeof(ep.addr)) < 0) {
-      std::cerr << "Bind failed." << std::endl;
+               ep.addrlen) < 0) {
+      log_failure(last_error, "Bind failed.");
       close();
       return false;
     }
@@ -88,13 +80,15 @@ struct udp_socket {
   bool connect(const endpoint ep) {
     sockfd = socket(ep.family, SOCK_DGRAM, 0);
     if (sockfd == -1) {
-      std::cerr << "Failed to create socket." << std::endl;
+      log_failure(last_error, "Failed to create socket.");
       return false;
     }
 
+    profile.apply(sockfd, socket_profile::stage::connect);
+
     if (::connect(sockfd, reinterpret_cast<const sockaddr *>(&ep.addr),
-                  sizeof(ep.addr)) < 0) {
-      std::cerr << "Connection failed." << std::endl;
+                  ep.addrlen) < 0) {
+      log_failure(last_error, "Connection failed.");
       close();
       return false;
     }
@@ -105,14 +99,14 @@ struct udp_socket {
   template <typename Container>
   ssize_t send(const Container &data, const endpoint &to, int flags) {
     if (sockfd == -1) {
-      std::cerr << "Socket not connected." << std::endl;
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
       return -1;
     }
 
     ssize_t bytes_sent = ::sendto(sockfd, std::data(data), std::size(data),
                                   flags, &to.addr, to.addrlen);
     if (bytes_sent == -1) {
-      std::cerr << "Failed to send data." << std::endl;
+      log_failure(last_error, "Failed to send data.");
       return -1;
     }
 
@@ -122,7 +116,7 @@ struct udp_socket {
   template <typename Container>
   ssize_t receive(Container &buffer, endpoint &from, int flags) {
     if (sockfd == -1) {
-      std::cerr << "Socket not connected." << std::endl;
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
       return -1;
     }
 
@@ -132,40 +126,362 @@ struct udp_socket {
     return bytes_read;
   }
 
+  /*
+    Fills buffer from as many datagrams as it takes, see
+    tcp_socket::receive_exact. from is the sender of the last datagram.
+    Datagram sockets have no end of stream, so the result is ok, timeout or
+    error.
+   */
   template <typename Container>
-  ssize_t receive_some(Container &buffer, endpoint &from) {
-    size_t total_bytes_read = 0;
-    while (total_bytes_read < std::size(buffer)) {
-      if (sockfd == -1) {
-        std::cerr << "Socket not connected." << std::endl;
-        return -1;
+  io_result receive_exact(Container &buffer, endpoint &from,
+                          const int timeout_ms = -1) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return {-1, io_status::error};
+    }
+
+    auto *bytes = reinterpret_cast<char *>(std::data(buffer));
+    const std::size_t len = std::size(buffer) * sizeof(*std::data(buffer));
+    const deadline until(timeout_ms);
+    std::size_t total = 0;
+    while (total < len) {
+      from.addrlen = sizeof(from.storage);
+      const ssize_t bytes_read =
+          ::recvfrom(sockfd, bytes + total, len - total,
+                     until.forever ? 0 : MSG_DONTWAIT, &from.addr,
+                     &from.addrlen);
+      if (bytes_read >= 0) {
+        from.family = from.addr.sa_family;
+        total += bytes_read;
+        continue;
       }
 
-      const auto begin =
-          std::addressof(*(std::begin(buffer) + total_bytes_read));
-      const std::size_t left = std::size(buffer) - total_bytes_read;
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        log_failure(last_error, "Failed to receive data.");
+        return {-1, io_status::error};
+      }
 
-      ssize_t bytes_read =
-          ::recvfrom(sockfd, begin, left, &from.addr, &from.addrlen);
-      if (bytes_read == -1) {
-        return -1;
-      } else if (bytes_read > 0)
-        total_bytes_read += bytes_read;
+      const io_status ready = wait_for(sockfd, POLLIN, until);
+      if (ready != io_status::ok)
+        return {static_cast<ssize_t>(total), ready};
     }
 
-    return total_bytes_read;
+    return {static_cast<ssize_t>(total), io_status::ok};
   }
 
-  template <typename T> ssize_t receive_into(T &obj, endpoint &from) {
+  template <typename Container>
+  ssize_t receive_some(Container &buffer, endpoint &from,
+                       const int timeout_ms = -1) {
+    return receive_exact(buffer, from, timeout_ms).bytes;
+  }
+
+  template <typename T>
+  ssize_t receive_into(T &obj, endpoint &from, const int timeout_ms = -1) {
     union var {
       T obj;
       std::array<std::byte, sizeof(T)> bytes;
     };
 
     var v;
-    ssize_t len = receive_some(v.bytes, from);
-    obj = v.obj;
-    return len;
+    const io_result r = receive_exact(v.bytes, from, timeout_ms);
+    if (r.ok())
+      obj = v.obj;
+    return r.bytes;
+  }
+
+  /*
+    Batched variants moving many datagrams per syscall. Buffers is any
+    container of containers (e.g. std::array<std::array<char, 1500>, 64>),
+    datagram i lands in buffers[i] with its size in lengths[i] and sender in
+    from[i]. Returns the number of datagrams received, or -1.
+
+    The default MSG_WAITFORONE blocks only until the first datagram, the
+    rest of the batch is whatever is already queued.
+   */
+  template <typename Buffers>
+  int receive_batch(Buffers &buffers, std::span<endpoint> from,
+                    std::span<std::size_t> lengths,
+                    int flags = MSG_WAITFORONE) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    const std::size_t count =
+        std::min({std::size(buffers), std::size(from), std::size(lengths)});
+
+    std::array<mmsghdr, batch_size> msgs;
+    std::array<iovec, batch_size> iovs;
+    std::size_t total = 0;
+    while (total < count) {
+      const std::size_t chunk = std::min(batch_size, count - total);
+      for (std::size_t i = 0; i < chunk; i++) {
+        auto &buffer = *(std::begin(buffers) + total + i);
+        iovs[i].iov_base = std::data(buffer);
+        iovs[i].iov_len = std::size(buffer);
+        std::memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_name = &from[total + i].addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(from[total + i].storage);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      int received;
+      do {
+        received = ::recvmmsg(sockfd, std::data(msgs), chunk, flags, nullptr);
+      } while (received == -1 && errno == EINTR);
+
+      if (received == -1) {
+        if (total == 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+          last_error = {errno, error_domain::system};
+          return -1;
+        }
+        break;
+      }
+
+      for (int i = 0; i < received; i++) {
+        endpoint &ep = from[total + i];
+        ep.addrlen = msgs[i].msg_hdr.msg_namelen;
+        ep.family = ep.addr.sa_family;
+        lengths[total + i] = msgs[i].msg_len;
+      }
+
+      total += received;
+      if (static_cast<std::size_t>(received) < chunk)
+        break;
+
+      // only the first chunk may wait, the rest drains what is queued.
+      flags = (flags & ~MSG_WAITFORONE) | MSG_DONTWAIT;
+    }
+
+    return total;
+  }
+
+  /*
+    Sends buffers[i] to to[i] for every i, batch_size datagrams per
+    sendmmsg. Returns how many datagrams were handed to the kernel, or -1
+    if not even the first one could be sent.
+   */
+  template <typename Buffers>
+  int send_batch(const Buffers &buffers, std::span<const endpoint> to,
+                 const int flags = 0) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    const std::size_t count = std::min(std::size(buffers), std::size(to));
+
+    std::array<mmsghdr, batch_size> msgs;
+    std::array<iovec, batch_size> iovs;
+    std::size_t total = 0;
+    while (total < count) {
+      const std::size_t chunk = std::min(batch_size, count - total);
+      for (std::size_t i = 0; i < chunk; i++) {
+        const auto &buffer = *(std::begin(buffers) + total + i);
+        iovs[i].iov_base =
+            const_cast<void *>(static_cast<const void *>(std::data(buffer)));
+        iovs[i].iov_len = std::size(buffer);
+        std::memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_name = const_cast<sockaddr *>(&to[total + i].addr);
+        msgs[i].msg_hdr.msg_namelen = to[total + i].addrlen;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      int sent;
+      do {
+        sent = ::sendmmsg(sockfd, std::data(msgs), chunk, flags);
+      } while (sent == -1 && errno == EINTR);
+
+      if (sent == -1) {
+        if (total == 0) {
+          log_failure(last_error, "Failed to send data.");
+          return -1;
+        }
+        break;
+      }
+
+      total += sent;
+      if (static_cast<std::size_t>(sent) < chunk)
+        break;
+    }
+
+    return total;
+  }
+
+  /*
+    UDP segmentation offload. send_segmented hands the kernel one large
+    buffer that leaves the host as segment_size byte datagrams (the last one
+    may be shorter), so the stack is traversed once per buffer instead of
+    once per datagram. The kernel caps this at 64 segments and 64 KiB.
+   */
+  template <typename Container>
+  ssize_t send_segmented(const Container &data, const endpoint &to,
+                         const std::uint16_t segment_size,
+                         const int flags = 0) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    iovec iov;
+    iov.iov_base =
+        const_cast<void *>(static_cast<const void *>(std::data(data)));
+    iov.iov_len = std::size(data) * sizeof(*std::data(data));
+
+    alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(std::uint16_t))>
+        control{};
+    msghdr msg{};
+    msg.msg_name = const_cast<sockaddr *>(&to.addr);
+    msg.msg_namelen = to.addrlen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = std::data(control);
+    msg.msg_controllen = std::size(control);
+
+    cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+    std::memcpy(CMSG_DATA(cm), &segment_size, sizeof(segment_size));
+
+    ssize_t bytes_sent;
+    do {
+      bytes_sent = ::sendmsg(sockfd, &msg, flags);
+    } while (bytes_sent == -1 && errno == EINTR);
+
+    if (bytes_sent == -1) {
+      log_failure(last_error, "Failed to send data.");
+      return -1;
+    }
+
+    return bytes_sent;
+  }
+
+  /*
+    Lets the kernel coalesce a train of same-sized datagrams from one peer
+    into a single receive, see receive_coalesced.
+   */
+  bool set_gro(const bool enable = true) {
+    const int on = enable ? 1 : 0;
+    return setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+  }
+
+  /*
+    Receives what may be several coalesced datagrams and splits them back
+    into one view per original datagram. The views point into buffer, which
+    should be 64 KiB to hold a full coalesced train. Returns the total byte
+    count, or -1.
+   */
+  template <typename Container>
+  ssize_t receive_coalesced(Container &buffer, endpoint &from,
+                            std::vector<std::span<const std::byte>> &segments,
+                            const int flags = 0) {
+    segments.clear();
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    iovec iov;
+    iov.iov_base = std::data(buffer);
+    iov.iov_len = std::size(buffer) * sizeof(*std::data(buffer));
+
+    alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+    msghdr msg{};
+    msg.msg_name = &from.addr;
+    msg.msg_namelen = sizeof(from.storage);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = std::data(control);
+    msg.msg_controllen = std::size(control);
+
+    ssize_t bytes_read;
+    do {
+      bytes_read = ::recvmsg(sockfd, &msg, flags);
+    } while (bytes_read == -1 && errno == EINTR);
+
+    if (bytes_read == -1) {
+      last_error = {errno, error_domain::system};
+      return -1;
+    }
+
+    from.addrlen = msg.msg_namelen;
+    from.family = from.addr.sa_family;
+
+    // without the control message this was a single ordinary datagram.
+    std::size_t segment_size = bytes_read;
+    for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+        int gso_size;
+        std::memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+        if (gso_size > 0)
+          segment_size = gso_size;
+      }
+    }
+
+    const auto *base = reinterpret_cast<const std::byte *>(std::data(buffer));
+    for (std::size_t off = 0; off < static_cast<std::size_t>(bytes_read);
+         off += segment_size)
+      segments.emplace_back(base + off,
+                            std::min<std::size_t>(segment_size, bytes_read - off));
+
+    return bytes_read;
+  }
+
+  bool set_nonblocking(const bool enable = true) {
+#ifdef _WIN32
+    u_long mode = enable ? 1 : 0;
+    return ioctlsocket(sockfd, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags == -1)
+      return false;
+
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(sockfd, F_SETFL, flags) != -1;
+#endif
+  }
+
+  /*
+    Non-blocking variants of send/receive, see tcp_socket::try_send.
+   */
+  template <typename Container>
+  io_result try_send(const Container &data, const endpoint &to) {
+    ssize_t bytes_sent;
+    do {
+      bytes_sent = ::sendto(sockfd, std::data(data), std::size(data), 0,
+                            &to.addr, to.addrlen);
+    } while (bytes_sent == -1 && errno == EINTR);
+
+    if (bytes_sent >= 0)
+      return {bytes_sent, io_status::ok};
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return {0, io_status::would_block};
+    last_error = {errno, error_domain::system};
+    return {-1, io_status::error};
+  }
+
+  template <typename Container>
+  io_result try_receive(Container &buffer, endpoint &from) {
+    ssize_t bytes_read;
+    do {
+      from.addrlen = sizeof(from.storage);
+      bytes_read = ::recvfrom(sockfd, std::data(buffer), std::size(buffer), 0,
+                              &from.addr, &from.addrlen);
+    } while (bytes_read == -1 && errno == EINTR);
+
+    // zero length datagrams are valid, udp has no end of stream.
+    if (bytes_read >= 0)
+      return {bytes_read, io_status::ok};
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return {0, io_status::would_block};
+    last_error = {errno, error_domain::system};
+    return {-1, io_status::error};
   }
 
   void close() {
@@ -179,7 +495,11 @@ struct udp_socket {
     }
   }
 
+  static constexpr std::size_t batch_size = 64;
+
   int sockfd;
+  socket_profile profile;
+  net_error last_error;
 };
 
 #endif
@@ -0,0 +1,441 @@
+#ifndef UNIX_HPP
+#define UNIX_HPP
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "deadline.hpp"
+#include "io_result.hpp"
+#include "log.hpp"
+
+/*
+  Unix domain socket with the tcp_socket surface, for processes on the same
+  host. type is SOCK_STREAM or SOCK_SEQPACKET (message boundaries kept,
+  a receive returns at most one message).
+
+  Addresses are filesystem paths, or Linux abstract names when they start
+  with '@' ("@enet/sidecar"), which need no cleanup and vanish with the
+  last socket. A listener bound to a path removes it again on close.
+
+  send_fds/receive_fds pass open descriptors alongside the data
+  (SCM_RIGHTS), the receiver gets its own duplicates.
+ */
+struct unix_socket {
+  static constexpr std::size_t max_fds = 16;
+
+  explicit unix_socket(const int type = SOCK_STREAM)
+      : sockfd(-1), socktype(type) {}
+
+  /*
+    A connected pair, e.g. to hand one end to a child process.
+   */
+  static std::pair<unix_socket, unix_socket> pair(const int type = SOCK_STREAM) {
+    std::pair<unix_socket, unix_socket> ends{unix_socket(type),
+                                             unix_socket(type)};
+    int fds[2];
+    if (::socketpair(AF_UNIX, type | SOCK_CLOEXEC, 0, fds) == -1) {
+      log_failure(ends.first.last_error, "Failed to create socket pair.");
+      ends.second.last_error = ends.first.last_error;
+      return ends;
+    }
+
+    ends.first.sockfd = fds[0];
+    ends.second.sockfd = fds[1];
+    return ends;
+  }
+
+  bool bind(const std::string &path) {
+    sockaddr_un addr;
+    socklen_t addrlen;
+    if (!address(path, addr, addrlen))
+      return false;
+
+    sockfd = socket(AF_UNIX, socktype | SOCK_CLOEXEC, 0);
+    if (sockfd == -1) {
+      log_failure(last_error, "Failed to create socket.");
+      return false;
+    }
+
+    // a socket file left behind by a previous run, never any other file
+    // and never one a live server still listens on.
+    struct stat st;
+    if (path[0] != '@' && ::stat(path.c_str(), &st) == 0 &&
+        S_ISSOCK(st.st_mode) && abandoned(addr, addrlen))
+      ::unlink(path.c_str());
+
+    if (::bind(sockfd, reinterpret_cast<const sockaddr *>(&addr), addrlen) <
+        0) {
+      log_failure(last_error, "Bind failed.");
+      close();
+      return false;
+    }
+
+    if (path[0] != '@')
+      bound_path = path;
+    return true;
+  }
+
+  /*
+    Whether nobody listens on addr any more. Only a refused connect says
+    so, a full backlog or another socket type still means a live server.
+   */
+  bool abandoned(const sockaddr_un &addr, const socklen_t addrlen) const {
+    const int probe = socket(AF_UNIX, socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe == -1)
+      return false;
+
+    const bool refused =
+        ::connect(probe, reinterpret_cast<const sockaddr *>(&addr), addrlen) ==
+            -1 &&
+        errno == ECONNREFUSED;
+    ::close(probe);
+    return refused;
+  }
+
+  bool listen(const int max_incoming_connections) {
+    if (::listen(sockfd, max_incoming_connections) == -1) {
+      log_failure(last_error, "Listen Failed");
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  unix_socket accept() {
+    unix_socket client_socket(socktype);
+    do {
+      client_socket.sockfd = ::accept4(sockfd, nullptr, nullptr, SOCK_CLOEXEC);
+    } while (client_socket.sockfd == -1 && errno == EINTR);
+    if (client_socket.sockfd == -1) {
+      log_failure(last_error, "Accept failed");
+    }
+
+    return client_socket;
+  }
+
+  bool connect(const std::string &path) {
+    sockaddr_un addr;
+    socklen_t addrlen;
+    if (!address(path, addr, addrlen))
+      return false;
+
+    sockfd = socket(AF_UNIX, socktype | SOCK_CLOEXEC, 0);
+    if (sockfd == -1) {
+      log_failure(last_error, "Failed to create socket.");
+      return false;
+    }
+
+    if (::connect(sockfd, reinterpret_cast<const sockaddr *>(&addr),
+                  addrlen) < 0) {
+      log_failure(last_error, "Connection failed.");
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  template <typename Container> ssize_t send(const Container &data) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    ssize_t bytes_sent =
+        ::send(sockfd, std::data(data), std::size(data), MSG_NOSIGNAL);
+    if (bytes_sent == -1) {
+      log_failure(last_error, "Failed to send data.");
+      return -1;
+    }
+
+    return bytes_sent;
+  }
+
+  template <typename Container> ssize_t receive(Container &buffer) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    ssize_t bytes_read =
+        ::recv(sockfd, std::data(buffer), std::size(buffer), 0);
+    if (bytes_read == -1) {
+      log_failure(last_error, "Failed to receive data.");
+      return -1;
+    }
+
+    return bytes_read;
+  }
+
+  /*
+    See tcp_socket::receive_exact.
+   */
+  template <typename Container>
+  io_result receive_exact(Container &buffer, const int timeout_ms = -1) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return {-1, io_status::error};
+    }
+
+    auto *bytes = reinterpret_cast<char *>(std::data(buffer));
+    const std::size_t len = std::size(buffer) * sizeof(*std::data(buffer));
+    const deadline until(timeout_ms);
+    std::size_t total = 0;
+    while (total < len) {
+      const ssize_t bytes_read =
+          ::recv(sockfd, bytes + total, len - total,
+                 until.forever ? MSG_WAITALL : MSG_DONTWAIT);
+      if (bytes_read > 0) {
+        total += bytes_read;
+        continue;
+      }
+
+      if (bytes_read == 0)
+        return {static_cast<ssize_t>(total), io_status::eof};
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        log_failure(last_error, "Failed to receive data.");
+        return {-1, io_status::error};
+      }
+
+      const io_status ready = wait_for(sockfd, POLLIN, until);
+      if (ready != io_status::ok)
+        return {static_cast<ssize_t>(total), ready};
+    }
+
+    return {static_cast<ssize_t>(total), io_status::ok};
+  }
+
+  template <typename Container>
+  ssize_t receive_some(Container &buffer, const int timeout_ms = -1) {
+    return receive_exact(buffer, timeout_ms).bytes;
+  }
+
+  /*
+    Receive exactly this object.
+   */
+  template <typename T>
+  ssize_t receive_into(T &obj, const int timeout_ms = -1) {
+    union var {
+      T obj;
+      std::array<std::byte, sizeof(T)> bytes;
+    };
+
+    var v;
+    const io_result r = receive_exact(v.bytes, timeout_ms);
+    if (r.ok())
+      obj = v.obj;
+    return r.bytes;
+  }
+
+  /*
+    Sends data with up to max_fds descriptors attached. data must not be
+    empty, on a stream socket the descriptors arrive with its first byte.
+   */
+  template <typename Container>
+  ssize_t send_fds(const Container &data, std::span<const int> fds) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    if (std::size(fds) > max_fds || std::size(data) == 0) {
+      log_failure(last_error, "Invalid descriptor message.", EINVAL);
+      return -1;
+    }
+
+    iovec iov{const_cast<void *>(static_cast<const void *>(std::data(data))),
+              std::size(data) * sizeof(*std::data(data))};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_fds)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (!fds.empty()) {
+      msg.msg_control = control;
+      msg.msg_controllen = CMSG_SPACE(sizeof(int) * std::size(fds));
+      cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+      cm->cmsg_level = SOL_SOCKET;
+      cm->cmsg_type = SCM_RIGHTS;
+      cm->cmsg_len = CMSG_LEN(sizeof(int) * std::size(fds));
+      std::memcpy(CMSG_DATA(cm), std::data(fds), sizeof(int) * std::size(fds));
+    }
+
+    ssize_t bytes_sent;
+    do {
+      bytes_sent = ::sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    } while (bytes_sent == -1 && errno == EINTR);
+
+    if (bytes_sent == -1) {
+      log_failure(last_error, "Failed to send data.");
+      return -1;
+    }
+
+    return bytes_sent;
+  }
+
+  /*
+    Receives data and any descriptors sent with it, which are appended to
+    fds (close-on-exec) and owned by the caller from then on.
+   */
+  template <typename Container>
+  ssize_t receive_fds(Container &buffer, std::vector<int> &fds) {
+    if (sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    iovec iov{std::data(buffer), std::size(buffer) * sizeof(*std::data(buffer))};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_fds)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t bytes_read;
+    do {
+      bytes_read = ::recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+    } while (bytes_read == -1 && errno == EINTR);
+
+    if (bytes_read == -1) {
+      log_failure(last_error, "Failed to receive data.");
+      return -1;
+    }
+
+    for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+        continue;
+
+      const std::size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (std::size_t i = 0; i < count; i++) {
+        int fd;
+        std::memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(fd));
+        fds.push_back(fd);
+      }
+    }
+
+    if (msg.msg_flags & MSG_CTRUNC)
+      log_warn("Descriptors dropped, more than max_fds were sent.");
+
+    return bytes_read;
+  }
+
+  bool set_nonblocking(const bool enable = true) {
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags == -1)
+      return false;
+
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(sockfd, F_SETFL, flags) != -1;
+  }
+
+  /*
+    Non-blocking variants, see tcp_socket::try_accept. These make
+    unix_socket usable with the reactor and the coroutine awaitables.
+   */
+  io_status try_accept(unix_socket &client) {
+    int fd;
+    do {
+      fd = ::accept4(sockfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    } while (fd == -1 && errno == EINTR);
+
+    if (fd == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return io_status::would_block;
+      last_error = {errno, error_domain::system};
+      return io_status::error;
+    }
+
+    client.sockfd = fd;
+    client.socktype = socktype;
+    return io_status::ok;
+  }
+
+  template <typename Container> io_result try_send(const Container &data) {
+    ssize_t bytes_sent;
+    do {
+      bytes_sent =
+          ::send(sockfd, std::data(data), std::size(data), MSG_NOSIGNAL);
+    } while (bytes_sent == -1 && errno == EINTR);
+
+    if (bytes_sent >= 0)
+      return {bytes_sent, io_status::ok};
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return {0, io_status::would_block};
+    last_error = {errno, error_domain::system};
+    return {-1, io_status::error};
+  }
+
+  template <typename Container> io_result try_receive(Container &buffer) {
+    ssize_t bytes_read;
+    do {
+      bytes_read = ::recv(sockfd, std::data(buffer), std::size(buffer), 0);
+    } while (bytes_read == -1 && errno == EINTR);
+
+    if (bytes_read > 0)
+      return {bytes_read, io_status::ok};
+    if (bytes_read == 0)
+      return {0, std::size(buffer) ? io_status::eof : io_status::ok};
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return {0, io_status::would_block};
+    last_error = {errno, error_domain::system};
+    return {-1, io_status::error};
+  }
+
+  void close() {
+    if (sockfd != -1) {
+      ::close(sockfd);
+      sockfd = -1;
+    }
+
+    if (!bound_path.empty()) {
+      ::unlink(bound_path.c_str());
+      bound_path.clear();
+    }
+  }
+
+  /*
+    Fills in a sockaddr_un, '@' selects the abstract namespace. The length
+    covers only the name, abstract names are not NUL terminated.
+   */
+  bool address(const std::string &path, sockaddr_un &addr,
+               socklen_t &addrlen) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || std::size(path) >= sizeof(addr.sun_path)) {
+      log_failure(last_error, "Invalid unix socket path.", EINVAL);
+      return false;
+    }
+
+    std::memcpy(addr.sun_path, path.data(), std::size(path));
+    if (path[0] == '@')
+      addr.sun_path[0] = '\0';
+
+    addrlen = offsetof(sockaddr_un, sun_path) + std::size(path) +
+              (path[0] == '@' ? 0 : 1);
+    return true;
+  }
+
+  int sockfd;
+  int socktype;
+  std::string bound_path;
+  net_error last_error;
+};
+
+#endif
@@ -0,0 +1,472 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "log.hpp"
+
+/*
+  Minimal io_uring ring driven through the raw syscalls, so no liburing is
+  needed. Operations are only queued by the prep calls, nothing reaches the
+  kernel until submit()/run_once(), which lets a whole batch of sends, recvs
+  and accepts go in with one io_uring_enter.
+
+  Completions follow the kernel convention: result >= 0 is the byte count
+  (or new descriptor for accept), result < 0 is -errno.
+ */
+struct uring {
+  using completion = std::function<void(int result, std::uint32_t flags)>;
+
+  uring() = default;
+  ~uring() { close(); }
+
+  uring(const uring &) = delete;
+  uring &operator=(const uring &) = delete;
+
+  /*
+    Returns false when the kernel has no (or a disabled) io_uring, or one
+    too old for what io_engine relies on, in which case the caller is
+    expected to fall back to the epoll reactor.
+   */
+  bool init(const unsigned entries = 256) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd == -1)
+      return false;
+
+    // single mmap covering both rings is all we support, it has been the
+    // norm since 5.4 and multishot ops need far newer kernels anyway.
+    // run_once bounds its wait with IORING_ENTER_EXT_ARG (5.11).
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_EXT_ARG) || !supported()) {
+      close();
+      return false;
+    }
+
+    ring_size =
+        std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                 params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ring_ptr = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (ring_ptr == MAP_FAILED) {
+      ring_ptr = nullptr;
+      close();
+      return false;
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes_ptr == MAP_FAILED) {
+      close();
+      return false;
+    }
+
+    auto *base = static_cast<char *>(ring_ptr);
+    sq_head = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+    sq_entries = params.sq_entries;
+    cq_head = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+    sqes = static_cast<io_uring_sqe *>(sqes_ptr);
+
+    local_tail = *sq_tail;
+    return true;
+  }
+
+  bool ready() const { return ring_fd != -1; }
+
+  /*
+    Whether the kernel knows every opcode used here. Flags cannot be probed,
+    so SEND_ZC stands in for them: it came with multishot recv (6.0), after
+    multishot accept and IORING_ASYNC_CANCEL_FD (5.19). Older kernels would
+    fail those with -EINVAL at runtime instead.
+   */
+  bool supported() const {
+    constexpr std::uint8_t needed[] = {
+        IORING_OP_ACCEPT,         IORING_OP_CONNECT,      IORING_OP_SEND,
+        IORING_OP_RECV,           IORING_OP_READ,         IORING_OP_TIMEOUT,
+        IORING_OP_ASYNC_CANCEL,   IORING_OP_PROVIDE_BUFFERS,
+        IORING_OP_WRITE_FIXED,    IORING_OP_READ_FIXED,   IORING_OP_SEND_ZC};
+    constexpr unsigned slots = 256;
+
+    std::vector<std::byte> storage(sizeof(io_uring_probe) +
+                                   slots * sizeof(io_uring_probe_op));
+    auto *probe = reinterpret_cast<io_uring_probe *>(std::data(storage));
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe,
+                slots) != 0)
+      return false;
+
+    return std::all_of(std::begin(needed), std::end(needed),
+                       [probe](const std::uint8_t op) {
+                         return op < probe->ops_len &&
+                                (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+                       });
+  }
+
+  bool accept(const int fd, completion fn, const bool multishot = false) {
+    io_uring_sqe *sqe = prep(IORING_OP_ACCEPT, fd, nullptr, 0, 0);
+    if (sqe == nullptr)
+      return false;
+
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    if (multishot)
+      sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = track(std::move(fn));
+    return true;
+  }
+
+  bool connect(const int fd, const sockaddr *addr, const socklen_t addrlen,
+               completion fn) {
+    // the address has to outlive the submission, keep it with the operation.
+    const std::uint64_t id = track(std::move(fn));
+    operation &op = operations[id];
+    std::memcpy(&op.addr, addr,
+                std::min<std::size_t>(addrlen, sizeof(op.addr)));
+
+    io_uring_sqe *sqe = prep(IORING_OP_CONNECT, fd, &op.addr, 0, addrlen);
+    if (sqe == nullptr) {
+      operations.erase(id);
+      return false;
+    }
+
+    sqe->user_data = id;
+    return true;
+  }
+
+  bool send(const int fd, const void *buf, const std::size_t len, completion fn,
+            const int flags = MSG_NOSIGNAL) {
+    io_uring_sqe *sqe = prep(IORING_OP_SEND, fd, buf, len, 0);
+    if (sqe == nullptr)
+      return false;
+
+    sqe->msg_flags = flags;
+    sqe->user_data = track(std::move(fn));
+    return true;
+  }
+
+  bool recv(const int fd, void *buf, const std::size_t len, completion fn,
+            const int flags = 0) {
+    io_uring_sqe *sqe = prep(IORING_OP_RECV, fd, buf, len, 0);
+    if (sqe == nullptr)
+      return false;
+
+    sqe->msg_flags = flags;
+    sqe->user_data = track(std::move(fn));
+    return true;
+  }
+
+  bool read(const int fd, void *buf, const std::size_t len, completion fn) {
+    io_uring_sqe *sqe = prep(IORING_OP_READ, fd, buf, len, 0);
+    if (sqe == nullptr)
+      return false;
+
+    sqe->user_data = track(std::move(fn));
+    return true;
+  }
+
+  /*
+    Multishot recv picks a buffer from the group registered with
+    provide_buffers() for every completion, the buffer id comes back in the
+    upper bits of the completion flags (see buffer_id()). The buffer has to
+    be handed back with provide_buffers() once consumed.
+   */
+  bool recv_multishot(const int fd, const std::uint16_t group, completion fn) {
+    io_uring_sqe *sqe = prep(IORING_OP_RECV, fd, nullptr, 0, 0);
+    if (sqe == nullptr)
+      return false;
+
+    sqe->ioprio |= IORING_RECV_MULTISHOT;
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = track(std::move(fn));
+    return true;
+  }
+
+  bool provide_buffers(void *base, const unsigned len, const unsigned count,
+                       const std::uint16_t group,
+                       const std::uint16_t first_id) {
+    io_uring_sqe *sqe = raw_sqe();
+    if (sqe == nullptr)
+      return false;
+
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = reinterpret_cast<std::uint64_t>(base);
+    sqe->len = len;
+    sqe->off = first_id;
+    sqe->buf_group = group;
+    sqe->user_data = 0;
+    return true;
+  }
+
+  static std::uint16_t buffer_id(const std::uint32_t flags) {
+    return flags >> IORING_CQE_BUFFER_SHIFT;
+  }
+
+  /*
+    Fixed buffer variants, index refers to the vector given to
+    register_buffers() and buf must lie inside that registered buffer.
+   */
+  bool write_fixed(const int fd, const void *buf, const std::size_t len,
+                   const std::uint16_t index, completion fn) {
+    io_uring_sqe *sqe = prep(IORING_OP_WRITE_FIXED, fd, buf, len, 0);
+    if (sqe == nullptr)
+      return false;
+
+    sqe->buf_index = index;
+    sqe->user_data = track(std::move(fn));
+    return true;
+  }
+
+  bool read_fixed(const int fd, void *buf, const std::size_t len,
+                  const std::uint16_t index, completion fn) {
+    io_uring_sqe *sqe = prep(IORING_OP_READ_FIXED, fd, buf, len, 0);
+    if (sqe == nullptr)
+      return false;
+
+    sqe->buf_index = index;
+    sqe->user_data = track(std::move(fn));
+    return true;
+  }
+
+  /*
+    Completes with -ETIME after ms milliseconds, used to bound a wait.
+   */
+  bool timeout(const long ms, completion fn) {
+    const std::uint64_t id = track(std::move(fn));
+    operation &op = operations[id];
+    op.ts.tv_sec = ms / 1000;
+    op.ts.tv_nsec = (ms % 1000) * 1000000;
+
+    io_uring_sqe *sqe = prep(IORING_OP_TIMEOUT, -1, &op.ts, 1, 0);
+    if (sqe == nullptr) {
+      operations.erase(id);
+      return false;
+    }
+
+    sqe->user_data = id;
+    return true;
+  }
+
+  bool cancel_fd(const int fd) {
+    io_uring_sqe *sqe = prep(IORING_OP_ASYNC_CANCEL, fd, nullptr, 0, 0);
+    if (sqe == nullptr)
+      return false;
+
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = 0;
+    return true;
+  }
+
+  bool register_buffers(const std::vector<iovec> &buffers) {
+    return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS,
+                   std::data(buffers), std::size(buffers)) == 0;
+  }
+
+  /*
+    Once registered, every operation on one of these descriptors goes
+    through the fixed file table, which saves the per-op fd lookup and
+    refcount in the kernel. The descriptors must stay open while registered.
+   */
+  bool register_files(const std::vector<int> &fds) {
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_FILES,
+                std::data(fds), std::size(fds)) != 0)
+      return false;
+
+    fixed_files.clear();
+    for (std::size_t i = 0; i < std::size(fds); i++)
+      fixed_files[fds[i]] = i;
+    return true;
+  }
+
+  /*
+    Hands every queued submission to the kernel in one call, optionally
+    waiting for wait_nr completions, for at most timeout_ms when that is
+    not -1. Running out of time is not an error.
+   */
+  int submit(const unsigned wait_nr = 0, const int timeout_ms = -1) {
+    const unsigned to_submit = local_tail - *sq_head;
+    std::atomic_ref<unsigned>(*sq_tail).store(local_tail,
+                                              std::memory_order_release);
+
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    __kernel_timespec ts{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    io_uring_getevents_arg arg{};
+    const void *argp = nullptr;
+    std::size_t argsz = 0;
+    if (wait_nr && timeout_ms >= 0) {
+      // the timeout lives in the call, nothing is left queued on the ring.
+      arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+      flags |= IORING_ENTER_EXT_ARG;
+      argp = &arg;
+      argsz = sizeof(arg);
+    }
+
+    int rc;
+    do {
+      rc = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, flags,
+                   argp, argsz);
+    } while (rc == -1 && errno == EINTR);
+
+    if (rc == -1 && errno == ETIME)
+      return 0;
+    return rc;
+  }
+
+  /*
+    Runs the completion handler of every finished operation. Handlers may
+    queue new operations, those go out with the next submit.
+   */
+  int reap() {
+    int reaped = 0;
+    unsigned head = *cq_head;
+    for (;;) {
+      const unsigned tail =
+          std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+      if (head == tail)
+        break;
+
+      const io_uring_cqe cqe = cqes[head & cq_mask];
+      head++;
+      std::atomic_ref<unsigned>(*cq_head).store(head,
+                                                std::memory_order_release);
+
+      if (cqe.user_data == 0)
+        continue;
+
+      auto it = operations.find(cqe.user_data);
+      if (it == std::end(operations))
+        continue;
+
+      // multishot operations stay armed while the kernel sets F_MORE.
+      if (cqe.flags & IORING_CQE_F_MORE) {
+        it->second.fn(cqe.res, cqe.flags);
+      } else {
+        completion fn = std::move(it->second.fn);
+        operations.erase(it);
+        fn(cqe.res, cqe.flags);
+      }
+      reaped++;
+    }
+
+    return reaped;
+  }
+
+  int run_once(const bool wait = true, const int timeout_ms = -1) {
+    if (submit(wait && operations.size() ? 1 : 0, timeout_ms) == -1 &&
+        errno != EBUSY) {
+      log_error("io_uring_enter failed.");
+      return -1;
+    }
+
+    return reap();
+  }
+
+  std::size_t pending() const { return operations.size(); }
+
+  void close() {
+    if (sqes != nullptr)
+      munmap(sqes, sqes_size);
+    if (ring_ptr != nullptr)
+      munmap(ring_ptr, ring_size);
+    if (ring_fd != -1)
+      ::close(ring_fd);
+
+    sqes = nullptr;
+    ring_ptr = nullptr;
+    ring_fd = -1;
+  }
+
+  struct operation {
+    completion fn;
+    sockaddr_storage addr;
+    __kernel_timespec ts;
+  };
+
+  io_uring_sqe *raw_sqe() {
+    // ring full, flush what is queued so far to make room.
+    if (local_tail - std::atomic_ref<unsigned>(*sq_head).load(
+                         std::memory_order_acquire) >=
+        sq_entries)
+      if (submit() <= 0)
+        return nullptr;
+
+    const unsigned index = local_tail & sq_mask;
+    io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    local_tail++;
+    return sqe;
+  }
+
+  io_uring_sqe *prep(const std::uint8_t opcode, const int fd, const void *addr,
+                     const std::size_t len, const std::uint64_t off) {
+    io_uring_sqe *sqe = raw_sqe();
+    if (sqe == nullptr)
+      return nullptr;
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(addr);
+    sqe->len = len;
+    sqe->off = off;
+
+    auto it = fixed_files.find(fd);
+    if (it != std::end(fixed_files)) {
+      sqe->fd = it->second;
+      sqe->flags |= IOSQE_FIXED_FILE;
+    }
+
+    return sqe;
+  }
+
+  std::uint64_t track(completion fn) {
+    const std::uint64_t id = ++next_id;
+    operations[id].fn = std::move(fn);
+    return id;
+  }
+
+  int ring_fd = -1;
+  void *ring_ptr = nullptr;
+  std::size_t ring_size = 0;
+  io_uring_sqe *sqes = nullptr;
+  std::size_t sqes_size = 0;
+
+  unsigned *sq_head = nullptr;
+  unsigned *sq_tail = nullptr;
+  unsigned *sq_array = nullptr;
+  unsigned sq_mask = 0;
+  unsigned sq_entries = 0;
+  unsigned local_tail = 0;
+
+  unsigned *cq_head = nullptr;
+  unsigned *cq_tail = nullptr;
+  unsigned cq_mask = 0;
+  io_uring_cqe *cqes = nullptr;
+
+  std::uint64_t next_id = 0;
+  std::unordered_map<std::uint64_t, operation> operations;
+  std::unordered_map<int, unsigned> fixed_files;
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef WORK_QUEUE_HPP
+#define WORK_QUEUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+/*
+  Lock-free queues used by the runtime to hand work between threads.
+ */
+
+/*
+  Unbounded multi-producer single-consumer queue (Vyukov). push never
+  blocks and touches one shared word, pop is only called by the owning
+  thread.
+
+  pop can briefly miss an element whose push is still in progress, so
+  a producer must signal the consumer after push returns, not before.
+ */
+template <typename T> struct mpsc_queue {
+  struct node {
+    std::atomic<node *> next = nullptr;
+    T value{};
+  };
+
+  mpsc_queue() : head(new node), tail(head.load()) {}
+
+  ~mpsc_queue() {
+    while (pop())
+      ;
+    delete tail;
+  }
+
+  mpsc_queue(const mpsc_queue &) = delete;
+  mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+  void push(T value) {
+    node *n = new node;
+    n->value = std::move(value);
+    node *prev = head.exchange(n, std::memory_order_acq_rel);
+    prev->next.store(n, std::memory_order_release);
+  }
+
+  std::optional<T> pop() {
+    node *next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+      return std::nullopt;
+
+    // next becomes the new stub, its value moves out.
+    std::optional<T> value(std::move(next->value));
+    delete tail;
+    tail = next;
+    return value;
+  }
+
+  bool empty() const {
+    return tail->next.load(std::memory_order_acquire) == nullptr;
+  }
+
+  std::atomic<node *> head;
+  node *tail;
+};
+
+/*
+  Chase-Lev work-stealing deque (the C11 formulation of Lê et al.). The
+  owning thread pushes and pops at the bottom without contention, other
+  threads steal from the top and only race on the last element.
+
+  T must be a trivially copyable handle, typically a pointer. The array
+  doubles when full, retired arrays are kept until destruction since a
+  thief may still be reading one.
+ */
+template <typename T> struct work_stealing_deque {
+  struct array {
+    explicit array(const std::int64_t n)
+        : capacity(n), slots(new std::atomic<T>[n]) {}
+
+    T get(const std::int64_t i) const {
+      return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+    void put(const std::int64_t i, const T v) {
+      slots[i & (capacity - 1)].store(v, std::memory_order_relaxed);
+    }
+
+    std::int64_t capacity;
+    std::unique_ptr<std::atomic<T>[]> slots;
+  };
+
+  explicit work_stealing_deque(const std::int64_t capacity = 256) {
+    retired.push_back(std::make_unique<array>(capacity));
+    buffer.store(retired.back().get(), std::memory_order_relaxed);
+  }
+
+  work_stealing_deque(const work_stealing_deque &) = delete;
+  work_stealing_deque &operator=(const work_stealing_deque &) = delete;
+
+  /*
+    Owner only.
+   */
+  void push(const T v) {
+    const std::int64_t b = bottom.load(std::memory_order_relaxed);
+    const std::int64_t t = top.load(std::memory_order_acquire);
+    array *a = buffer.load(std::memory_order_relaxed);
+    if (b - t > a->capacity - 1)
+      a = grow(a, b, t);
+
+    a->put(b, v);
+    // a release store rather than the paper's fence, same code on x86 and
+    // visible to thread sanitizer.
+    bottom.store(b + 1, std::memory_order_release);
+  }
+
+  /*
+    Owner only, newest first.
+   */
+  std::optional<T> pop() {
+    const std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    array *a = buffer.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+
+    std::optional<T> v = a->get(b);
+    if (t == b) {
+      // last element, race the thieves for it.
+      if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+        v.reset();
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    return v;
+  }
+
+  /*
+    Any thread, oldest first. Empty also when it lost a race.
+   */
+  std::optional<T> steal() {
+    std::int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const std::int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b)
+      return std::nullopt;
+
+    const T v = buffer.load(std::memory_order_acquire)->get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      return std::nullopt;
+
+    return v;
+  }
+
+  std::int64_t size() const {
+    return bottom.load(std::memory_order_relaxed) -
+           top.load(std::memory_order_relaxed);
+  }
+
+  array *grow(array *a, const std::int64_t b, const std::int64_t t) {
+    auto bigger = std::make_unique<array>(a->capacity * 2);
+    for (std::int64_t i = t; i < b; i++)
+      bigger->put(i, a->get(i));
+
+    a = bigger.get();
+    retired.push_back(std::move(bigger));
+    buffer.store(a, std::memory_order_release);
+    return a;
+  }
+
+  alignas(64) std::atomic<std::int64_t> top = 0;
+  alignas(64) std::atomic<std::int64_t> bottom = 0;
+  std::atomic<array *> buffer;
+  std::vector<std::unique_ptr<array>> retired;
+};
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef ZEROCOPY_HPP
+#define ZEROCOPY_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "endpoint.hpp"
+#include "io_result.hpp"
+#include "log.hpp"
+
+/*
+  MSG_ZEROCOPY transmit path for tcp_socket and udp_socket. The kernel pins
+  the caller's pages instead of copying them, so a buffer must not be
+  modified or freed until its completion has run. Completions are read from
+  the socket error queue by poll_completions()/drain(), each buffer gets
+  exactly one, with copied set when the kernel fell back to copying anyway
+  (always the case over loopback).
+
+  Buffers below threshold are sent the ordinary way and complete
+  immediately, pinning pages only pays off for large payloads.
+ */
+template <typename Socket> struct zerocopy_sender {
+  using completion = std::function<void(bool copied)>;
+
+  explicit zerocopy_sender(Socket &s, const std::size_t min_size = 16384)
+      : sock(s), threshold(min_size) {}
+
+  bool enable() {
+    const int on = 1;
+    if (setsockopt(sock.sockfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) <
+        0) {
+      log_failure(last_error, "Failed to enable SO_ZEROCOPY.");
+      return false;
+    }
+
+    enabled = true;
+    return true;
+  }
+
+  /*
+    Stream send, keeps going after short writes so the whole buffer is
+    queued before returning. Returns the byte count or -1, fn runs once
+    the kernel has released every page of data.
+   */
+  template <typename Container>
+  ssize_t send(const Container &data, completion fn) {
+    return submit(std::data(data), std::size(data) * sizeof(*std::data(data)),
+                  nullptr, std::move(fn));
+  }
+
+  template <typename Container> std::future<bool> send(const Container &data) {
+    auto done = std::make_shared<std::promise<bool>>();
+    std::future<bool> result = done->get_future();
+    if (send(data, [done](bool copied) { done->set_value(copied); }) == -1)
+      return {};
+    return result;
+  }
+
+  /*
+    Datagram send for udp_socket, one completion per datagram.
+   */
+  template <typename Container>
+  ssize_t send_to(const Container &data, const endpoint &to, completion fn) {
+    return submit(std::data(data), std::size(data) * sizeof(*std::data(data)),
+                  &to, std::move(fn));
+  }
+
+  template <typename Container>
+  std::future<bool> send_to(const Container &data, const endpoint &to) {
+    auto done = std::make_shared<std::promise<bool>>();
+    std::future<bool> result = done->get_future();
+    if (send_to(data, to, [done](bool copied) { done->set_value(copied); }) ==
+        -1)
+      return {};
+    return result;
+  }
+
+  /*
+    Reads every notification currently on the error queue without
+    blocking. Returns the number of buffers completed.
+   */
+  int poll_completions() {
+    int completed = 0;
+    for (;;) {
+      alignas(cmsghdr) char control[CMSG_SPACE(sizeof(sock_extended_err)) +
+                                    CMSG_SPACE(sizeof(sockaddr_in6))];
+      msghdr msg{};
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      if (::recvmsg(sock.sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+
+      for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+           cm = CMSG_NXTHDR(&msg, cm)) {
+        const bool recverr =
+            (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+        if (!recverr)
+          continue;
+
+        sock_extended_err err;
+        std::memcpy(&err, CMSG_DATA(cm), sizeof(err));
+        if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0)
+          continue;
+
+        completed += acknowledge(err.ee_info, err.ee_data,
+                                 err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+      }
+    }
+
+    return completed;
+  }
+
+  /*
+    Blocks until every in-flight buffer has completed or timeout_ms passes.
+    Returns true when nothing is left in flight.
+   */
+  bool drain(const int timeout_ms = -1) {
+    while (!in_flight.empty()) {
+      // error queue readiness is always reported, no event bits needed.
+      pollfd pfd{sock.sockfd, 0, 0};
+      const int rc = ::poll(&pfd, 1, timeout_ms);
+      if (rc == -1 && errno == EINTR)
+        continue;
+      if (rc <= 0)
+        return false;
+
+      poll_completions();
+    }
+
+    return true;
+  }
+
+  std::size_t pending() const { return in_flight.size(); }
+
+  /*
+    Every successful MSG_ZEROCOPY syscall gets the next id from a per-socket
+    counter, notifications then acknowledge a range of ids. A buffer may
+    have taken several syscalls, it completes when all of its ids have been
+    acknowledged. Ids are 32-bit, wraparound after 2^32 sends is not handled.
+   */
+  struct pending_send {
+    std::uint32_t first;
+    std::uint32_t last;
+    std::uint32_t remaining;
+    bool copied;
+    completion fn;
+  };
+
+  ssize_t submit(const void *buf, const std::size_t len, const endpoint *to,
+                 completion fn) {
+    if (sock.sockfd == -1) {
+      log_failure(last_error, "Socket not connected.", ENOTCONN);
+      return -1;
+    }
+
+    const int flags =
+        MSG_NOSIGNAL | (enabled && len >= threshold ? MSG_ZEROCOPY : 0);
+    const std::uint32_t first = next_id;
+    const auto *bytes = static_cast<const char *>(buf);
+    std::size_t total = 0;
+    bool copied = !(flags & MSG_ZEROCOPY);
+
+    do {
+      ssize_t sent;
+      if (to != nullptr)
+        sent = ::sendto(sock.sockfd, bytes + total, len - total,
+                        copied ? MSG_NOSIGNAL : flags, &to->addr, to->addrlen);
+      else
+        sent = ::send(sock.sockfd, bytes + total, len - total,
+                      copied ? MSG_NOSIGNAL : flags);
+
+      if (sent == -1) {
+        if (errno == EINTR)
+          continue;
+        // out of optmem for pinned pages, reap what we can and copy.
+        if (errno == ENOBUFS && !copied) {
+          poll_completions();
+          copied = true;
+          continue;
+        }
+        log_failure(last_error, "Failed to send data.");
+        if (next_id == first)
+          return -1;
+        break;
+      }
+
+      if (!copied)
+        next_id++;
+      total += sent;
+    } while (to == nullptr && total < len);
+
+    if (next_id == first) {
+      fn(true);
+      return total;
+    }
+
+    in_flight.push_back(
+        {first, next_id - 1, next_id - first, copied, std::move(fn)});
+    return total;
+  }
+
+  int acknowledge(const std::uint32_t lo, const std::uint32_t hi,
+                  const bool copied) {
+    // callbacks may send again, so run them only once the deque is settled.
+    std::vector<std::pair<completion, bool>> done;
+    for (auto &entry : in_flight) {
+      if (entry.first > hi)
+        break;
+      if (entry.last < lo || entry.remaining == 0)
+        continue;
+
+      entry.remaining -=
+          std::min(entry.last, hi) - std::max(entry.first, lo) + 1;
+      entry.copied |= copied;
+      if (entry.remaining == 0)
+        done.emplace_back(std::move(entry.fn), entry.copied);
+    }
+
+    while (!in_flight.empty() && in_flight.front().remaining == 0)
+      in_flight.pop_front();
+
+    for (auto &[fn, was_copied] : done)
+      fn(was_copied);
+
+    return std::size(done);
+  }
+
+  Socket &sock;
+  std::size_t threshold;
+  bool enabled = false;
+  std::uint32_t next_id = 0;
+  std::deque<pending_send> in_flight;
+  // why enable() or the last send failed, as on the socket wrappers.
+  net_error last_error;
+};
+
+#endif
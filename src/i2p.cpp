@@ -1,5 +1,6 @@
 
 #include "i2p.hpp"
+#include "log.hpp"
 #include "api.h"
 #include "util.h"
 
@@ -56,9 +57,8 @@ void add_incoming_i2p_stream(std::shared_ptr<i2p::stream::Stream> stream) {
 
 void i2p_session::handle_accept(std::shared_ptr<i2p::stream::Stream> stream) {
   if (stream) {
-    std::cerr << "Incoming Connection From: "
-              << stream->GetRemoteIdentity()->GetIdentHash().ToBase32()
-              << std::endl;
+    log_info("Incoming Connection From: ",
+             stream->GetRemoteIdentity()->GetIdentHash().ToBase32());
     add_incoming_i2p_stream(stream);
   }
 }